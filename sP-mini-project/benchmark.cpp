@@ -1,18 +1,95 @@
 #include <ranges>
 #include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <sstream>
+#include <vector>
 #include <benchmark/benchmark.h>
 #include "library/stosim.hpp"
+#include "library/LockstepEnsemble.hpp"
+#include "library/TrajectoryFile.hpp"
 #include "samples.hpp"
 
+//Every allocation goes through these, so the benchmarks can report how much memory they use.
+//The counting is only switched on for the extra run Google Benchmark makes for the memory manager
+namespace {
+	std::atomic<bool> tracking_allocations = false;
+	std::atomic<std::int64_t> allocation_count = 0;
+	std::atomic<std::int64_t> allocated_bytes = 0;
+	std::atomic<std::int64_t> live_bytes = 0;
+	std::atomic<std::int64_t> peak_bytes = 0;
+
+	class AllocationTracker : public benchmark::MemoryManager {
+	public:
+		void Start() override {
+			allocation_count = 0;
+			allocated_bytes = 0;
+			live_bytes = 0;
+			peak_bytes = 0;
+			tracking_allocations = true;
+		}
+
+		void Stop(Result& result) override {
+			tracking_allocations = false;
+			result.num_allocs = allocation_count;
+			result.max_bytes_used = peak_bytes;
+			result.total_allocated_bytes = allocated_bytes;
+			result.net_heap_growth = live_bytes;
+		}
+
+		void Stop(Result* result) override {
+			Stop(*result);
+		}
+	};
+}
+
+/* The size is kept in front of the block, so the delete can count it */
+void* operator new(std::size_t size) {
+	auto* block = static_cast<std::max_align_t*>(std::malloc(size + sizeof(std::max_align_t)));
+	if (block == nullptr) {
+		throw std::bad_alloc();
+	}
+	*reinterpret_cast<std::size_t*>(block) = size;
+	if (tracking_allocations.load(std::memory_order_relaxed)) {
+		allocation_count.fetch_add(1, std::memory_order_relaxed);
+		allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+		auto live = live_bytes.fetch_add(size, std::memory_order_relaxed) + static_cast<std::int64_t>(size);
+		auto peak = peak_bytes.load(std::memory_order_relaxed);
+		while (live > peak && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+	}
+	return block + 1;
+}
+
+void operator delete(void* pointer) noexcept {
+	if (pointer == nullptr) {
+		return;
+	}
+	auto* block = static_cast<std::max_align_t*>(pointer) - 1;
+	if (tracking_allocations.load(std::memory_order_relaxed)) {
+		live_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(block), std::memory_order_relaxed);
+	}
+	std::free(block);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+	operator delete(pointer);
+}
+
 //Requirement 10: benchmarking single threaded for covid19 100 times
-void single_threaded(benchmark::State& agent_count) {
+void single_threaded(benchmark::State& agent_count, stosim::SimulationAlgorithm algorithm) {
 	auto vessel = covid19(10000);
+	vessel.compile();
 	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
 	for (auto _ : agent_count) {
 		stosim::agent_count_t total = 0;
 		for (size_t i = 0; i < 100; i++) {
 			total += std::ranges::max(
-				vessel.simulate() |
+				vessel.simulate(i, algorithm) |
 				std::views::take_while([](const auto& state) { return state.time < 100; }) |
 				std::views::transform([&](const auto& state) { return state.agent_count[H_token]; })
 			);
@@ -22,11 +99,284 @@ void single_threaded(benchmark::State& agent_count) {
 	}
 }
 
-BENCHMARK(single_threaded);
+BENCHMARK_CAPTURE(single_threaded, first_reaction, stosim::SimulationAlgorithm::first_reaction);
+BENCHMARK_CAPTURE(single_threaded, next_reaction, stosim::SimulationAlgorithm::next_reaction);
+BENCHMARK_CAPTURE(single_threaded, direct, stosim::SimulationAlgorithm::direct);
+BENCHMARK_CAPTURE(single_threaded, composition_rejection, stosim::SimulationAlgorithm::composition_rejection);
+BENCHMARK_CAPTURE(single_threaded, tau_leaping, stosim::SimulationAlgorithm::tau_leaping);
+BENCHMARK_CAPTURE(single_threaded, hybrid, stosim::SimulationAlgorithm::hybrid);
+
+//The same as single_threaded, with the time horizon checked in the event loop instead of by take_while
+void single_threaded_stop_condition(benchmark::State& agent_count, stosim::SimulationAlgorithm algorithm) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
+	for (auto _ : agent_count) {
+		stosim::agent_count_t total = 0;
+		for (size_t i = 0; i < 100; i++) {
+			total += std::ranges::max(
+				stosim::trajectory(vessel.start(i, algorithm), { .time_horizon = 100 }) |
+				std::views::transform([&](const auto& state) { return state.agent_count[H_token]; })
+			);
+		}
+		benchmark::DoNotOptimize(total);
+		benchmark::ClobberMemory();
+	}
+}
+
+BENCHMARK_CAPTURE(single_threaded_stop_condition, direct, stosim::SimulationAlgorithm::direct);
+
+//A bounded run that only needs the final state does not go through a generator at all
+void single_threaded_run(benchmark::State& agent_count, stosim::SimulationAlgorithm algorithm) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto R_token = vessel.get_reaction_symbols().lookup_by_value("R");
+	for (auto _ : agent_count) {
+		stosim::agent_count_t total = 0;
+		for (size_t i = 0; i < 100; i++) {
+			auto simulation = vessel.start(i, algorithm);
+			simulation.run({ .time_horizon = 100 });
+			total += simulation.state().agent_count[R_token];
+		}
+		benchmark::DoNotOptimize(total);
+		benchmark::ClobberMemory();
+	}
+}
+
+BENCHMARK_CAPTURE(single_threaded_run, direct, stosim::SimulationAlgorithm::direct);
+
+//The same as single_threaded, looking at the state every 0.1 time units instead of after every event
+void single_threaded_sampled(benchmark::State& agent_count, stosim::SimulationAlgorithm algorithm) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
+	for (auto _ : agent_count) {
+		stosim::agent_count_t total = 0;
+		for (size_t i = 0; i < 100; i++) {
+			total += std::ranges::max(
+				stosim::sample(vessel.start(i, algorithm), { .step = 0.1, .end = 100 }) |
+				std::views::transform([&](const auto& state) { return state.agent_count[H_token]; })
+			);
+		}
+		benchmark::DoNotOptimize(total);
+		benchmark::ClobberMemory();
+	}
+}
+
+BENCHMARK_CAPTURE(single_threaded_sampled, direct, stosim::SimulationAlgorithm::direct);
+
+//The same as single_threaded, with the network fixed at compile time
+void single_threaded_static(benchmark::State& agent_count) {
+	auto vessel = covid19_static(10000);
+	for (auto _ : agent_count) {
+		stosim::agent_count_t total = 0;
+		for (size_t i = 0; i < 100; i++) {
+			total += std::ranges::max(
+				vessel.simulate(i) |
+				std::views::take_while([](const auto& state) { return state.time < 100; }) |
+				std::views::transform([&](const auto& state) { return state.agent_count[3]; })
+			);
+		}
+		benchmark::DoNotOptimize(total);
+		benchmark::ClobberMemory();
+	}
+}
+
+BENCHMARK(single_threaded_static);
+
+//Circadian rhythm has 16 rules, the dynamic direct method against the compile time network
+void circadian_rhythm_dynamic(benchmark::State& agent_count) {
+	auto vessel = circadian_rhythm();
+	vessel.compile();
+	for (auto _ : agent_count) {
+		double total = 0;
+		for (const auto& state : vessel.simulate(1, stosim::SimulationAlgorithm::direct) | std::views::take_while([](const auto& state) { return state.time < 10; })) {
+			total += state.agent_count[8];
+		}
+		benchmark::DoNotOptimize(total);
+	}
+}
+
+BENCHMARK(circadian_rhythm_dynamic);
+
+void circadian_rhythm_static_network(benchmark::State& agent_count) {
+	auto vessel = circadian_rhythm_static();
+	for (auto _ : agent_count) {
+		double total = 0;
+		for (const auto& state : vessel.simulate(1) | std::views::take_while([](const auto& state) { return state.time < 10; })) {
+			total += state.agent_count[8];
+		}
+		benchmark::DoNotOptimize(total);
+	}
+}
+
+BENCHMARK(circadian_rhythm_static_network);
+
+//The same as single_threaded, with the replicas run in lockstep on one thread
+void single_threaded_lockstep(benchmark::State& agent_count) {
+	auto vessel = covid19(10000);
+	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
+	auto ensemble = stosim::LockstepEnsemble<8>(*vessel.compile(), vessel.get_initial_state());
+	std::vector<stosim::agent_count_t> peaks(100);
+	for (auto _ : agent_count) {
+		std::ranges::fill(peaks, 0);
+		ensemble.run(peaks.size(), 0, 100, [&](std::size_t replica, double time, const auto& counts) {
+			peaks[replica] = std::max(peaks[replica], counts[H_token]);
+		});
+		stosim::agent_count_t total = std::ranges::fold_left(peaks, 0, std::plus<>{});
+		benchmark::DoNotOptimize(total);
+		benchmark::ClobberMemory();
+	}
+}
+
+BENCHMARK(single_threaded_lockstep);
+
+//The three ways of looking at every event of figure 1, where the work per event is small
+void figure1_generator(benchmark::State& agent_count) {
+	auto vessel = figure1();
+	vessel.compile();
+	for (auto _ : agent_count) {
+		double total = 0;
+		for (const auto& state : vessel.simulate(1, stosim::SimulationAlgorithm::direct)) {
+			total += state.time;
+		}
+		benchmark::DoNotOptimize(total);
+	}
+}
+
+BENCHMARK(figure1_generator);
+
+void figure1_observer(benchmark::State& agent_count) {
+	auto vessel = figure1();
+	vessel.compile();
+	for (auto _ : agent_count) {
+		double total = 0;
+		vessel.start(1, stosim::SimulationAlgorithm::direct).run({}, [&](const stosim::VesselState& state, std::size_t) { total += state.time; });
+		benchmark::DoNotOptimize(total);
+	}
+}
+
+BENCHMARK(figure1_observer);
+
+void figure1_batched(benchmark::State& agent_count) {
+	auto vessel = figure1();
+	vessel.compile();
+	for (auto _ : agent_count) {
+		double total = 0;
+		for (auto batch : stosim::batches(vessel.start(1, stosim::SimulationAlgorithm::direct), 256)) {
+			for (const auto& record : batch) {
+				total += record.time;
+			}
+		}
+		benchmark::DoNotOptimize(total);
+	}
+}
+
+BENCHMARK(figure1_batched);
+
+//Writing and reading back every event of a covid19 trajectory
+void trajectory_file_write(benchmark::State& agent_count) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto path = std::filesystem::temp_directory_path() / "stosim_bm.stj";
+	std::size_t events = 0;
+	for (auto _ : agent_count) {
+		auto writer = stosim::TrajectoryWriter(path, vessel);
+		vessel.start(1, stosim::SimulationAlgorithm::direct).run({ .time_horizon = 100 }, [&](const stosim::VesselState& state, std::size_t) { writer.write(state); events++; });
+		writer.close();
+	}
+	agent_count.SetItemsProcessed(events);
+}
+
+BENCHMARK(trajectory_file_write);
+
+void trajectory_file_read(benchmark::State& agent_count) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
+	auto path = std::filesystem::temp_directory_path() / "stosim_bm_read.stj";
+	{
+		auto writer = stosim::TrajectoryWriter(path, vessel);
+		vessel.start(1, stosim::SimulationAlgorithm::direct).run({ .time_horizon = 100 }, writer);
+	}
+	auto reader = stosim::TrajectoryReader(path);
+	for (auto _ : agent_count) {
+		stosim::agent_count_t peak = 0;
+		for (const auto& count : reader.counts(H_token)) {
+			peak = std::max(peak, count.count);
+		}
+		benchmark::DoNotOptimize(peak);
+	}
+	agent_count.SetItemsProcessed(agent_count.iterations() * reader.event_count());
+}
+
+BENCHMARK(trajectory_file_read);
+
+//Recording covid19 as an event log and replaying it, with the bytes it takes per event
+void event_log_record(benchmark::State& agent_count) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	std::size_t events = 0;
+	std::size_t bytes = 0;
+	for (auto _ : agent_count) {
+		auto simulation = vessel.start(1, stosim::SimulationAlgorithm::direct);
+		auto log = stosim::EventLog(simulation);
+		simulation.run({ .time_horizon = 100 }, log);
+		events += log.event_count();
+		bytes += log.memory_size();
+	}
+	agent_count.SetItemsProcessed(events);
+	agent_count.counters["bytes_per_event"] = static_cast<double>(bytes) / static_cast<double>(events);
+}
+
+BENCHMARK(event_log_record);
+
+void event_log_replay(benchmark::State& agent_count) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
+	auto simulation = vessel.start(1, stosim::SimulationAlgorithm::direct);
+	auto log = stosim::EventLog(simulation);
+	simulation.run({ .time_horizon = 100 }, log);
+	for (auto _ : agent_count) {
+		stosim::agent_count_t peak = 0;
+		for (const auto& state : log.replay(25, 75)) {
+			peak = std::max(peak, state.agent_count[H_token]);
+		}
+		benchmark::DoNotOptimize(peak);
+	}
+}
+
+BENCHMARK(event_log_replay);
+
+//What the engines do per event, only counted in stosim_bm_instrumented. Comparing the other
+//benchmarks of stosim_bm and stosim_bm_instrumented shows what the counting costs
+void single_threaded_measure(benchmark::State& agent_count, stosim::SimulationAlgorithm algorithm) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto pool = stosim::WorkStealingPool(1);
+	stosim::SimulationStatistics statistics;
+	for (auto _ : agent_count) {
+		statistics.merge(vessel.measure(1, { .time_horizon = 100 }, algorithm, { .pool = &pool, .seed = 1 }));
+	}
+	agent_count.SetLabel(stosim::instrumentation_enabled ? "instrumented" : "not instrumented");
+	if (statistics.events > 0) {
+		auto events = static_cast<double>(statistics.events);
+		agent_count.counters["events_per_second"] = statistics.events_per_second();
+		agent_count.counters["propensities_per_event"] = static_cast<double>(statistics.propensity_evaluations) / events;
+		agent_count.counters["draws_per_event"] = static_cast<double>(statistics.random_draws) / events;
+		agent_count.counters["queue_updates_per_event"] = static_cast<double>(statistics.queue_updates) / events;
+	}
+}
+
+BENCHMARK_CAPTURE(single_threaded_measure, direct, stosim::SimulationAlgorithm::direct);
+BENCHMARK_CAPTURE(single_threaded_measure, next_reaction, stosim::SimulationAlgorithm::next_reaction);
+BENCHMARK_CAPTURE(single_threaded_measure, composition_rejection, stosim::SimulationAlgorithm::composition_rejection);
 
 //Requirement 10: benchmarking multithreaded threaded for covid19 100 times
 void multi_threaded(benchmark::State& agent_count) {
 	auto vessel = covid19(10000);
+	vessel.compile();
 	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
 	for (auto _ : agent_count) {
 		auto simulation_results = vessel.multi_simulate(100, [=](auto simulation) -> stosim::agent_count_t {
@@ -34,7 +384,7 @@ void multi_threaded(benchmark::State& agent_count) {
 				std::views::take_while([](const auto& state) { return state.time < 100; }) |
 				std::views::transform([&](const auto& state) ->  stosim::agent_count_t { return state.agent_count[H_token]; })
 			);
-		});
+		}, stosim::SimulationAlgorithm::first_reaction, { .seed = 1 });
 
 		stosim::agent_count_t total = std::ranges::fold_left(simulation_results, 0,
 			[](stosim::agent_count_t acc, stosim::agent_count_t next) { return acc + next; });
@@ -45,4 +395,416 @@ void multi_threaded(benchmark::State& agent_count) {
 
 BENCHMARK(multi_threaded);
 
-BENCHMARK_MAIN();
\ No newline at end of file
+//The same as multi_threaded, with the peaks reduced on the worker threads
+void multi_threaded_reduce(benchmark::State& agent_count) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
+	for (auto _ : agent_count) {
+		auto peaks = vessel.reduce(100, stosim::PeakStatistics(H_token), { .time_horizon = 100 }, stosim::SimulationAlgorithm::first_reaction, { .seed = 1 });
+		benchmark::DoNotOptimize(peaks.value().mean());
+		benchmark::ClobberMemory();
+	}
+}
+
+BENCHMARK(multi_threaded_reduce);
+
+//The same as multi_threaded, with the states going through a pipeline to a sink finding the peaks
+void multi_threaded_pipeline(benchmark::State& agent_count) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
+	double producer_waits = 0;
+	double idle_waits = 0;
+	for (auto _ : agent_count) {
+		std::vector<stosim::agent_count_t> peaks(100, 0);
+		auto pipeline = stosim::StatePipeline({
+			{ "peaks", [&](const stosim::StateBatch& batch) {
+				for (const auto& state : batch.states) {
+					peaks[batch.simulation] = std::max(peaks[batch.simulation], state.agent_count[H_token]);
+				}
+			} }
+		});
+		vessel.simulate_into(pipeline, 100, { .time_horizon = 100 }, stosim::SimulationAlgorithm::first_reaction, { .seed = 1 });
+		pipeline.close();
+		auto statistics = pipeline.statistics();
+		producer_waits += static_cast<double>(statistics[0].producer_waits);
+		idle_waits += static_cast<double>(statistics[0].idle_waits);
+		benchmark::DoNotOptimize(peaks.data());
+		benchmark::ClobberMemory();
+	}
+	agent_count.counters["producer_waits"] = benchmark::Counter(producer_waits, benchmark::Counter::kAvgIterations);
+	agent_count.counters["idle_waits"] = benchmark::Counter(idle_waits, benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(multi_threaded_pipeline);
+
+//Many short simulations, which used to start a thread per simulation
+void multi_threaded_many_simulations(benchmark::State& agent_count) {
+	auto vessel = covid19(100);
+	vessel.compile();
+	auto H_token = vessel.get_reaction_symbols().lookup_by_value("H");
+	for (auto _ : agent_count) {
+		stosim::agent_count_t total = 0;
+		for (auto peak : vessel.multi_simulate(10000, [=](auto simulation) -> stosim::agent_count_t {
+			return std::ranges::max(simulation |
+				std::views::take_while([](const auto& state) { return state.time < 100; }) |
+				std::views::transform([&](const auto& state) -> stosim::agent_count_t { return state.agent_count[H_token]; })
+			);
+		}, stosim::SimulationAlgorithm::direct, { .seed = 1 })) {
+			total += peak;
+		}
+		benchmark::DoNotOptimize(total);
+		benchmark::ClobberMemory();
+	}
+}
+
+BENCHMARK(multi_threaded_many_simulations);
+
+//Registering many agents, one at a time and all at once, and naming every count of a state
+void many_agents(benchmark::State& agent_count) {
+	const auto count = static_cast<std::size_t>(agent_count.range(0));
+	for (auto _ : agent_count) {
+		auto vessel = stosim::Vessel("many agents");
+		for (std::size_t i = 0; i < count; i++) {
+			vessel.add("X" + std::to_string(i), i);
+		}
+		benchmark::DoNotOptimize(vessel.get_initial_state().data());
+	}
+	agent_count.SetItemsProcessed(agent_count.iterations() * count);
+}
+
+BENCHMARK(many_agents)->Arg(1000)->Arg(100000);
+
+void many_agents_at_once(benchmark::State& agent_count) {
+	const auto count = static_cast<std::size_t>(agent_count.range(0));
+	for (auto _ : agent_count) {
+		std::vector<std::pair<std::string, stosim::agent_count_t>> agents;
+		for (std::size_t i = 0; i < count; i++) {
+			agents.emplace_back("X" + std::to_string(i), i);
+		}
+		auto vessel = stosim::Vessel("many agents");
+		vessel.add(std::move(agents));
+		benchmark::DoNotOptimize(vessel.get_initial_state().data());
+	}
+	agent_count.SetItemsProcessed(agent_count.iterations() * count);
+}
+
+BENCHMARK(many_agents_at_once)->Arg(1000)->Arg(100000);
+
+void translate_state(benchmark::State& agent_count) {
+	auto vessel = synthetic(1000, 2000, 1000, 100 * 1000);
+	const auto& state = vessel.get_initial_state();
+	for (auto _ : agent_count) {
+		std::size_t total = 0;
+		for (const auto& [name, count] : vessel.translate_state(state)) {
+			total += name.size() + count;
+		}
+		benchmark::DoNotOptimize(total);
+	}
+	agent_count.SetItemsProcessed(agent_count.iterations() * state.size());
+}
+
+BENCHMARK(translate_state);
+
+//The scaling suite: every engine on synthetic networks of different shapes, every way of looking
+//at a simulation, and multi_simulate on 1 to N threads. Every simulation has a fixed seed, so
+//two runs do the same work, and the memory manager in main reports what each of them allocates
+constexpr std::size_t scaling_events = 20000;
+
+void set_event_counters(benchmark::State& agent_count, std::size_t events) {
+	agent_count.counters["events_per_second"] = benchmark::Counter(static_cast<double>(events), benchmark::Counter::kIsRate);
+	agent_count.counters["seconds_per_event"] = benchmark::Counter(static_cast<double>(events), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+void engine_scaling(benchmark::State& agent_count, stosim::SimulationAlgorithm algorithm) {
+	auto vessel = synthetic(agent_count.range(0), agent_count.range(1), agent_count.range(2), agent_count.range(3));
+	vessel.compile();
+	std::size_t events = 0;
+	for (auto _ : agent_count) {
+		auto simulation = vessel.start(1, algorithm);
+		simulation.run({ .event_budget = scaling_events });
+		events += simulation.events();
+		benchmark::DoNotOptimize(simulation.state().time);
+	}
+	set_event_counters(agent_count, events);
+}
+
+//More agents and rules, rules that touch more of the network, a lattice instead of random wiring, and larger populations
+void engine_scaling_shapes(benchmark::internal::Benchmark* benchmark) {
+	benchmark->ArgNames({ "species", "rules", "connectivity", "population" });
+	for (std::int64_t species : { 10, 100, 1000 }) {
+		for (std::int64_t rules_per_species : { 2, 8 }) {
+			benchmark->Args({ species, rules_per_species * species, species, 100 * species });
+		}
+	}
+	benchmark->Args({ 1000, 2000, 4, 100 * 1000 });
+	benchmark->Args({ 100, 200, 100, 10 * 100 });
+	benchmark->Args({ 100, 200, 100, 10000 * 100 });
+}
+
+BENCHMARK_CAPTURE(engine_scaling, first_reaction, stosim::SimulationAlgorithm::first_reaction)->Apply(engine_scaling_shapes);
+BENCHMARK_CAPTURE(engine_scaling, next_reaction, stosim::SimulationAlgorithm::next_reaction)->Apply(engine_scaling_shapes);
+BENCHMARK_CAPTURE(engine_scaling, direct, stosim::SimulationAlgorithm::direct)->Apply(engine_scaling_shapes);
+BENCHMARK_CAPTURE(engine_scaling, composition_rejection, stosim::SimulationAlgorithm::composition_rejection)->Apply(engine_scaling_shapes);
+BENCHMARK_CAPTURE(engine_scaling, tau_leaping, stosim::SimulationAlgorithm::tau_leaping)->Apply(engine_scaling_shapes);
+BENCHMARK_CAPTURE(engine_scaling, hybrid, stosim::SimulationAlgorithm::hybrid)->Apply(engine_scaling_shapes);
+
+enum class Observation {
+	run,
+	observer,
+	generator,
+	batches,
+	samples,
+	event_log,
+	trajectory_file,
+	pipeline,
+};
+
+//The same simulation looked at in every way there is
+void observation(benchmark::State& agent_count, Observation observation) {
+	auto vessel = synthetic(100, 200, 100, 100 * 100);
+	vessel.compile();
+	const auto algorithm = stosim::SimulationAlgorithm::direct;
+	const auto stop = stosim::StopCondition{ .event_budget = scaling_events };
+	auto first = vessel.start(1, algorithm);
+	first.run(stop);
+	const auto grid = stosim::TimeGrid{ .step = first.state().time / 1000, .end = first.state().time };
+	const auto path = std::filesystem::temp_directory_path() / "stosim_bm_observation.stj";
+
+	std::size_t events = 0;
+	for (auto _ : agent_count) {
+		double total = 0;
+		auto simulation = vessel.start(1, algorithm);
+		switch (observation) {
+		case Observation::run:
+			simulation.run(stop);
+			total = simulation.state().time;
+			break;
+		case Observation::observer:
+			simulation.run(stop, [&](const stosim::VesselState& state, std::size_t) { total += state.time; });
+			break;
+		case Observation::generator:
+			for (const auto& state : stosim::trajectory(simulation, stop)) {
+				total += state.time;
+			}
+			break;
+		case Observation::batches:
+			for (auto batch : stosim::batches(simulation, 256, stop)) {
+				for (const auto& record : batch) {
+					total += record.time;
+				}
+			}
+			break;
+		case Observation::samples:
+			for (const auto& state : stosim::sample(simulation, grid)) {
+				total += state.time;
+			}
+			break;
+		case Observation::event_log: {
+			auto log = stosim::EventLog(simulation);
+			simulation.run(stop, log);
+			total = static_cast<double>(log.memory_size());
+			break;
+		}
+		case Observation::trajectory_file: {
+			auto writer = stosim::TrajectoryWriter(path, vessel);
+			writer.write(simulation.state());
+			simulation.run(stop, writer);
+			break;
+		}
+		case Observation::pipeline: {
+			auto pipeline = stosim::StatePipeline({ { "time", [&](const stosim::StateBatch& batch) {
+				for (const auto& state : batch.states) {
+					total += state.time;
+				}
+			} } });
+			auto producer = pipeline.producer(0);
+			producer.push(simulation.state());
+			simulation.run(stop, producer);
+			producer.finish();
+			pipeline.close();
+			break;
+		}
+		}
+		events += scaling_events;
+		benchmark::DoNotOptimize(total);
+	}
+	set_event_counters(agent_count, events);
+}
+
+BENCHMARK_CAPTURE(observation, run, Observation::run);
+BENCHMARK_CAPTURE(observation, observer, Observation::observer);
+BENCHMARK_CAPTURE(observation, generator, Observation::generator);
+BENCHMARK_CAPTURE(observation, batches, Observation::batches);
+BENCHMARK_CAPTURE(observation, samples, Observation::samples);
+BENCHMARK_CAPTURE(observation, event_log, Observation::event_log);
+BENCHMARK_CAPTURE(observation, trajectory_file, Observation::trajectory_file);
+BENCHMARK_CAPTURE(observation, pipeline, Observation::pipeline);
+
+//multi_simulate on a pool of 1, 2, 4, ... threads up to the number of cores
+void thread_scaling(benchmark::State& agent_count) {
+	auto vessel = synthetic(100, 200, 100, 100 * 100);
+	vessel.compile();
+	auto pool = stosim::WorkStealingPool(agent_count.range(0));
+	std::size_t events = 0;
+	for (auto _ : agent_count) {
+		for (auto states : vessel.multi_simulate(64, [](auto simulation) {
+			std::size_t rv = 0;
+			for ([[maybe_unused]] const auto& state : simulation) {
+				rv++;
+			}
+			return rv;
+		}, { .event_budget = scaling_events / 10 }, stosim::SimulationAlgorithm::direct, { .pool = &pool, .seed = 1 })) {
+			events += states - 1;
+		}
+	}
+	set_event_counters(agent_count, events);
+}
+
+BENCHMARK(thread_scaling)->ArgName("threads")->RangeMultiplier(2)->Range(1, std::max(1u, std::thread::hardware_concurrency()))->UseRealTime();
+
+//An ensemble of 16 simulations that share a burn-in, either simulating the burn-in in every
+//simulation or once and forking it. Only the burn-in differs, the continuations are the same length
+void burn_in(benchmark::State& agent_count, bool fork) {
+	auto vessel = synthetic(100, 200, 100, 100 * 100);
+	vessel.compile();
+	constexpr std::size_t replicas = 16;
+	constexpr std::size_t burn_in_events = 10 * scaling_events;
+	constexpr std::size_t continuation_events = scaling_events / 10;
+	for (auto _ : agent_count) {
+		std::vector<stosim::Simulation<>> simulations;
+		if (fork) {
+			auto prefix = vessel.start(1, stosim::SimulationAlgorithm::direct);
+			prefix.run({ .event_budget = burn_in_events });
+			simulations = prefix.fork(replicas, 2);
+		}
+		else {
+			for (std::size_t i = 0; i < replicas; i++) {
+				simulations.push_back(vessel.start(1, stosim::SimulationAlgorithm::direct, i));
+				simulations.back().run({ .event_budget = burn_in_events });
+			}
+		}
+		for (auto& simulation : simulations) {
+			simulation.run({ .event_budget = burn_in_events + continuation_events });
+			benchmark::DoNotOptimize(simulation.state().time);
+		}
+	}
+	agent_count.counters["replicas_per_second"] = benchmark::Counter(static_cast<double>(replicas), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK_CAPTURE(burn_in, per_replica, false);
+BENCHMARK_CAPTURE(burn_in, forked, true);
+
+//Saving and restoring a simulation in the middle of a run, the checkpoint holds the caches of the engine
+void checkpoint(benchmark::State& agent_count, stosim::SimulationAlgorithm algorithm) {
+	auto vessel = synthetic(1000, 8000, 1000, 100 * 1000);
+	vessel.compile();
+	auto simulation = vessel.start(1, algorithm);
+	simulation.run({ .event_budget = scaling_events });
+	std::size_t bytes = 0;
+	for (auto _ : agent_count) {
+		std::stringstream stream;
+		simulation.save(stream);
+		bytes += stream.str().size();
+		auto restored = stosim::Simulation<>::load(stream, simulation.shared_network());
+		benchmark::DoNotOptimize(restored.state().time);
+	}
+	agent_count.counters["checkpoint_bytes"] = benchmark::Counter(static_cast<double>(bytes), benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK_CAPTURE(checkpoint, next_reaction, stosim::SimulationAlgorithm::next_reaction);
+BENCHMARK_CAPTURE(checkpoint, composition_rejection, stosim::SimulationAlgorithm::composition_rejection);
+
+//A sweep of covid19 over beta and kappa, either as a single sweep of one vessel or by building
+//the vessel again and sweeping only the one point, both with 4 simulations of 2000 events per point
+constexpr std::size_t sweep_simulations = 4;
+constexpr std::size_t sweep_events = 2000;
+
+stosim::SweepDesign covid19_design(std::size_t points) {
+	return stosim::SweepDesign::latin_hypercube({ { "beta", 0.4, 1.2 }, { "kappa", 1e-4, 1e-3 } }, points, 1);
+}
+
+void sweep(benchmark::State& agent_count) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto design = covid19_design(agent_count.range(0));
+	auto peak = stosim::PeakStatistics(vessel.get_reaction_symbols().lookup_by_value("H"));
+	for (auto _ : agent_count) {
+		auto result = vessel.sweep(design, sweep_simulations, peak, { .event_budget = sweep_events }, stosim::SimulationAlgorithm::direct, { .seed = 1 });
+		benchmark::DoNotOptimize(result.results.data());
+	}
+	agent_count.counters["points_per_second"] = benchmark::Counter(static_cast<double>(design.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(sweep)->Arg(100)->Arg(10000)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void sweep_rebuilding(benchmark::State& agent_count) {
+	auto design = covid19_design(agent_count.range(0));
+	for (auto _ : agent_count) {
+		for (std::size_t i = 0; i < design.size(); i++) {
+			auto vessel = covid19(10000);
+			vessel.compile();
+			auto peak = stosim::PeakStatistics(vessel.get_reaction_symbols().lookup_by_value("H"));
+			auto point = stosim::SweepDesign(design.names(), std::vector(std::cbegin(design.point(i)), std::cend(design.point(i))));
+			auto result = vessel.sweep(point, sweep_simulations, peak, { .event_budget = sweep_events }, stosim::SimulationAlgorithm::direct, { .seed = 1 });
+			benchmark::DoNotOptimize(result.results.data());
+		}
+	}
+	agent_count.counters["points_per_second"] = benchmark::Counter(static_cast<double>(design.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(sweep_rebuilding)->Arg(100)->Arg(10000)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+//An ensemble of covid19 reduced to the peak of H by the threads of the shared pool, by one
+//worker process per core or by coroutines on a libcoro pool with a thread per core. The workers
+//pay for the forks and for sending every chunk back, the coroutines for going back to the queue
+//of their pool every 1024 events
+constexpr std::size_t ensemble_simulations = 256;
+
+enum class EnsemblePath {
+	threads,
+	processes,
+	coroutines,
+};
+
+void ensemble(benchmark::State& agent_count, EnsemblePath path) {
+	auto vessel = covid19(10000);
+	vessel.compile();
+	auto peak = stosim::PeakStatistics(vessel.get_reaction_symbols().lookup_by_value("H"));
+	stosim::StopCondition stop{ .event_budget = sweep_events };
+	auto pool = coro::thread_pool();
+	for (auto _ : agent_count) {
+		switch (path) {
+		case EnsemblePath::threads:
+			benchmark::DoNotOptimize(vessel.reduce(ensemble_simulations, peak, stop, stosim::SimulationAlgorithm::direct, { .seed = 1 }).value().mean());
+			break;
+		case EnsemblePath::processes:
+			benchmark::DoNotOptimize(vessel.reduce_sharded(ensemble_simulations, peak, stop, stosim::SimulationAlgorithm::direct, { .seed = 1 }).reducer.value().mean());
+			break;
+		case EnsemblePath::coroutines:
+			benchmark::DoNotOptimize(coro::sync_wait(vessel.reduce_async(pool, ensemble_simulations, peak, stop, stosim::SimulationAlgorithm::direct, { .seed = 1 })).reducer.value().mean());
+			break;
+		}
+	}
+	agent_count.counters["simulations_per_second"] = benchmark::Counter(static_cast<double>(ensemble_simulations), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK_CAPTURE(ensemble, threads, EnsemblePath::threads)->Unit(benchmark::kMillisecond)->UseRealTime();
+#ifndef _WIN32
+BENCHMARK_CAPTURE(ensemble, processes, EnsemblePath::processes)->Unit(benchmark::kMillisecond)->UseRealTime();
+#endif
+BENCHMARK_CAPTURE(ensemble, coroutines, EnsemblePath::coroutines)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+int main(int argc, char** argv) {
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+		return 1;
+	}
+	auto allocation_tracker = AllocationTracker();
+	benchmark::RegisterMemoryManager(&allocation_tracker);
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::RegisterMemoryManager(nullptr);
+	benchmark::Shutdown();
+	return 0;
+}
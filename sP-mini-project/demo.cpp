@@ -21,8 +21,8 @@ void visualize(const stosim::Vessel& vessel, double duration, const std::vector<
 		ys.push_back(std::vector<PLFLT>());
 	}
 
-	auto simulation = vessel.simulate()
-		| std::views::take_while([=](const auto& state) { return state.time < duration; });
+	/* A point per event would be millions of points for large vessels, so the trajectory is sampled */
+	auto simulation = vessel.sample({ .step = duration / 1000, .end = duration });
 
 	for (const auto& step : simulation) {
 		for (std::size_t i = 0; i < agents.size(); i++) {
@@ -57,12 +57,11 @@ void visualize(const stosim::Vessel& vessel, double duration, const std::vector<
 
 /* requirement 7: demonstrating using the generator to sget the max agent count
    withut storing all entire trajectory data*/
-stosim::agent_count_t get_max_hospitalizations(int N) {
+stosim::agent_count_t get_max_hospitalizations(int N, stosim::SimulationAlgorithm algorithm = stosim::SimulationAlgorithm::first_reaction) {
 	auto v = covid19(N);
 	auto H_token = v.get_reaction_symbols().lookup_by_value("H");
 	return std::ranges::max(
-		v.simulate() |
-		std::views::take_while([](const auto& state) { return state.time < 100; }) |
+		v.simulate({ .time_horizon = 100 }, algorithm) |
 		std::views::transform([&](const auto& state) { return state.agent_count[H_token]; })
 	);
 }
@@ -107,8 +106,9 @@ void generate_graphs(std::ostream& results) {
 void estimate_hospitalizations(std::ostream& results) {
 	const auto N_DK = 5822763;
 	const auto N_NJ = 589755;
-	const auto N_DK_hospitalizations = get_max_hospitalizations(5822763);
-	const auto N_NJ_hospitalizations = get_max_hospitalizations(589755);
+	/* Exact simulation fires an event per individual, tau leaping is accurate enough at these populations */
+	const auto N_DK_hospitalizations = get_max_hospitalizations(N_DK, stosim::SimulationAlgorithm::tau_leaping);
+	const auto N_NJ_hospitalizations = get_max_hospitalizations(N_NJ, stosim::SimulationAlgorithm::tau_leaping);
 	
 	results << "Max hospitalizations for different populations:\n";
 	results << "N_DK (" << N_DK << "): " << N_DK_hospitalizations << "\n";
@@ -139,20 +139,22 @@ void print_reactions(std::ostream& results) {
 void do_multithreading(std::ostream& results) {
 	const auto v = covid19(10000);
 	const auto H_token = v.get_reaction_symbols().lookup_by_value("H");
-	
-	const auto count = 100;
 
-	auto simulation_results = v.multi_simulate(count, [=](coro::generator<const stosim::VesselState&> simulation) -> stosim::agent_count_t {
-		return std::ranges::max(simulation |
-			std::views::take_while([](const auto& state) { return state.time < 100; }) |
-			std::views::transform([&](const auto& state) ->  stosim::agent_count_t { return state.agent_count[H_token]; })
-		);
-	});
+	/* The peaks are reduced on the worker threads, so no simulation results are kept. Instead
+	   of a fixed number of simulations they run until the 95% confidence interval of the mean
+	   is within 1% of it */
+	auto precision = stosim::Precision{ .relative_half_width = 0.01 };
+	auto result = v.reduce_until(stosim::PeakStatistics(H_token),
+		[](const stosim::PeakStatistics& peaks) { return std::vector{ peaks.value() }; },
+		precision, { .time_horizon = 100 });
+	const auto& peaks = result.reducer;
 
-	double total = std::ranges::fold_left(simulation_results, 0,
-		[](double acc, stosim::agent_count_t next) { return acc + next; });
 	results << "\nMultithreaded testing:\n";
-	results << "Peak total: " << total << ", average: " << ((double) total) / count << "\n";
+	results << "Simulations: " << result.simulation_count << ", average peak: " << peaks.value().mean()
+		<< " +- " << precision.half_width(peaks.value())
+		<< ", standard deviation: " << peaks.value().standard_deviation()
+		<< ", median: " << peaks.quantiles().quantile(0.5)
+		<< ", 95th percentile: " << peaks.quantiles().quantile(0.95) << "\n";
 }
 
 
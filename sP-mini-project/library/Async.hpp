@@ -0,0 +1,228 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <mutex>
+#include <stop_token>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <coro/coro.hpp>
+#include "Simulation.hpp"
+#include "Reducers.hpp"
+
+namespace stosim {
+	struct AsyncOptions {
+		/* Events between two visits to the queue of the pool, so long and short simulations that
+		   share the threads take turns instead of one holding a thread until it is done */
+		std::size_t yield_interval = 1024;
+		/* Simulations per task of reduce_async, 0 picks one from the number of simulations and threads */
+		std::size_t chunk_size = 0;
+		/* Simulations search_async runs at the same time, 0 for four per thread */
+		std::size_t concurrency = 0;
+		/* Requesting a stop ends run_async and the simulations of search_async at their next
+		   yield, and skips the simulations of reduce_async that have not started */
+		std::stop_token stop_token = {};
+		/* The seed of reduce_async and search_async, a random one if empty */
+		std::optional<std::uint64_t> seed = std::nullopt;
+	};
+
+	/* A simulation that ran on a pool, reason is empty if the stop token ended it */
+	template<std::uniform_random_bit_generator R = default_random_t>
+	struct AsyncRun {
+		Simulation<R> simulation;
+		std::optional<StopReason> reason;
+	};
+
+	/* Steps the simulation on the pool like Simulation::run, calling observe(state, rule_index)
+	   after every event, and goes to the back of the queue of the pool every
+	   options.yield_interval events. The task holds on to the simulation, the stop condition,
+	   the observer and the options, so the caller awaits it while they live */
+	template<std::uniform_random_bit_generator R, typename Observer>
+	coro::task<std::optional<StopReason>> advance_async(coro::thread_pool& pool, Simulation<R>& simulation, const StopCondition& stop, Observer& observe, const AsyncOptions& options) {
+		auto yield_interval = std::max<std::size_t>(options.yield_interval, 1);
+		std::size_t fired_rule;
+		co_await pool.schedule();
+		while (!options.stop_token.stop_requested()) {
+			for (std::size_t i = 0; i < yield_interval; i++) {
+				if (auto reason = simulation.step_until(stop, fired_rule)) {
+					co_return reason;
+				}
+				observe(std::as_const(simulation.state()), fired_rule);
+			}
+			co_await pool.yield();
+		}
+		co_return std::nullopt;
+	}
+
+	/* Runs the simulation on the pool until the stop condition holds, see Vessel::simulate_async */
+	template<std::uniform_random_bit_generator R>
+	coro::task<AsyncRun<R>> run_async(coro::thread_pool& pool, Simulation<R> simulation, StopCondition stop = {}, AsyncOptions options = {}) {
+		auto observe = [](const VesselState&, std::size_t) {};
+		auto reason = co_await advance_async(pool, simulation, stop, observe, options);
+		co_return AsyncRun<R>{ .simulation = std::move(simulation), .reason = reason };
+	}
+
+	/* The reducer of reduce_async and how many simulations went into it */
+	template<typename T>
+	struct AsyncReduction {
+		T reducer;
+		std::size_t simulation_count = 0;
+		/* True if the stop token skipped some of the simulations */
+		bool stopped = false;
+	};
+
+	/* Runs the simulations start(first) ... start(end - 1) one after the other into the reducer.
+	   A simulation that has started is always finished, so the reducer only holds whole simulations */
+	template<Reducer T, typename Start>
+	coro::task<AsyncReduction<T>> reduce_chunk_async(coro::thread_pool& pool, std::size_t first, std::size_t end, T reducer, Start& start, const StopCondition& stop, const AsyncOptions& options) {
+		auto running = AsyncOptions{ .yield_interval = options.yield_interval };
+		auto observe = [&reducer](const VesselState& state, std::size_t) {
+			reducer.event(state);
+		};
+		auto i = first;
+		for (; i < end && !options.stop_token.stop_requested(); i++) {
+			auto simulation = start(i);
+			reducer.start(simulation.state());
+			auto reason = co_await advance_async(pool, simulation, stop, observe, running);
+			reducer.finish(simulation.state(), reason.value());
+		}
+		co_return AsyncReduction<T>{ .reducer = std::move(reducer), .simulation_count = i - first, .stopped = i < end };
+	}
+
+	/* The simulations start(0) ... start(simulation_count - 1) reduced in chunks that run
+	   together on the pool with coro::when_all, and merged into the prototype in the order of
+	   the chunks. Unlike Vessel::reduce, which merges as the chunks finish, the result does not
+	   depend on the timing of the threads. If the stop token skipped simulations, the result
+	   says how many were reduced */
+	template<Reducer T, typename Start>
+	coro::task<AsyncReduction<T>> reduce_async(coro::thread_pool& pool, std::size_t simulation_count, T prototype, StopCondition stop, Start start, AsyncOptions options) {
+		auto chunk_size = options.chunk_size != 0 ? options.chunk_size
+			: std::clamp<std::size_t>(simulation_count / (pool.thread_count() * 16), 1, 256);
+		std::vector<coro::task<AsyncReduction<T>>> chunks;
+		for (std::size_t first = 0; first < simulation_count; first += chunk_size) {
+			chunks.push_back(reduce_chunk_async(pool, first, std::min(first + chunk_size, simulation_count), prototype, start, stop, options));
+		}
+		auto rv = AsyncReduction<T>{ .reducer = std::move(prototype) };
+		/* Moved out of the awaitable, which only lives until the end of the statement */
+		auto partials = co_await coro::when_all(std::move(chunks));
+		for (auto& partial : partials) {
+			const auto& chunk = partial.return_value();
+			rv.reducer.merge(chunk.reducer);
+			rv.simulation_count += chunk.simulation_count;
+			rv.stopped = rv.stopped || chunk.stopped;
+		}
+		co_return rv;
+	}
+
+	/* An attempt of when_first that returned a result, and its index */
+	template<typename T>
+	struct Found {
+		std::size_t index;
+		T value;
+	};
+
+	/* What the lanes of when_first share */
+	template<typename T>
+	class FirstFound {
+		std::mutex _mutex;
+		std::optional<Found<T>> _found;
+		/* The attempt every lane is running and the source that stops it */
+		std::vector<std::pair<std::size_t, std::stop_source>> _running;
+		bool _stopped = false;
+
+	public:
+		explicit FirstFound(std::size_t lane_count)
+			: _running(lane_count, { std::numeric_limits<std::size_t>::max(), std::stop_source(std::nostopstate) }) {}
+
+		/* The token for attempt index on the lane, or nothing if an attempt before it already found a result */
+		std::optional<std::stop_token> begin(std::size_t lane, std::size_t index) {
+			std::lock_guard lock(_mutex);
+			if (_stopped || (_found.has_value() && _found->index < index)) {
+				return std::nullopt;
+			}
+			_running[lane] = { index, std::stop_source() };
+			return _running[lane].second.get_token();
+		}
+
+		/* Keeps the result if no attempt before it found one and stops the attempts after it */
+		void offer(std::size_t index, T value) {
+			std::lock_guard lock(_mutex);
+			if (_found.has_value() && _found->index < index) {
+				return;
+			}
+			_found.reset();
+			_found.emplace(Found<T>{ .index = index, .value = std::move(value) });
+			for (auto& [running, source] : _running) {
+				if (running > index) {
+					source.request_stop();
+				}
+			}
+		}
+
+		/* Stops every attempt and skips the ones not started yet */
+		void stop() {
+			std::lock_guard lock(_mutex);
+			_stopped = true;
+			for (auto& [running, source] : _running) {
+				source.request_stop();
+			}
+		}
+
+		std::optional<Found<T>> take() {
+			std::lock_guard lock(_mutex);
+			return std::move(_found);
+		}
+	};
+
+	/* Runs the attempts lane, lane + lane_count, ... one after the other until one finds a result */
+	template<typename T, typename Attempt>
+	coro::task<void> run_lane(FirstFound<T>& found, std::size_t lane, std::size_t lane_count, std::size_t attempt_count, Attempt& attempt) {
+		for (auto index = lane; index < attempt_count; index += lane_count) {
+			auto token = found.begin(lane, index);
+			if (!token.has_value()) {
+				co_return;
+			}
+			if (auto value = co_await attempt(index, token.value())) {
+				found.offer(index, std::move(value.value()));
+				co_return;
+			}
+		}
+	}
+
+	/* The counterpart of coro::when_all for searches: attempt(i, stop_token) returns a task of
+	   an optional result for i = 0 ... attempt_count - 1, and at most lane_count of them run at
+	   the same time. The result is the one of the lowest i that has one. Once attempt i has
+	   found one, the attempts after it are asked to stop through their tokens and the ones not
+	   started yet are skipped, while the ones before it still run. So the search stops early,
+	   but which result it returns does not depend on which attempt happens to finish first.
+	   Requesting a stop through stop_token stops every attempt */
+	template<typename T, typename Attempt>
+	coro::task<std::optional<Found<T>>> when_first(std::size_t attempt_count, std::size_t lane_count, Attempt attempt, std::stop_token stop_token = {}) {
+		lane_count = std::clamp<std::size_t>(lane_count, 1, std::max<std::size_t>(attempt_count, 1));
+		FirstFound<T> found(lane_count);
+		std::stop_callback on_stop(stop_token, [&found]() {
+			found.stop();
+		});
+		std::vector<coro::task<void>> lanes;
+		for (std::size_t lane = 0; lane < lane_count; lane++) {
+			lanes.push_back(run_lane(found, lane, lane_count, attempt_count, attempt));
+		}
+		auto finished = co_await coro::when_all(std::move(lanes));
+		for (auto& lane : finished) {
+			lane.return_value();
+		}
+		co_return found.take();
+	}
+
+	/* Runs the simulation on the pool and returns it if accept(final_state, reason) holds, see Vessel::search_async */
+	template<std::uniform_random_bit_generator R, typename Accept>
+	coro::task<std::optional<AsyncRun<R>>> accept_async(coro::thread_pool& pool, Simulation<R> simulation, StopCondition stop, AsyncOptions options, Accept accept) {
+		auto run = co_await run_async(pool, std::move(simulation), std::move(stop), std::move(options));
+		if (run.reason.has_value() && accept(std::as_const(run.simulation.state()), run.reason.value())) {
+			co_return std::optional<AsyncRun<R>>(std::move(run));
+		}
+		co_return std::nullopt;
+	}
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <concepts>
+#include <type_traits>
+#include <exception>
+
+namespace stosim {
+	struct CheckpointException : public std::exception {
+		CheckpointException(const char* message)
+			: std::exception(message) {}
+	};
+
+	/* A simulation, its engine and its random number generator write and read their state with
+	   a single checkpoint(archive) function that hands every member to archive(...), so saving
+	   and restoring cannot drift apart. Numbers are stored as their raw bytes, vectors as their
+	   length followed by their elements and classes through their own checkpoint(), so a
+	   checkpoint is only read back on a machine with the same endianness */
+	class CheckpointWriter {
+		std::string _bytes;
+
+		template<typename T> requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+		void write(const T& value) {
+			_bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+
+		/* The writer only reads the members, checkpoint() takes them as mutable since the reader shares it */
+		template<typename T> requires std::is_class_v<T>
+		void write(const T& value) {
+			const_cast<T&>(value).checkpoint(*this);
+		}
+
+		template<typename T, std::size_t N>
+		void write(const std::array<T, N>& values) {
+			for (const auto& value : values) {
+				write(value);
+			}
+		}
+
+		template<typename T>
+		void write(const std::vector<T>& values) {
+			write<std::uint64_t>(values.size());
+			if constexpr (std::is_arithmetic_v<T> && !std::same_as<T, bool>) {
+				_bytes.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+			}
+			else {
+				for (const auto& value : values) {
+					write(static_cast<const T&>(value));
+				}
+			}
+		}
+
+	public:
+		template<typename... T>
+		void operator()(const T&... values) {
+			(write(values), ...);
+		}
+
+		const std::string& bytes() const {
+			return _bytes;
+		}
+	};
+
+	/* Reads what a CheckpointWriter wrote, every read checks that it stays inside the bytes */
+	class CheckpointReader {
+		std::string_view _bytes;
+
+		void check(std::size_t size) const {
+			if (_bytes.size() < size) {
+				throw CheckpointException("CheckpointReader() The checkpoint is truncated");
+			}
+		}
+
+		template<typename T> requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+		void read(T& value) {
+			check(sizeof(value));
+			std::memcpy(&value, _bytes.data(), sizeof(value));
+			_bytes.remove_prefix(sizeof(value));
+		}
+
+		template<typename T> requires std::is_class_v<T>
+		void read(T& value) {
+			value.checkpoint(*this);
+		}
+
+		template<typename T, std::size_t N>
+		void read(std::array<T, N>& values) {
+			for (auto& value : values) {
+				read(value);
+			}
+		}
+
+		template<typename T>
+		void read(std::vector<T>& values) {
+			std::uint64_t size;
+			read(size);
+			/* Every element takes at least a byte, so a broken length cannot allocate more than the checkpoint holds */
+			check(size);
+			values.resize(size);
+			if constexpr (std::is_arithmetic_v<T> && !std::same_as<T, bool>) {
+				check(size * sizeof(T));
+				/* An empty vector may have no storage, which memcpy does not take even for no bytes */
+				if (size != 0) {
+					std::memcpy(values.data(), _bytes.data(), size * sizeof(T));
+				}
+				_bytes.remove_prefix(size * sizeof(T));
+			}
+			else {
+				for (std::size_t i = 0; i < size; i++) {
+					if constexpr (std::same_as<T, bool>) {
+						bool value;
+						read(value);
+						values[i] = value;
+					}
+					else {
+						read(values[i]);
+					}
+				}
+			}
+		}
+
+	public:
+		explicit CheckpointReader(std::string_view bytes)
+			: _bytes(bytes) {}
+
+		template<typename... T>
+		void operator()(T&... values) {
+			(read(values), ...);
+		}
+
+		/* The bytes that have not been read yet */
+		std::size_t remaining() const {
+			return _bytes.size();
+		}
+	};
+
+	/* Something that can be saved in a checkpoint, like a random number generator or a reducer */
+	template<typename T>
+	concept Checkpointable = requires(T& value, CheckpointWriter& writer, CheckpointReader& reader) {
+		value.checkpoint(writer);
+		value.checkpoint(reader);
+	};
+
+	namespace checkpoint_format {
+		constexpr char magic[8] = { 'S', 'T', 'O', 'S', 'I', 'M', 'C', 'P' };
+		constexpr std::uint32_t version = 1;
+	}
+}
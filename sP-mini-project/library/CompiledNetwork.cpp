@@ -0,0 +1,56 @@
+#include "CompiledNetwork.hpp"
+#include <map>
+
+namespace stosim {
+	CompiledNetwork::CompiledNetwork(const std::vector<ReactionRule>& rules, std::size_t agent_type_count)
+	{
+		auto structure = std::make_shared<Structure>();
+		auto& s = *structure;
+		s.agent_type_count = agent_type_count;
+		_rates.reserve(rules.size());
+		s.rates.reserve(rules.size());
+		s.reactant_offsets.reserve(rules.size() + 1);
+		s.change_offsets.reserve(rules.size() + 1);
+		s.reactant_offsets.push_back(0);
+		s.change_offsets.push_back(0);
+
+		for (const auto& rule : rules) {
+			_rates.push_back(rule.get_rate());
+			s.rates.push_back(rule.get_rate_expression());
+
+			/* The tokens are kept sorted, which keeps the accesses into the agent counts in order */
+			std::map<agent_token_t, std::int64_t> net_change;
+			const auto& reactants = rule.get_reactants().get_agent_tokens();
+			for (auto it = std::cbegin(reactants); it != std::cend(reactants); it = reactants.upper_bound(*it)) {
+				auto multiplicity = reactants.count(*it);
+				s.reactant_tokens.push_back(*it);
+				s.reactant_multiplicities.push_back(multiplicity);
+				net_change[*it] -= static_cast<std::int64_t>(multiplicity);
+			}
+			for (auto token : rule.get_products().get_agent_tokens()) {
+				net_change[token] += 1;
+			}
+
+			for (const auto& [token, change] : net_change) {
+				if (change != 0) {
+					s.change_tokens.push_back(token);
+					s.change_amounts.push_back(change);
+				}
+			}
+
+			s.reactant_offsets.push_back(s.reactant_tokens.size());
+			s.change_offsets.push_back(s.change_tokens.size());
+		}
+		_structure = std::move(structure);
+		point_into_structure();
+	}
+
+	CompiledNetwork CompiledNetwork::with_parameters(std::span<const double> parameters) const
+	{
+		auto rv = *this;
+		for (std::size_t i = 0; i < rv._rates.size(); i++) {
+			rv._rates[i] = _structure->rates[i].value(parameters);
+		}
+		return rv;
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include "ReactionRule.hpp"
+#include "Instrumentation.hpp"
+
+namespace stosim {
+	/* The reaction rules frozen into flat arrays in compressed sparse row form, this is what the
+	   simulation engines run on. Rule r has its reactants in [reactant_offsets[r], reactant_offsets[r + 1])
+	   of the reactant arrays and its net changes in [change_offsets[r], change_offsets[r + 1]) of
+	   the change arrays, so evaluating a propensity or applying a rule is a walk over contiguous memory */
+	class CompiledNetwork {
+		/* Everything but the rates, shared between networks that only differ in their parameters */
+		struct Structure {
+			std::size_t agent_type_count;
+			std::vector<Rate> rates;
+
+			std::vector<std::size_t> reactant_offsets;
+			std::vector<agent_token_t> reactant_tokens;
+			std::vector<agent_count_t> reactant_multiplicities;
+
+			std::vector<std::size_t> change_offsets;
+			std::vector<agent_token_t> change_tokens;
+			std::vector<std::int64_t> change_amounts;
+		};
+
+		std::shared_ptr<const Structure> _structure;
+		std::vector<double> _rates;
+		/* Into the arrays of the structure, which never move, so the engines do not go through the shared pointer */
+		const std::size_t* _reactant_offsets;
+		const agent_token_t* _reactant_tokens;
+		const agent_count_t* _reactant_multiplicities;
+		const std::size_t* _change_offsets;
+		const agent_token_t* _change_tokens;
+		const std::int64_t* _change_amounts;
+
+		void point_into_structure() {
+			_reactant_offsets = _structure->reactant_offsets.data();
+			_reactant_tokens = _structure->reactant_tokens.data();
+			_reactant_multiplicities = _structure->reactant_multiplicities.data();
+			_change_offsets = _structure->change_offsets.data();
+			_change_tokens = _structure->change_tokens.data();
+			_change_amounts = _structure->change_amounts.data();
+		}
+
+	public:
+		CompiledNetwork(const std::vector<ReactionRule>& rules, std::size_t agent_type_count);
+
+		/* The same network with parameter i of the rates at parameters[i]. The new network shares
+		   everything but the rates with this one, so it is as cheap as a vector of the rates */
+		CompiledNetwork with_parameters(std::span<const double> parameters) const;
+
+		std::size_t rule_count() const {
+			return _rates.size();
+		}
+
+		std::size_t agent_type_count() const {
+			return _structure->agent_type_count;
+		}
+
+		double rate(std::size_t rule_index) const {
+			return _rates[rule_index];
+		}
+
+		std::span<const agent_token_t> reactant_tokens(std::size_t rule_index) const {
+			return std::span(_reactant_tokens + _reactant_offsets[rule_index], _reactant_tokens + _reactant_offsets[rule_index + 1]);
+		}
+
+		std::span<const agent_count_t> reactant_multiplicities(std::size_t rule_index) const {
+			return std::span(_reactant_multiplicities + _reactant_offsets[rule_index], _reactant_multiplicities + _reactant_offsets[rule_index + 1]);
+		}
+
+		/* The agents whose count changes when the rule fires, a catalyst is left out */
+		std::span<const agent_token_t> change_tokens(std::size_t rule_index) const {
+			return std::span(_change_tokens + _change_offsets[rule_index], _change_tokens + _change_offsets[rule_index + 1]);
+		}
+
+		std::span<const std::int64_t> change_amounts(std::size_t rule_index) const {
+			return std::span(_change_amounts + _change_offsets[rule_index], _change_amounts + _change_offsets[rule_index + 1]);
+		}
+
+		/* The total number of reactants including multiplicities, 2A + B is of order 3 */
+		agent_count_t order(std::size_t rule_index) const {
+			agent_count_t rv = 0;
+			for (auto multiplicity : reactant_multiplicities(rule_index)) {
+				rv += multiplicity;
+			}
+			return rv;
+		}
+
+		/* The propensity is the rate times the number of distinct combinations of reactants,
+		   so a reactant with multiplicity m contributes x choose m instead of x */
+		double propensity(std::size_t rule_index, const std::vector<agent_count_t>& agent_count) const {
+			instrumentation::count_propensity_evaluation();
+			auto rv = _rates[rule_index];
+			for (auto i = _reactant_offsets[rule_index]; i < _reactant_offsets[rule_index + 1]; i++) {
+				auto count = agent_count[_reactant_tokens[i]];
+				auto multiplicity = _reactant_multiplicities[i];
+				if (multiplicity == 1) {
+					rv *= count;
+					continue;
+				}
+				if (count < multiplicity) {
+					return 0;
+				}
+				for (agent_count_t k = 0; k < multiplicity; k++) {
+					rv *= static_cast<double>(count - k) / (k + 1);
+				}
+			}
+			return rv;
+		}
+
+		/* The same as propensity() for populations that are not whole numbers */
+		double continuous_propensity(std::size_t rule_index, const std::vector<double>& amounts) const {
+			instrumentation::count_propensity_evaluation();
+			auto rv = _rates[rule_index];
+			for (auto i = _reactant_offsets[rule_index]; i < _reactant_offsets[rule_index + 1]; i++) {
+				auto amount = amounts[_reactant_tokens[i]];
+				for (agent_count_t k = 0; k < _reactant_multiplicities[i]; k++) {
+					rv *= std::max(amount - k, 0.0) / (k + 1);
+				}
+			}
+			return rv;
+		}
+
+		void apply(std::size_t rule_index, std::vector<agent_count_t>& agent_count) const {
+			for (auto i = _change_offsets[rule_index]; i < _change_offsets[rule_index + 1]; i++) {
+				agent_count[_change_tokens[i]] += _change_amounts[i];
+			}
+		}
+
+		/* Undoes apply() */
+		void revert(std::size_t rule_index, std::vector<agent_count_t>& agent_count) const {
+			for (auto i = _change_offsets[rule_index]; i < _change_offsets[rule_index + 1]; i++) {
+				agent_count[_change_tokens[i]] -= _change_amounts[i];
+			}
+		}
+	};
+}
@@ -0,0 +1,218 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "SimulationEngine.hpp"
+#include "DependencyGraph.hpp"
+
+namespace stosim {
+	/* The composition-rejection method by Slepoy, Thompson & Plimpton. Rules are grouped by the
+	   power of two their propensity falls under, so group g holds the propensities in
+	   [2^(g-1), 2^g). A group is picked by scanning the group totals, whose count only depends on
+	   the range of the propensities and not on the number of rules, and a rule is then picked
+	   uniformly inside the group and accepted with probability propensity / 2^g, which is at
+	   least one half. Moving a rule to another group is a swap with the last member */
+	class CompositionRejectionEngine {
+		struct Group {
+			std::vector<std::size_t> rules;
+			double total = 0;
+		};
+
+		static constexpr std::size_t no_group = std::numeric_limits<std::size_t>::max();
+		/* frexp gives exponents down to the smallest denormal and up to the largest double */
+		static constexpr int min_exponent = std::numeric_limits<double>::min_exponent - std::numeric_limits<double>::digits;
+		static constexpr int max_exponent = std::numeric_limits<double>::max_exponent;
+		/* The group totals are updated with differences, so they are recomputed this often */
+		static constexpr std::size_t resum_interval = 10000;
+
+		const CompiledNetwork& _network;
+		DependencyGraph _dependency_graph;
+		std::vector<double> _propensities;
+		std::vector<Group> _groups;
+		std::vector<std::size_t> _group_of;
+		std::vector<std::size_t> _position_in_group;
+		double _total_propensity = 0;
+		/* The range of groups that have been used, only this range has to be scanned */
+		std::size_t _lowest_group = no_group;
+		std::size_t _highest_group = 0;
+		std::size_t _events_since_resum = 0;
+
+		static std::size_t group_index(double propensity) {
+			int exponent;
+			std::frexp(propensity, &exponent);
+			return static_cast<std::size_t>(exponent - min_exponent);
+		}
+
+		static double group_upper_bound(std::size_t group) {
+			return std::ldexp(1.0, static_cast<int>(group) + min_exponent);
+		}
+
+		void remove_from_group(std::size_t rule_index) {
+			auto& group = _groups[_group_of[rule_index]];
+			auto position = _position_in_group[rule_index];
+			auto last = group.rules.back();
+			group.rules[position] = last;
+			_position_in_group[last] = position;
+			group.rules.pop_back();
+			group.total -= _propensities[rule_index];
+			_group_of[rule_index] = no_group;
+		}
+
+		void add_to_group(std::size_t rule_index) {
+			auto group_id = group_index(_propensities[rule_index]);
+			auto& group = _groups[group_id];
+			_group_of[rule_index] = group_id;
+			_position_in_group[rule_index] = group.rules.size();
+			group.rules.push_back(rule_index);
+			group.total += _propensities[rule_index];
+			_lowest_group = std::min(_lowest_group, group_id);
+			_highest_group = std::max(_highest_group, group_id);
+		}
+
+		void set_propensity(std::size_t rule_index, double new_propensity) {
+			auto old_propensity = _propensities[rule_index];
+			_total_propensity += new_propensity - old_propensity;
+
+			if (old_propensity > 0 && new_propensity > 0 && group_index(old_propensity) == group_index(new_propensity)) {
+				_groups[_group_of[rule_index]].total += new_propensity - old_propensity;
+				_propensities[rule_index] = new_propensity;
+				return;
+			}
+
+			instrumentation::count_queue_update();
+			if (_group_of[rule_index] != no_group) {
+				remove_from_group(rule_index);
+			}
+			_propensities[rule_index] = new_propensity;
+			if (new_propensity > 0) {
+				add_to_group(rule_index);
+			}
+		}
+
+		void resum() {
+			_total_propensity = 0;
+			for (std::size_t g = _lowest_group; g <= _highest_group && _lowest_group != no_group; g++) {
+				auto& group = _groups[g];
+				group.total = 0;
+				for (auto rule_index : group.rules) {
+					group.total += _propensities[rule_index];
+				}
+				_total_propensity += group.total;
+			}
+			_events_since_resum = 0;
+		}
+
+		/* Composition: the group is picked with probability proportional to its total, starting
+		   from the highest group since it usually holds most of the total */
+		std::optional<std::size_t> select_group(double target) const {
+			std::optional<std::size_t> last_non_empty = std::nullopt;
+			double cumulative = 0;
+			for (auto g = _highest_group + 1; g-- > _lowest_group && _lowest_group != no_group;) {
+				if (_groups[g].rules.empty()) {
+					continue;
+				}
+				cumulative += _groups[g].total;
+				last_non_empty.emplace(g);
+				if (target < cumulative) {
+					break;
+				}
+			}
+			return last_non_empty;
+		}
+
+	public:
+		CompositionRejectionEngine(const CompiledNetwork& network)
+			: _network(network), _dependency_graph(network), _propensities(network.rule_count(), 0),
+			  _groups(max_exponent - min_exponent + 1), _group_of(network.rule_count(), no_group), _position_in_group(network.rule_count(), 0) {}
+
+		template<std::uniform_random_bit_generator R>
+		void reset(const VesselState& state, R& rng) {
+			for (std::size_t i = 0; i < _network.rule_count(); i++) {
+				set_propensity(i, _network.propensity(i, state.agent_count));
+			}
+			resum();
+		}
+
+		/* The order of the rules inside a group decides which rule a draw picks, so the groups are kept as they are */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_propensities, _group_of, _position_in_group, _total_propensity, _lowest_group, _highest_group, _events_since_resum);
+			for (auto& group : _groups) {
+				archive(group.rules, group.total);
+			}
+		}
+
+		/* True if every rule with a positive propensity is in the group of its propensity at
+		   its position, the others are in none, and the groups hold nothing else */
+		bool consistent() const {
+			auto rule_count = _network.rule_count();
+			if (_propensities.size() != rule_count || _group_of.size() != rule_count || _position_in_group.size() != rule_count) {
+				return false;
+			}
+			if (_lowest_group != no_group && (_lowest_group > _highest_group || _highest_group >= _groups.size())) {
+				return false;
+			}
+			std::size_t grouped = 0;
+			for (std::size_t i = 0; i < rule_count; i++) {
+				if (!(_propensities[i] > 0)) {
+					if (_group_of[i] != no_group) {
+						return false;
+					}
+					continue;
+				}
+				auto group_id = _group_of[i];
+				if (group_id != group_index(_propensities[i]) || group_id < _lowest_group || group_id > _highest_group
+					|| _position_in_group[i] >= _groups[group_id].rules.size() || _groups[group_id].rules[_position_in_group[i]] != i) {
+					return false;
+				}
+				grouped++;
+			}
+			std::size_t group_sizes = 0;
+			for (const auto& group : _groups) {
+				group_sizes += group.rules.size();
+			}
+			return group_sizes == grouped;
+		}
+
+		template<std::uniform_random_bit_generator R>
+		std::optional<std::size_t> step(VesselState& state, R& rng) {
+			if (_total_propensity <= 0) {
+				return std::nullopt;
+			}
+
+			auto uniform = std::uniform_real_distribution(0.0, 1.0);
+			auto delay = -std::log(1.0 - uniform(rng)) / _total_propensity;
+			auto group_id = select_group(uniform(rng) * _total_propensity);
+			if (!group_id.has_value()) {
+				/* Only possible when the total drifted away from an actual total of zero */
+				resum();
+				return std::nullopt;
+			}
+
+			/* Rejection: every rule in the group is below the upper bound, so a uniformly picked
+			   rule is accepted with probability propensity / upper bound */
+			const auto& group = _groups[group_id.value()];
+			auto upper_bound = group_upper_bound(group_id.value());
+			auto member = std::uniform_int_distribution<std::size_t>(0, group.rules.size() - 1);
+			std::size_t rule_index;
+			do {
+				rule_index = group.rules[member(rng)];
+			} while (uniform(rng) * upper_bound >= _propensities[rule_index]);
+
+			state.time += delay;
+			_network.apply(rule_index, state.agent_count);
+
+			for (auto dependent : _dependency_graph.dependents(rule_index)) {
+				set_propensity(dependent, _network.propensity(dependent, state.agent_count));
+			}
+
+			if (++_events_since_resum >= std::max(resum_interval, _network.rule_count()) || _total_propensity <= 0) {
+				resum();
+			}
+
+			return rule_index;
+		}
+	};
+}
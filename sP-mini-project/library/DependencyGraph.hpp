@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <span>
+#include "CompiledNetwork.hpp"
+
+namespace stosim {
+	/* The dependency graph from Gibson & Bruck: an edge from rule i to rule j means that
+	   firing rule i changes the count of at least one reactant of rule j, so the propensity
+	   of rule j has to be recomputed after rule i fires. A rule is always dependent on itself.
+	   Like the network itself the edges are stored in compressed sparse row form */
+	class DependencyGraph {
+		std::vector<std::size_t> _offsets;
+		std::vector<std::size_t> _dependents;
+	public:
+		DependencyGraph() {}
+
+		DependencyGraph(const CompiledNetwork& network) {
+			/* First index which rules consume each agent, so each rule only has to look at
+			   the agents it changes instead of every other rule */
+			std::vector<std::vector<std::size_t>> consumers(network.agent_type_count());
+			for (std::size_t i = 0; i < network.rule_count(); i++) {
+				for (auto token : network.reactant_tokens(i)) {
+					consumers[token].push_back(i);
+				}
+			}
+
+			/* Only agents with a net change matter, so a catalyst does not make other rules
+			   dependent on this one */
+			_offsets.push_back(0);
+			std::vector<std::size_t> dependents;
+			for (std::size_t i = 0; i < network.rule_count(); i++) {
+				dependents.clear();
+				dependents.push_back(i);
+				for (auto token : network.change_tokens(i)) {
+					dependents.insert(std::end(dependents), std::cbegin(consumers[token]), std::cend(consumers[token]));
+				}
+
+				std::ranges::sort(dependents);
+				auto [first, last] = std::ranges::unique(dependents);
+				dependents.erase(first, last);
+
+				_dependents.insert(std::end(_dependents), std::cbegin(dependents), std::cend(dependents));
+				_offsets.push_back(_dependents.size());
+			}
+		}
+
+		std::span<const std::size_t> dependents(std::size_t rule_index) const {
+			return std::span(_dependents).subspan(_offsets[rule_index], _offsets[rule_index + 1] - _offsets[rule_index]);
+		}
+
+		std::size_t size() const {
+			return _offsets.empty() ? 0 : _offsets.size() - 1;
+		}
+	};
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <cmath>
+#include <numeric>
+#include "SimulationEngine.hpp"
+#include "DependencyGraph.hpp"
+
+namespace stosim {
+	/* Gillespie's direct method. The propensities are cached together with their sum, so an
+	   event costs two uniform draws and a scan over the cached propensities, and only the rules
+	   in the dependency graph of the rule that fired are recomputed */
+	class DirectMethodEngine {
+		/* Updating the total with differences accumulates rounding errors, so it is recomputed
+		   from scratch this often */
+		static constexpr std::size_t resum_interval = 10000;
+
+		const CompiledNetwork& _network;
+		DependencyGraph _dependency_graph;
+		std::vector<double> _propensities;
+		double _total_propensity = 0;
+		std::size_t _events_since_resum = 0;
+
+		void resum() {
+			_total_propensity = std::accumulate(std::cbegin(_propensities), std::cend(_propensities), 0.0);
+			_events_since_resum = 0;
+		}
+
+		/* Finds the rule where the cumulative propensity passes the target. Rounding can make the
+		   target land past the last rule, in that case the last rule that can fire is used */
+		std::optional<std::size_t> select_rule(double target) const {
+			std::optional<std::size_t> last_enabled = std::nullopt;
+			double cumulative = 0;
+			for (std::size_t i = 0; i < _propensities.size(); i++) {
+				if (_propensities[i] <= 0) {
+					continue;
+				}
+				cumulative += _propensities[i];
+				last_enabled.emplace(i);
+				if (target < cumulative) {
+					break;
+				}
+			}
+			return last_enabled;
+		}
+
+	public:
+		DirectMethodEngine(const CompiledNetwork& network)
+			: _network(network), _dependency_graph(network), _propensities(network.rule_count()) {}
+
+		template<std::uniform_random_bit_generator R>
+		void reset(const VesselState& state, R& rng) {
+			for (std::size_t i = 0; i < _network.rule_count(); i++) {
+				_propensities[i] = _network.propensity(i, state.agent_count);
+			}
+			resum();
+		}
+
+		/* The total is kept as it is rather than summed again, so a restored simulation picks the same rules */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_propensities, _total_propensity, _events_since_resum);
+		}
+
+		bool consistent() const {
+			return _propensities.size() == _network.rule_count();
+		}
+
+		template<std::uniform_random_bit_generator R>
+		std::optional<std::size_t> step(VesselState& state, R& rng) {
+			if (_total_propensity <= 0) {
+				return std::nullopt;
+			}
+
+			auto uniform = std::uniform_real_distribution(0.0, 1.0);
+			auto delay = -std::log(1.0 - uniform(rng)) / _total_propensity;
+			auto rule_index = select_rule(uniform(rng) * _total_propensity);
+			if (!rule_index.has_value()) {
+				/* Only possible when the total drifted away from an actual total of zero */
+				resum();
+				return std::nullopt;
+			}
+
+			state.time += delay;
+			_network.apply(rule_index.value(), state.agent_count);
+
+			for (auto dependent : _dependency_graph.dependents(rule_index.value())) {
+				auto new_propensity = _network.propensity(dependent, state.agent_count);
+				_total_propensity += new_propensity - _propensities[dependent];
+				_propensities[dependent] = new_propensity;
+			}
+
+			if (++_events_since_resum >= resum_interval || _total_propensity <= 0) {
+				resum();
+			}
+
+			return rule_index;
+		}
+	};
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <cstdint>
+#include <exception>
+#include <stop_token>
+#include <algorithm>
+#include <coro/coro.hpp>
+#include "WorkStealingPool.hpp"
+
+namespace stosim {
+	struct EnsembleOptions {
+		/* Simulations per task, 0 picks one from the number of simulations and threads */
+		std::size_t chunk_size = 0;
+		/* Results that can be waiting for the consumer or still be produced by the tasks that
+		   have been submitted, 0 picks one from the chunk size. A task is only submitted once
+		   there is room for all of its results, or when nothing is outstanding, so this is what
+		   bounds the memory of an ensemble without ever blocking a thread of the pool */
+		std::size_t max_buffered_results = 0;
+		/* Requesting a stop skips the simulations that have not started and ends the results */
+		std::stop_token stop_token = {};
+		/* The pool to run on, WorkStealingPool::shared() if null */
+		WorkStealingPool* pool = nullptr;
+		/* The seed multi_simulate gives the simulations, a random one if empty */
+		std::optional<std::uint64_t> seed = std::nullopt;
+	};
+
+	/* Enough chunks for every thread to get several, so the stealing can even out simulations of different lengths */
+	inline std::size_t ensemble_chunk_size(std::size_t simulation_count, const WorkStealingPool& pool) {
+		return std::clamp<std::size_t>(simulation_count / (pool.thread_count() * 16), 1, 256);
+	}
+
+	/* The state shared between the tasks of an ensemble and the generator handing out the results */
+	template<typename Result>
+	class EnsembleChannel {
+		std::mutex _mutex;
+		std::condition_variable _changed;
+		std::deque<Result> _results;
+		std::size_t _capacity;
+		/* The results waiting in _results plus the ones the running tasks may still push */
+		std::size_t _reserved = 0;
+		std::size_t _running_tasks = 0;
+		bool _cancelled = false;
+		std::exception_ptr _exception;
+
+	public:
+		explicit EnsembleChannel(std::size_t capacity)
+			: _capacity(capacity) {}
+
+		bool cancelled() {
+			std::lock_guard lock(_mutex);
+			return _cancelled;
+		}
+
+		/* Makes room for a task of result_count results before it is submitted. Returns false if
+		   there is no room, unless nothing is reserved, so a capacity below the size of a task
+		   still lets the ensemble go on */
+		bool reserve(std::size_t result_count) {
+			std::lock_guard lock(_mutex);
+			if (_cancelled || (_reserved != 0 && _reserved + result_count > _capacity)) {
+				return false;
+			}
+			_reserved += result_count;
+			_running_tasks++;
+			return true;
+		}
+
+		/* Never blocks, the room was reserved when the task was submitted */
+		void push(Result result) {
+			std::lock_guard lock(_mutex);
+			_results.push_back(std::move(result));
+			_changed.notify_all();
+		}
+
+		/* Blocks until there is a result, returns nullopt when every submitted task is done or
+		   the ensemble was cancelled */
+		std::optional<Result> pop() {
+			std::unique_lock lock(_mutex);
+			_changed.wait(lock, [&]() { return !_results.empty() || _running_tasks == 0 || _cancelled; });
+			if (_cancelled || _results.empty()) {
+				return std::nullopt;
+			}
+			auto result = std::move(_results.front());
+			_results.pop_front();
+			_reserved--;
+			return result;
+		}
+
+		void cancel() {
+			std::lock_guard lock(_mutex);
+			_cancelled = true;
+			_changed.notify_all();
+		}
+
+		/* The first exception cancels the ensemble and is rethrown to the consumer */
+		void fail(std::exception_ptr exception) {
+			std::lock_guard lock(_mutex);
+			if (!_exception) {
+				_exception = exception;
+			}
+			_cancelled = true;
+			_changed.notify_all();
+		}
+
+		/* unpushed are the reserved results the task did not push because it was cancelled or failed */
+		void task_done(std::size_t unpushed) {
+			std::lock_guard lock(_mutex);
+			_running_tasks--;
+			_reserved -= unpushed;
+			_changed.notify_all();
+		}
+
+		void wait_for_tasks() {
+			std::unique_lock lock(_mutex);
+			_changed.wait(lock, [&]() { return _running_tasks == 0; });
+		}
+
+		void rethrow_if_failed() {
+			std::lock_guard lock(_mutex);
+			if (_exception) {
+				std::rethrow_exception(_exception);
+			}
+		}
+	};
+
+	/* Runs simulation(i) for every i below simulation_count on a work stealing pool and yields the
+	   results in the order they complete. Destroying the generator early cancels the remaining
+	   simulations and waits for the ones that are running, since they use simulation.
+	   The generator must not be consumed from a thread of the pool it runs on */
+	template<typename Result, typename F>
+	coro::generator<Result> run_ensemble(std::size_t simulation_count, F simulation, EnsembleOptions options = {}) {
+		auto& pool = options.pool != nullptr ? *options.pool : WorkStealingPool::shared();
+		auto chunk_size = options.chunk_size != 0
+			? options.chunk_size
+			: ensemble_chunk_size(simulation_count, pool);
+		auto capacity = options.max_buffered_results != 0
+			? options.max_buffered_results
+			: 2 * chunk_size * pool.thread_count();
+
+		auto channel = std::make_shared<EnsembleChannel<Result>>(capacity);
+		struct CancelOnExit {
+			std::shared_ptr<EnsembleChannel<Result>> channel;
+			~CancelOnExit() {
+				channel->cancel();
+				channel->wait_for_tasks();
+			}
+		} cancel_on_exit{ channel };
+		std::stop_callback on_stop(options.stop_token, [&]() { channel->cancel(); });
+
+		/* Chunks are submitted as the consumer makes room for their results, so a task never
+		   waits for the consumer and a full ensemble cannot hold the threads of the pool that
+		   another ensemble on the same pool needs */
+		std::size_t next = 0;
+		while (true) {
+			std::vector<WorkStealingPool::task_t> tasks;
+			while (next < simulation_count && channel->reserve(std::min(chunk_size, simulation_count - next))) {
+				auto begin = next;
+				auto end = std::min(begin + chunk_size, simulation_count);
+				tasks.push_back([channel, &simulation, begin, end]() {
+					auto i = begin;
+					try {
+						for (; i < end && !channel->cancelled(); i++) {
+							channel->push(simulation(i));
+						}
+					}
+					catch (...) {
+						channel->fail(std::current_exception());
+					}
+					channel->task_done(end - i);
+				});
+				next = end;
+			}
+			if (!tasks.empty()) {
+				pool.submit(std::move(tasks));
+			}
+
+			auto result = channel->pop();
+			if (!result.has_value()) {
+				if (next < simulation_count && !channel->cancelled()) {
+					continue;
+				}
+				break;
+			}
+			co_yield std::move(result.value());
+		}
+		channel->rethrow_if_failed();
+	}
+}
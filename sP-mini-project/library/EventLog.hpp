@@ -0,0 +1,160 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <bit>
+#include <algorithm>
+#include <coro/coro.hpp>
+#include "CompiledNetwork.hpp"
+#include "SimulationEngine.hpp"
+#include "Simulation.hpp"
+#include "Varint.hpp"
+
+namespace stosim {
+	/* A trajectory stored as the rule that fired in every event and the time it took, instead of
+	   every state. An event is a varint of the rule index and a varint of the difference between
+	   the bit patterns of its time and the time before it, usually 5 to 8 bytes no matter how many
+	   agents there are. Every keyframe_interval events the whole state is kept as a keyframe, so a
+	   state is rebuilt by applying the rules from the keyframe before it. A leap changes the counts
+	   in a way its rule index does not tell, so the state after a leap is always a keyframe. So
+	   is the state after every event of the hybrid engine, which moves the fast agents along
+	   before the slow rule it returns fires. State i is the state after event i, state 0 is the
+	   initial state */
+	class EventLog {
+		struct Keyframe {
+			std::size_t event;
+			/* Where event + 1 starts in _events */
+			std::size_t offset;
+			VesselState state;
+		};
+
+		std::shared_ptr<const CompiledNetwork> _network;
+		std::size_t _keyframe_interval;
+		/* Every event is stored as a leap, for engines whose events change more than their rule */
+		bool _every_event_leaps;
+		std::string _events;
+		std::vector<Keyframe> _keyframes;
+		std::size_t _event_count = 0;
+		std::uint64_t _last_time_bits;
+
+		/* The last keyframe with a time below time, or the first keyframe */
+		const Keyframe& keyframe_before(double time) const {
+			auto it = std::ranges::lower_bound(_keyframes, time, {}, [](const Keyframe& k) { return k.state.time; });
+			return it == _keyframes.begin() ? *it : *std::prev(it);
+		}
+
+		/* Yields the states from keyframe on until stop(state) or the end of the log */
+		template<typename Stop>
+		coro::generator<const VesselState&> replay_from(const Keyframe& keyframe, Stop stop) const {
+			auto state = keyframe.state;
+			auto time_bits = std::bit_cast<std::uint64_t>(state.time);
+			const auto* position = reinterpret_cast<const std::byte*>(_events.data()) + keyframe.offset;
+			auto next_keyframe = std::ranges::upper_bound(_keyframes, keyframe.event, {}, &Keyframe::event);
+
+			for (auto event = keyframe.event;; event++) {
+				if (stop(std::as_const(state))) {
+					co_return;
+				}
+				co_yield state;
+				if (event == _event_count) {
+					co_return;
+				}
+
+				auto rule_code = read_varint(position);
+				time_bits += read_varint(position);
+				if (rule_code == 0) {
+					state.agent_count = next_keyframe->state.agent_count;
+				}
+				else {
+					_network->apply(rule_code - 1, state.agent_count);
+				}
+				state.time = std::bit_cast<double>(time_bits);
+				if (next_keyframe != _keyframes.end() && next_keyframe->event == event + 1) {
+					++next_keyframe;
+				}
+			}
+		}
+
+	public:
+		EventLog(std::shared_ptr<const CompiledNetwork> network, VesselState initial_state, std::size_t keyframe_interval = 1024, bool every_event_leaps = false)
+			: _network(std::move(network)), _keyframe_interval(std::max<std::size_t>(keyframe_interval, 1)), _every_event_leaps(every_event_leaps),
+			  _last_time_bits(std::bit_cast<std::uint64_t>(initial_state.time)) {
+			_keyframes.push_back({ .event = 0, .offset = 0, .state = std::move(initial_state) });
+		}
+
+		/* Records a simulation from its current state on */
+		template<std::uniform_random_bit_generator R>
+		explicit EventLog(const Simulation<R>& simulation, std::size_t keyframe_interval = 1024)
+			: EventLog(simulation.shared_network(), simulation.state(), keyframe_interval, simulation.algorithm() == SimulationAlgorithm::hybrid) {}
+
+		/* Records an event, state is the state after it */
+		void record(const VesselState& state, std::size_t rule_index) {
+			if (_every_event_leaps) {
+				rule_index = leap_rule_index;
+			}
+			auto time_bits = std::bit_cast<std::uint64_t>(state.time);
+			append_varint(_events, rule_index == leap_rule_index ? 0 : rule_index + 1);
+			append_varint(_events, time_bits - _last_time_bits);
+			_last_time_bits = time_bits;
+			_event_count++;
+			if (rule_index == leap_rule_index || _event_count - _keyframes.back().event >= _keyframe_interval) {
+				_keyframes.push_back({ .event = _event_count, .offset = _events.size(), .state = state });
+			}
+		}
+
+		/* So the log can be given to Simulation::run as the observer */
+		void operator()(const VesselState& state, std::size_t rule_index) {
+			record(state, rule_index);
+		}
+
+		std::size_t event_count() const {
+			return _event_count;
+		}
+
+		std::size_t keyframe_count() const {
+			return _keyframes.size();
+		}
+
+		/* The bytes of the events and the keyframes */
+		std::size_t memory_size() const {
+			std::size_t rv = _events.capacity();
+			for (const auto& keyframe : _keyframes) {
+				rv += sizeof(Keyframe) + keyframe.state.agent_count.capacity() * sizeof(agent_count_t);
+			}
+			return rv;
+		}
+
+		/* The state after the given event */
+		VesselState state_at_event(std::size_t event) const {
+			event = std::min(event, _event_count);
+			auto it = std::prev(std::ranges::upper_bound(_keyframes, event, {}, &Keyframe::event));
+			auto current = it->event;
+			for (const auto& state : replay_from(*it, [&](const VesselState&) { return false; })) {
+				if (current++ == event) {
+					return state;
+				}
+			}
+			return it->state;
+		}
+
+		/* The last state at or before time, the initial state if time is before it */
+		VesselState state_at(double time) const {
+			const auto& keyframe = keyframe_before(time);
+			VesselState rv = keyframe.state;
+			for (const auto& state : replay_from(keyframe, [&](const VesselState& s) { return s.time > time; })) {
+				rv = state;
+			}
+			return rv;
+		}
+
+		/* The states with from <= time <= to, rebuilt from the keyframe before from */
+		coro::generator<const VesselState&> replay(double from = -std::numeric_limits<double>::infinity(), double to = std::numeric_limits<double>::infinity()) const {
+			for (const auto& state : replay_from(keyframe_before(from), [&](const VesselState& s) { return s.time > to; })) {
+				if (state.time >= from) {
+					co_yield state;
+				}
+			}
+		}
+	};
+}
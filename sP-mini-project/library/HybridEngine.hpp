@@ -0,0 +1,217 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "SimulationEngine.hpp"
+
+namespace stosim {
+	/* A hybrid engine in the style of Haseltine & Rawlings. A rule is fast when every agent it
+	   consumes or changes has a large population, the fast rules are integrated as reaction
+	   rate ODEs with RK4 while the slow rules fire exactly. Since the propensities of the slow
+	   rules change while the ODEs are integrated, a slow rule fires when the integral of their
+	   total propensity reaches an exponentially distributed threshold. The partition is redone
+	   before every step, so rules move between the sets as counts cross the threshold */
+	class HybridEngine {
+		/* Rules where every involved agent has at least this population are integrated */
+		static constexpr double fast_population = 1000;
+		/* The largest relative change of a fast agent during a single ODE step */
+		static constexpr double epsilon = 0.01;
+
+		const CompiledNetwork& _network;
+		std::vector<bool> _fast;
+		std::vector<bool> _changed_by_fast;
+		/* The continuous populations, agent_count holds them rounded */
+		std::vector<double> _amounts;
+		std::vector<double> _next_amounts;
+		std::vector<double> _k1, _k2, _k3, _k4, _scratch;
+		std::vector<double> _slow_propensities;
+		double _slow_integral = 0;
+		double _slow_threshold = 0;
+
+		bool partition() {
+			bool any_fast = false;
+			std::fill(std::begin(_changed_by_fast), std::end(_changed_by_fast), false);
+			auto large = [&](agent_token_t token) { return _amounts[token] >= fast_population; };
+			for (std::size_t j = 0; j < _network.rule_count(); j++) {
+				auto changes = _network.change_tokens(j);
+				_fast[j] = !changes.empty()
+					&& std::ranges::all_of(_network.reactant_tokens(j), large)
+					&& std::ranges::all_of(changes, large);
+				if (_fast[j]) {
+					any_fast = true;
+					for (auto token : changes) {
+						_changed_by_fast[token] = true;
+					}
+				}
+			}
+			/* Agents only changed by slow rules go back to whole numbers */
+			for (std::size_t i = 0; i < _amounts.size(); i++) {
+				if (!_changed_by_fast[i]) {
+					_amounts[i] = std::round(_amounts[i]);
+				}
+			}
+			return any_fast;
+		}
+
+		void derivative(const std::vector<double>& amounts, std::vector<double>& out) const {
+			std::ranges::fill(out, 0.0);
+			for (std::size_t j = 0; j < _network.rule_count(); j++) {
+				if (!_fast[j]) {
+					continue;
+				}
+				auto rule_propensity = _network.continuous_propensity(j, amounts);
+				auto tokens = _network.change_tokens(j);
+				auto changes = _network.change_amounts(j);
+				for (std::size_t k = 0; k < tokens.size(); k++) {
+					out[tokens[k]] += changes[k] * rule_propensity;
+				}
+			}
+		}
+
+		double slow_total(const std::vector<double>& amounts) {
+			double total = 0;
+			for (std::size_t j = 0; j < _network.rule_count(); j++) {
+				_slow_propensities[j] = _fast[j] ? 0 : _network.continuous_propensity(j, amounts);
+				total += _slow_propensities[j];
+			}
+			return total;
+		}
+
+		/* One classic Runge-Kutta step from _amounts, where _k1 already holds the derivative */
+		void runge_kutta(double h) {
+			auto n = _amounts.size();
+			for (std::size_t i = 0; i < n; i++) {
+				_scratch[i] = _amounts[i] + h / 2 * _k1[i];
+			}
+			derivative(_scratch, _k2);
+			for (std::size_t i = 0; i < n; i++) {
+				_scratch[i] = _amounts[i] + h / 2 * _k2[i];
+			}
+			derivative(_scratch, _k3);
+			for (std::size_t i = 0; i < n; i++) {
+				_scratch[i] = _amounts[i] + h * _k3[i];
+			}
+			derivative(_scratch, _k4);
+			for (std::size_t i = 0; i < n; i++) {
+				_next_amounts[i] = std::max(_amounts[i] + h / 6 * (_k1[i] + 2 * _k2[i] + 2 * _k3[i] + _k4[i]), 0.0);
+			}
+		}
+
+		void write_counts(VesselState& state) const {
+			for (std::size_t i = 0; i < _amounts.size(); i++) {
+				state.agent_count[i] = static_cast<agent_count_t>(std::llround(_amounts[i]));
+			}
+		}
+
+		template<std::uniform_random_bit_generator R>
+		std::size_t fire_slow_rule(double total, R& rng) {
+			auto target = std::uniform_real_distribution(0.0, total)(rng);
+			std::size_t rule_index = 0;
+			double cumulative = 0;
+			for (std::size_t j = 0; j < _network.rule_count(); j++) {
+				if (_slow_propensities[j] <= 0) {
+					continue;
+				}
+				cumulative += _slow_propensities[j];
+				rule_index = j;
+				if (target < cumulative) {
+					break;
+				}
+			}
+			auto tokens = _network.change_tokens(rule_index);
+			auto changes = _network.change_amounts(rule_index);
+			for (std::size_t k = 0; k < tokens.size(); k++) {
+				_amounts[tokens[k]] = std::max(_amounts[tokens[k]] + changes[k], 0.0);
+			}
+			_slow_integral = 0;
+			_slow_threshold = std::exponential_distribution(1.0)(rng);
+			return rule_index;
+		}
+
+	public:
+		HybridEngine(const CompiledNetwork& network)
+			: _network(network), _fast(network.rule_count()), _changed_by_fast(network.agent_type_count()),
+			  _amounts(network.agent_type_count()), _next_amounts(network.agent_type_count()), _k1(network.agent_type_count()),
+			  _k2(network.agent_type_count()), _k3(network.agent_type_count()), _k4(network.agent_type_count()),
+			  _scratch(network.agent_type_count()), _slow_propensities(network.rule_count()) {}
+
+		template<std::uniform_random_bit_generator R>
+		void reset(const VesselState& state, R& rng) {
+			for (std::size_t i = 0; i < _amounts.size(); i++) {
+				_amounts[i] = static_cast<double>(state.agent_count[i]);
+			}
+			_slow_integral = 0;
+			_slow_threshold = std::exponential_distribution(1.0)(rng);
+		}
+
+		/* The amounts are kept with their fractions, the partition and the slow propensities are recomputed on every step */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_amounts, _slow_integral, _slow_threshold);
+		}
+
+		bool consistent() const {
+			return _amounts.size() == _network.agent_type_count();
+		}
+
+		/* Returns the slow rule that fired, or leap_rule_index after an ODE step without one */
+		template<std::uniform_random_bit_generator R>
+		std::optional<std::size_t> step(VesselState& state, R& rng) {
+			auto any_fast = partition();
+			auto slow_before = slow_total(_amounts);
+
+			auto h = std::numeric_limits<double>::infinity();
+			if (any_fast) {
+				derivative(_amounts, _k1);
+				for (std::size_t i = 0; i < _amounts.size(); i++) {
+					if (_k1[i] != 0) {
+						h = std::min(h, epsilon * std::max(_amounts[i], 1.0) / std::abs(_k1[i]));
+					}
+				}
+			}
+
+			if (std::isinf(h)) {
+				/* Nothing changes continuously, so the slow propensities are constant and the
+				   next slow rule fires exactly as in the direct method */
+				if (slow_before <= 0) {
+					return std::nullopt;
+				}
+				state.time += (_slow_threshold - _slow_integral) / slow_before;
+				auto rule_index = fire_slow_rule(slow_before, rng);
+				write_counts(state);
+				return rule_index;
+			}
+
+			runge_kutta(h);
+			auto increment = h * (slow_before + slow_total(_next_amounts)) / 2;
+			bool fire = increment > 0 && _slow_integral + increment >= _slow_threshold;
+			if (fire) {
+				/* Shorten the step so it ends where the integral reaches the threshold */
+				h *= (_slow_threshold - _slow_integral) / increment;
+				runge_kutta(h);
+			}
+
+			std::swap(_amounts, _next_amounts);
+			state.time += h;
+
+			if (fire) {
+				auto slow_after = slow_total(_amounts);
+				if (slow_after > 0) {
+					auto rule_index = fire_slow_rule(slow_after, rng);
+					write_counts(state);
+					return rule_index;
+				}
+				_slow_integral = 0;
+				_slow_threshold = std::exponential_distribution(1.0)(rng);
+			}
+			else {
+				_slow_integral += increment;
+			}
+
+			write_counts(state);
+			return leap_rule_index;
+		}
+	};
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+namespace stosim {
+	/* A binary min heap over the indices 0..n-1 where the priority of any index can be changed
+	   in O(log n). The position of every index in the heap is tracked, so the next reaction
+	   method can update the putative time of a single rule without searching for it */
+	class IndexedPriorityQueue {
+		std::vector<double> _priorities;
+		std::vector<std::size_t> _heap;
+		std::vector<std::size_t> _positions;
+
+		bool less(std::size_t a, std::size_t b) const {
+			return _priorities[_heap[a]] < _priorities[_heap[b]];
+		}
+
+		void swap_nodes(std::size_t a, std::size_t b) {
+			std::swap(_heap[a], _heap[b]);
+			_positions[_heap[a]] = a;
+			_positions[_heap[b]] = b;
+		}
+
+		void sift_up(std::size_t node) {
+			while (node > 0) {
+				auto parent = (node - 1) / 2;
+				if (!less(node, parent)) {
+					return;
+				}
+				swap_nodes(node, parent);
+				node = parent;
+			}
+		}
+
+		void sift_down(std::size_t node) {
+			while (true) {
+				auto smallest = node;
+				auto left = 2 * node + 1;
+				auto right = left + 1;
+				if (left < _heap.size() && less(left, smallest)) {
+					smallest = left;
+				}
+				if (right < _heap.size() && less(right, smallest)) {
+					smallest = right;
+				}
+				if (smallest == node) {
+					return;
+				}
+				swap_nodes(node, smallest);
+				node = smallest;
+			}
+		}
+
+	public:
+		IndexedPriorityQueue() {}
+
+		IndexedPriorityQueue(std::vector<double> priorities)
+			: _priorities(std::move(priorities)) {
+			_heap.resize(_priorities.size());
+			_positions.resize(_priorities.size());
+			for (std::size_t i = 0; i < _heap.size(); i++) {
+				_heap[i] = i;
+				_positions[i] = i;
+			}
+			/* Floyd's heap construction is O(n) instead of the O(n log n) from pushing one at a time */
+			for (auto i = _heap.size() / 2; i > 0; i--) {
+				sift_down(i - 1);
+			}
+		}
+
+		std::size_t top() const {
+			return _heap.front();
+		}
+
+		double top_priority() const {
+			return _priorities[_heap.front()];
+		}
+
+		double priority(std::size_t index) const {
+			return _priorities[index];
+		}
+
+		void update(std::size_t index, double priority) {
+			auto old_priority = _priorities[index];
+			_priorities[index] = priority;
+			if (priority < old_priority) {
+				sift_up(_positions[index]);
+			}
+			else {
+				sift_down(_positions[index]);
+			}
+		}
+
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_priorities, _heap, _positions);
+		}
+
+		/* True if the heap and the positions are inverse permutations of the indices and the heap is ordered */
+		bool consistent() const {
+			if (_heap.size() != _priorities.size() || _positions.size() != _priorities.size()) {
+				return false;
+			}
+			for (std::size_t node = 0; node < _heap.size(); node++) {
+				if (_heap[node] >= _heap.size() || _positions[_heap[node]] != node) {
+					return false;
+				}
+				if (node > 0 && less(node, (node - 1) / 2)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		bool empty() const {
+			return _heap.empty();
+		}
+
+		std::size_t size() const {
+			return _heap.size();
+		}
+	};
+}
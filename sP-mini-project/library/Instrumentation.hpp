@@ -0,0 +1,160 @@
+#pragma once
+#include <vector>
+#include <ostream>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <random>
+#include <algorithm>
+
+/* Define STOSIM_INSTRUMENTATION as 1 to count what the engines do. Otherwise every counter below
+   is an empty inline function, so the engines compile to the same code as without them */
+#ifndef STOSIM_INSTRUMENTATION
+#define STOSIM_INSTRUMENTATION 0
+#endif
+
+namespace stosim {
+	constexpr bool instrumentation_enabled = STOSIM_INSTRUMENTATION != 0;
+
+	/* What one or more simulations did, all zero unless STOSIM_INSTRUMENTATION is set */
+	struct SimulationStatistics {
+		std::uint64_t simulations = 0;
+		/* A leap counts as one event */
+		std::uint64_t events = 0;
+		std::uint64_t leaps = 0;
+		/* The events of every rule, leaps are not in here */
+		std::vector<std::uint64_t> rule_events;
+		std::uint64_t propensity_evaluations = 0;
+		/* Every number drawn from the random number generator */
+		std::uint64_t random_draws = 0;
+		/* Updates of the priority queue of next_reaction and moves between the groups of composition_rejection */
+		std::uint64_t queue_updates = 0;
+		/* States handed out by the generators */
+		std::uint64_t yields = 0;
+		/* Resetting the engine, at the start and after a time horizon */
+		double setup_seconds = 0;
+		/* Inside the steps of the engine, so the time the consumer of a generator takes is left out */
+		double step_seconds = 0;
+
+		double events_per_second() const {
+			return step_seconds > 0 ? static_cast<double>(events) / step_seconds : 0;
+		}
+
+		void merge(const SimulationStatistics& other) {
+			simulations += other.simulations;
+			events += other.events;
+			leaps += other.leaps;
+			rule_events.resize(std::max(rule_events.size(), other.rule_events.size()));
+			for (std::size_t i = 0; i < other.rule_events.size(); i++) {
+				rule_events[i] += other.rule_events[i];
+			}
+			propensity_evaluations += other.propensity_evaluations;
+			random_draws += other.random_draws;
+			queue_updates += other.queue_updates;
+			yields += other.yields;
+			setup_seconds += other.setup_seconds;
+			step_seconds += other.step_seconds;
+		}
+
+		void write_json(std::ostream& out) const {
+			out << "{\"instrumented\": " << (instrumentation_enabled ? "true" : "false")
+				<< ", \"simulations\": " << simulations
+				<< ", \"events\": " << events
+				<< ", \"leaps\": " << leaps
+				<< ", \"rule_events\": [";
+			for (std::size_t i = 0; i < rule_events.size(); i++) {
+				out << (i == 0 ? "" : ", ") << rule_events[i];
+			}
+			out << "], \"propensity_evaluations\": " << propensity_evaluations
+				<< ", \"random_draws\": " << random_draws
+				<< ", \"queue_updates\": " << queue_updates
+				<< ", \"yields\": " << yields
+				<< ", \"setup_seconds\": " << setup_seconds
+				<< ", \"step_seconds\": " << step_seconds
+				<< ", \"events_per_second\": " << events_per_second() << "}";
+		}
+	};
+
+	namespace instrumentation {
+		/* The statistics of the simulation that is stepping on this thread. The engines and the
+		   network are shared, so this is how the counters deep inside them find their simulation */
+		inline thread_local SimulationStatistics* current = nullptr;
+
+		/* Makes statistics the current statistics of this thread while it lives */
+		class Scope {
+			SimulationStatistics* _previous;
+
+		public:
+			explicit Scope(SimulationStatistics& statistics)
+				: _previous(current) {
+				current = &statistics;
+			}
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+			~Scope() {
+				current = _previous;
+			}
+		};
+
+		inline void count_propensity_evaluation() {
+			if constexpr (instrumentation_enabled) {
+				if (current != nullptr) {
+					current->propensity_evaluations++;
+				}
+			}
+		}
+
+		inline void count_queue_update() {
+			if constexpr (instrumentation_enabled) {
+				if (current != nullptr) {
+					current->queue_updates++;
+				}
+			}
+		}
+
+		/* Adds the time from its construction to its destruction to seconds */
+		class Timer {
+			double& _seconds;
+			std::chrono::steady_clock::time_point _start;
+
+		public:
+			explicit Timer(double& seconds)
+				: _seconds(seconds), _start(std::chrono::steady_clock::now()) {}
+
+			Timer(const Timer&) = delete;
+			Timer& operator=(const Timer&) = delete;
+
+			~Timer() {
+				_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+			}
+		};
+
+		/* Passes the numbers of a generator through while counting them */
+		template<std::uniform_random_bit_generator R>
+		class CountingRandom {
+			R& _rng;
+			std::uint64_t& _draws;
+
+		public:
+			using result_type = typename R::result_type;
+
+			CountingRandom(R& rng, std::uint64_t& draws)
+				: _rng(rng), _draws(draws) {}
+
+			static constexpr result_type min() {
+				return R::min();
+			}
+
+			static constexpr result_type max() {
+				return R::max();
+			}
+
+			result_type operator()() {
+				_draws++;
+				return _rng();
+			}
+		};
+	}
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include "CompiledNetwork.hpp"
+
+namespace stosim {
+	/* Simulates an ensemble Width replicas at a time in lockstep with the direct method. The counts
+	   are stored as structure of arrays, counts[token * Width + lane], and every kernel is a loop over
+	   the lanes with a constant trip count and no branches, so the compiler can map the lanes onto
+	   AVX2/AVX-512 registers. A lane whose replica has finished is masked out of the updates and
+	   refilled with the next replica, so no lane idles while there are replicas left */
+	template<std::size_t Width = 8>
+	class LockstepEnsemble {
+		static constexpr double no_rule = -1;
+
+		const CompiledNetwork& _network;
+		std::vector<agent_count_t> _initial_state;
+
+		/* xorshift128+ only needs shifts, xors and adds, which vectorize on every instruction set */
+		struct LaneRandom {
+			std::array<std::uint64_t, Width> s0;
+			std::array<std::uint64_t, Width> s1;
+
+			/* Fills out with uniform numbers in [0, 1) */
+			void uniform(std::array<double, Width>& out) {
+				for (std::size_t l = 0; l < Width; l++) {
+					auto x = s0[l];
+					auto y = s1[l];
+					s0[l] = y;
+					x ^= x << 23;
+					s1[l] = x ^ y ^ (x >> 17) ^ (y >> 26);
+					out[l] = static_cast<double>((s1[l] + y) >> 11) * 0x1.0p-53;
+				}
+			}
+
+			/* splitmix64 of the seed and replica, so every replica has its own stream */
+			void seed(std::size_t lane, std::uint64_t seed, std::uint64_t replica) {
+				auto state = seed ^ (replica * 0x9E3779B97F4A7C15ull);
+				auto next = [&]() {
+					auto z = (state += 0x9E3779B97F4A7C15ull);
+					z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+					z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+					return z ^ (z >> 31);
+				};
+				s0[lane] = next();
+				s1[lane] = next();
+				if (s0[lane] == 0 && s1[lane] == 0) {
+					s1[lane] = 1;
+				}
+			}
+		};
+
+	public:
+		/* A view of the counts of a single lane */
+		class LaneView {
+			const double* _counts;
+			std::size_t _size;
+		public:
+			LaneView(const double* counts, std::size_t size)
+				: _counts(counts), _size(size) {}
+
+			agent_count_t operator[](agent_token_t token) const {
+				return static_cast<agent_count_t>(_counts[token * Width]);
+			}
+
+			std::size_t size() const {
+				return _size;
+			}
+		};
+
+		LockstepEnsemble(const CompiledNetwork& network, std::vector<agent_count_t> initial_state)
+			: _network(network), _initial_state(std::move(initial_state)) {}
+
+		/* Runs replica_count replicas until end_time or until no rule can fire. observe(replica, time, counts)
+		   is called with the initial state of every replica and after every event before end_time,
+		   the calls for different replicas are interleaved */
+		template<typename Observer>
+		void run(std::size_t replica_count, std::uint64_t seed, double end_time, Observer&& observe) const {
+			const auto agent_types = _network.agent_type_count();
+			const auto rules = _network.rule_count();
+
+			/* Counts are stored as doubles, which are exact up to 2^53 and convert for free in the propensity kernel */
+			std::vector<double> counts(agent_types * Width);
+			std::vector<double> propensities(rules * Width);
+			std::array<double, Width> time{}, total{}, target{}, cumulative{}, delay{}, selected{}, active{};
+			std::array<std::size_t, Width> replica{};
+			LaneRandom random{};
+			std::size_t next_replica = 0;
+
+			auto start_lane = [&](std::size_t lane) {
+				if (next_replica >= replica_count) {
+					active[lane] = 0;
+					return;
+				}
+				replica[lane] = next_replica++;
+				for (std::size_t token = 0; token < agent_types; token++) {
+					counts[token * Width + lane] = static_cast<double>(_initial_state[token]);
+				}
+				time[lane] = 0;
+				active[lane] = 1;
+				random.seed(lane, seed, replica[lane]);
+				observe(replica[lane], 0.0, LaneView(&counts[lane], agent_types));
+			};
+
+			for (std::size_t lane = 0; lane < Width; lane++) {
+				start_lane(lane);
+			}
+
+			while (std::ranges::any_of(active, [](double a) { return a != 0; })) {
+				/* Propensities, masked by whether the lane is active */
+				for (std::size_t r = 0; r < rules; r++) {
+					auto* out = &propensities[r * Width];
+					for (std::size_t l = 0; l < Width; l++) {
+						out[l] = _network.rate(r) * active[l];
+					}
+					auto tokens = _network.reactant_tokens(r);
+					auto multiplicities = _network.reactant_multiplicities(r);
+					for (std::size_t k = 0; k < tokens.size(); k++) {
+						const auto* x = &counts[tokens[k] * Width];
+						for (agent_count_t m = 0; m < multiplicities[k]; m++) {
+							for (std::size_t l = 0; l < Width; l++) {
+								out[l] *= std::max(x[l] - m, 0.0) / (m + 1);
+							}
+						}
+					}
+				}
+
+				std::ranges::fill(total, 0.0);
+				for (std::size_t r = 0; r < rules; r++) {
+					for (std::size_t l = 0; l < Width; l++) {
+						total[l] += propensities[r * Width + l];
+					}
+				}
+
+				random.uniform(delay);
+				random.uniform(target);
+				for (std::size_t l = 0; l < Width; l++) {
+					delay[l] = -std::log(1.0 - delay[l]) / total[l];
+					target[l] *= total[l];
+					time[l] += delay[l];
+					/* A lane stops when nothing can fire or when the event is past the end */
+					active[l] = (active[l] != 0 && total[l] > 0 && time[l] < end_time) ? 1.0 : 0.0;
+					cumulative[l] = 0;
+					selected[l] = no_rule;
+				}
+
+				/* Selection: the first rule whose cumulative propensity passes the target */
+				for (std::size_t r = 0; r < rules; r++) {
+					for (std::size_t l = 0; l < Width; l++) {
+						auto a = propensities[r * Width + l];
+						cumulative[l] += a;
+						auto take = active[l] != 0 && selected[l] == no_rule && a > 0 && target[l] < cumulative[l];
+						selected[l] = take ? static_cast<double>(r) : selected[l];
+					}
+				}
+				/* Rounding can put the target past the last rule, then the last enabled rule is used */
+				for (std::size_t r = rules; r-- > 0;) {
+					for (std::size_t l = 0; l < Width; l++) {
+						auto take = active[l] != 0 && selected[l] == no_rule && propensities[r * Width + l] > 0;
+						selected[l] = take ? static_cast<double>(r) : selected[l];
+					}
+				}
+
+				/* State update, every lane applies the changes of every rule masked by whether it was selected */
+				for (std::size_t r = 0; r < rules; r++) {
+					auto tokens = _network.change_tokens(r);
+					auto amounts = _network.change_amounts(r);
+					for (std::size_t k = 0; k < tokens.size(); k++) {
+						auto* x = &counts[tokens[k] * Width];
+						auto amount = static_cast<double>(amounts[k]);
+						for (std::size_t l = 0; l < Width; l++) {
+							x[l] += selected[l] == static_cast<double>(r) ? amount : 0.0;
+						}
+					}
+				}
+
+				for (std::size_t lane = 0; lane < Width; lane++) {
+					if (active[lane] != 0) {
+						observe(replica[lane], time[lane], LaneView(&counts[lane], agent_types));
+					}
+					else {
+						start_lane(lane);
+					}
+				}
+			}
+		}
+	};
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <cmath>
+#include "SimulationEngine.hpp"
+#include "DependencyGraph.hpp"
+#include "IndexedPriorityQueue.hpp"
+
+namespace stosim {
+	/* The next reaction method by Gibson & Bruck. Every rule keeps an absolute putative firing
+	   time in an indexed priority queue, so finding the next rule is O(1) and an event only
+	   touches the rules in the dependency graph of the rule that fired, each in O(log n) */
+	class NextReactionEngine {
+		const CompiledNetwork& _network;
+		DependencyGraph _dependency_graph;
+		std::vector<double> _propensities;
+		IndexedPriorityQueue _firing_times;
+	public:
+		NextReactionEngine(const CompiledNetwork& network)
+			: _network(network), _dependency_graph(network), _propensities(network.rule_count()) {}
+
+		template<std::uniform_random_bit_generator R>
+		void reset(const VesselState& state, R& rng) {
+			std::vector<double> firing_times(_network.rule_count());
+			for (std::size_t i = 0; i < _network.rule_count(); i++) {
+				_propensities[i] = _network.propensity(i, state.agent_count);
+				firing_times[i] = state.time + draw_delay(_propensities[i], rng);
+			}
+			_firing_times = IndexedPriorityQueue(std::move(firing_times));
+		}
+
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_propensities);
+			_firing_times.checkpoint(archive);
+		}
+
+		bool consistent() const {
+			return _propensities.size() == _network.rule_count() && _firing_times.size() == _network.rule_count() && _firing_times.consistent();
+		}
+
+		template<std::uniform_random_bit_generator R>
+		std::optional<std::size_t> step(VesselState& state, R& rng) {
+			if (_firing_times.empty() || std::isinf(_firing_times.top_priority())) {
+				return std::nullopt;
+			}
+
+			auto rule_index = _firing_times.top();
+			state.time = _firing_times.top_priority();
+			_network.apply(rule_index, state.agent_count);
+
+			for (auto dependent : _dependency_graph.dependents(rule_index)) {
+				auto old_propensity = _propensities[dependent];
+				auto new_propensity = _network.propensity(dependent, state.agent_count);
+				_propensities[dependent] = new_propensity;
+
+				/* The rule that fired and rules that were disabled need a fresh draw. Gibson & Bruck
+				   keep the remaining time of a disabled rule around, but since the exponential
+				   distribution is memoryless a fresh draw once it is enabled again is equivalent */
+				double firing_time;
+				if (dependent == rule_index || old_propensity <= 0 || new_propensity <= 0) {
+					firing_time = state.time + draw_delay(new_propensity, rng);
+				}
+				else {
+					/* Otherwise the remaining time is rescaled, which reuses the old random number */
+					firing_time = state.time + (old_propensity / new_propensity) * (_firing_times.priority(dependent) - state.time);
+				}
+				_firing_times.update(dependent, firing_time);
+				instrumentation::count_queue_update();
+			}
+
+			return rule_index;
+		}
+	};
+}
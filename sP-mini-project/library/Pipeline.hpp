@@ -0,0 +1,324 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <optional>
+#include <functional>
+#include <exception>
+#include <cstdint>
+#include <cstddef>
+#include <bit>
+#include <algorithm>
+#include "SimulationEngine.hpp"
+
+namespace stosim {
+	/* A bounded queue that any number of threads can push to and a single thread pops from,
+	   without locks. Every slot has a sequence number that tells whether it is free for the
+	   push at that position or holds the value for the pop at that position, so a push only
+	   has to claim a position and a pop never contends with anyone. With a single producer it
+	   works as a SPSC queue, where the claim never fails */
+	template<typename T>
+	class MpscRing {
+		struct Slot {
+			std::atomic<std::size_t> sequence;
+			T value;
+		};
+
+		std::unique_ptr<Slot[]> _slots;
+		std::size_t _mask;
+		/* Apart so the producers and the consumer do not share a cache line */
+		alignas(64) std::atomic<std::size_t> _tail = 0;
+		alignas(64) std::atomic<std::size_t> _head = 0;
+
+	public:
+		/* The capacity is rounded up to a power of two */
+		explicit MpscRing(std::size_t capacity)
+			: _slots(std::make_unique<Slot[]>(std::bit_ceil(std::max<std::size_t>(capacity, 2)))), _mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1) {
+			for (std::size_t i = 0; i <= _mask; i++) {
+				_slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		/* Moves value into the queue unless it is full */
+		bool try_push(T& value) {
+			auto position = _tail.load(std::memory_order_relaxed);
+			while (true) {
+				auto& slot = _slots[position & _mask];
+				auto sequence = slot.sequence.load(std::memory_order_acquire);
+				auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+				if (difference == 0) {
+					if (_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+						slot.value = std::move(value);
+						slot.sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (difference < 0) {
+					return false;
+				}
+				else {
+					position = _tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/* Only called from the consumer */
+		std::optional<T> try_pop() {
+			auto position = _head.load(std::memory_order_relaxed);
+			auto& slot = _slots[position & _mask];
+			if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+				return std::nullopt;
+			}
+			auto value = std::move(slot.value);
+			slot.sequence.store(position + _mask + 1, std::memory_order_release);
+			_head.store(position + 1, std::memory_order_release);
+			return value;
+		}
+
+		/* Only exact when no one is pushing or popping */
+		std::size_t size() const {
+			auto head = _head.load(std::memory_order_acquire);
+			auto tail = _tail.load(std::memory_order_acquire);
+			return tail > head ? tail - head : 0;
+		}
+
+		std::size_t capacity() const {
+			return _mask + 1;
+		}
+	};
+
+	/* The states a simulation handed to the pipeline since its previous batch */
+	struct StateBatch {
+		std::size_t simulation;
+		std::vector<VesselState> states;
+		/* Whether this is the last batch of the simulation */
+		bool last;
+	};
+
+	/* Takes every batch of every simulation. Batches of one simulation arrive in order, batches of
+	   different simulations are interleaved */
+	struct PipelineSink {
+		std::string name;
+		std::function<void(const StateBatch&)> consume;
+	};
+
+	struct PipelineOptions {
+		/* States per batch */
+		std::size_t batch_size = 256;
+		/* Batches that can wait for a sink before the producers block */
+		std::size_t queue_capacity = 64;
+	};
+
+	/* The counters of a sink. A stage whose producers often wait is the bottleneck, a stage
+	   that is often idle is waiting for the simulations */
+	struct StageStatistics {
+		std::string name;
+		std::uint64_t batches = 0;
+		std::uint64_t states = 0;
+		/* How often a producer found the queue full */
+		std::uint64_t producer_waits = 0;
+		/* How often the sink found the queue empty */
+		std::uint64_t idle_waits = 0;
+		std::size_t queue_depth = 0;
+		std::size_t max_queue_depth = 0;
+		std::size_t queue_capacity = 0;
+		/* Time spent inside the sink */
+		double sink_seconds = 0;
+
+		/* States per second of sink time */
+		double throughput() const {
+			return sink_seconds > 0 ? static_cast<double>(states) / sink_seconds : 0;
+		}
+	};
+
+	/* Connects simulations running on any number of threads to sinks that each run on their own
+	   thread, through a bounded queue per sink. The producers batch the states and block when a
+	   queue is full, so a slow sink slows the simulations down instead of the queues growing.
+	   A batch is shared between the sinks, not copied */
+	class StatePipeline {
+		using batch_ptr_t = std::shared_ptr<const StateBatch>;
+
+		struct Stage {
+			PipelineSink sink;
+			MpscRing<batch_ptr_t> queue;
+			/* Bumped on every push and pop, the blocked side waits for these to change */
+			std::atomic<std::uint64_t> pushed = 0;
+			std::atomic<std::uint64_t> popped = 0;
+			std::atomic<bool> closed = false;
+			std::atomic<std::uint64_t> batches = 0;
+			std::atomic<std::uint64_t> states = 0;
+			std::atomic<std::uint64_t> producer_waits = 0;
+			std::atomic<std::uint64_t> idle_waits = 0;
+			std::atomic<std::size_t> max_queue_depth = 0;
+			std::atomic<std::int64_t> sink_nanoseconds = 0;
+			std::exception_ptr exception;
+			std::jthread consumer;
+
+			Stage(PipelineSink s, std::size_t capacity)
+				: sink(std::move(s)), queue(capacity) {}
+
+			void push(batch_ptr_t batch) {
+				while (true) {
+					auto seen = popped.load(std::memory_order_acquire);
+					if (queue.try_push(batch)) {
+						break;
+					}
+					producer_waits.fetch_add(1, std::memory_order_relaxed);
+					popped.wait(seen, std::memory_order_acquire);
+				}
+				auto depth = queue.size();
+				auto max_depth = max_queue_depth.load(std::memory_order_relaxed);
+				while (depth > max_depth && !max_queue_depth.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {}
+				pushed.fetch_add(1, std::memory_order_release);
+				pushed.notify_one();
+			}
+
+			void consume() {
+				while (true) {
+					auto seen = pushed.load(std::memory_order_acquire);
+					auto batch = queue.try_pop();
+					if (!batch.has_value()) {
+						if (closed.load(std::memory_order_acquire) && queue.size() == 0) {
+							return;
+						}
+						idle_waits.fetch_add(1, std::memory_order_relaxed);
+						pushed.wait(seen, std::memory_order_acquire);
+						continue;
+					}
+					popped.fetch_add(1, std::memory_order_release);
+					popped.notify_all();
+
+					/* A sink that threw keeps draining its queue, so the producers do not block forever */
+					if (!exception) {
+						auto start = std::chrono::steady_clock::now();
+						try {
+							sink.consume(**batch);
+						}
+						catch (...) {
+							exception = std::current_exception();
+						}
+						sink_nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+					}
+					batches.fetch_add(1, std::memory_order_relaxed);
+					states.fetch_add((*batch)->states.size(), std::memory_order_relaxed);
+				}
+			}
+
+			void close() {
+				closed.store(true, std::memory_order_release);
+				pushed.fetch_add(1, std::memory_order_release);
+				pushed.notify_one();
+			}
+		};
+
+		PipelineOptions _options;
+		std::vector<std::unique_ptr<Stage>> _stages;
+		bool _closed = false;
+
+	public:
+		/* Collects the states of a simulation into batches, it can be given to Simulation::run as the observer */
+		class Producer {
+			StatePipeline* _pipeline;
+			std::size_t _simulation;
+			std::vector<VesselState> _states;
+
+			void send(bool last) {
+				auto batch = std::make_shared<const StateBatch>(StateBatch{ .simulation = _simulation, .states = std::move(_states), .last = last });
+				for (auto& stage : _pipeline->_stages) {
+					stage->push(batch);
+				}
+				_states = {};
+				_states.reserve(_pipeline->_options.batch_size);
+			}
+
+		public:
+			Producer(StatePipeline& pipeline, std::size_t simulation)
+				: _pipeline(&pipeline), _simulation(simulation) {
+				_states.reserve(_pipeline->_options.batch_size);
+			}
+
+			void push(const VesselState& state) {
+				_states.push_back(state);
+				if (_states.size() == _pipeline->_options.batch_size) {
+					send(false);
+				}
+			}
+
+			void operator()(const VesselState& state, std::size_t) {
+				push(state);
+			}
+
+			/* Sends what is left as the last batch of the simulation */
+			void finish() {
+				send(true);
+			}
+		};
+
+		StatePipeline(std::vector<PipelineSink> sinks, PipelineOptions options = {})
+			: _options(options) {
+			_options.batch_size = std::max<std::size_t>(_options.batch_size, 1);
+			for (auto& sink : sinks) {
+				_stages.push_back(std::make_unique<Stage>(std::move(sink), _options.queue_capacity));
+			}
+			for (auto& stage : _stages) {
+				stage->consumer = std::jthread([stage = stage.get()]() { stage->consume(); });
+			}
+		}
+
+		StatePipeline(const StatePipeline&) = delete;
+		StatePipeline& operator=(const StatePipeline&) = delete;
+
+		~StatePipeline() {
+			if (!_closed) {
+				for (auto& stage : _stages) {
+					stage->close();
+				}
+			}
+		}
+
+		Producer producer(std::size_t simulation) {
+			return Producer(*this, simulation);
+		}
+
+		/* Waits for the sinks to take every batch and rethrows the first exception a sink threw.
+		   No producer may push after this */
+		void close() {
+			if (_closed) {
+				return;
+			}
+			_closed = true;
+			for (auto& stage : _stages) {
+				stage->close();
+			}
+			for (auto& stage : _stages) {
+				stage->consumer.join();
+			}
+			for (auto& stage : _stages) {
+				if (stage->exception) {
+					std::rethrow_exception(stage->exception);
+				}
+			}
+		}
+
+		std::vector<StageStatistics> statistics() const {
+			std::vector<StageStatistics> rv;
+			for (const auto& stage : _stages) {
+				rv.push_back({
+					.name = stage->sink.name,
+					.batches = stage->batches.load(std::memory_order_relaxed),
+					.states = stage->states.load(std::memory_order_relaxed),
+					.producer_waits = stage->producer_waits.load(std::memory_order_relaxed),
+					.idle_waits = stage->idle_waits.load(std::memory_order_relaxed),
+					.queue_depth = stage->queue.size(),
+					.max_queue_depth = stage->max_queue_depth.load(std::memory_order_relaxed),
+					.queue_capacity = stage->queue.capacity(),
+					.sink_seconds = static_cast<double>(stage->sink_nanoseconds.load(std::memory_order_relaxed)) * 1e-9
+				});
+			}
+			return rv;
+		}
+	};
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <concepts>
+
+namespace stosim {
+	/* A random number generator the simulations can use. It is created from a seed and a stream,
+	   and generators with the same seed but different streams must be independent, so simulation
+	   i of an ensemble can use stream i and get the same numbers no matter which thread runs it */
+	template<typename R>
+	concept RandomStream = std::uniform_random_bit_generator<R> && std::constructible_from<R, std::uint64_t, std::uint64_t>;
+
+	/* Philox4x32-10 by Salmon, Moraes, Dror & Shaw. It is counter based: block n of a stream is a
+	   keyed bijection of the counter (n, stream), so creating a stream is free and the whole state
+	   is a few words, against the 5 KB of std::mt19937 */
+	class Philox4x32 {
+		static constexpr std::uint32_t multiplier_0 = 0xD2511F53;
+		static constexpr std::uint32_t multiplier_1 = 0xCD9E8D57;
+		static constexpr std::uint32_t weyl_0 = 0x9E3779B9;
+		static constexpr std::uint32_t weyl_1 = 0xBB67AE85;
+
+		std::array<std::uint32_t, 2> _key;
+		std::uint64_t _stream;
+		/* The block that will be generated next */
+		std::uint64_t _block = 0;
+		std::array<std::uint32_t, 4> _output{};
+		/* How many 64 bit halves of _output have been used */
+		std::size_t _used = 2;
+
+		void next_block() {
+			_output = generate(
+				{ static_cast<std::uint32_t>(_block), static_cast<std::uint32_t>(_block >> 32), static_cast<std::uint32_t>(_stream), static_cast<std::uint32_t>(_stream >> 32) },
+				_key);
+			_block++;
+			_used = 0;
+		}
+
+	public:
+		using result_type = std::uint64_t;
+
+		Philox4x32(std::uint64_t seed, std::uint64_t stream = 0)
+			: _key{ static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32) }, _stream(stream) {}
+
+		/* The bijection itself, ten rounds with the key bumped between them */
+		static std::array<std::uint32_t, 4> generate(std::array<std::uint32_t, 4> counter, std::array<std::uint32_t, 2> key) {
+			for (int round = 0; round < 10; round++) {
+				if (round > 0) {
+					key[0] += weyl_0;
+					key[1] += weyl_1;
+				}
+				auto product_0 = static_cast<std::uint64_t>(multiplier_0) * counter[0];
+				auto product_1 = static_cast<std::uint64_t>(multiplier_1) * counter[2];
+				counter = {
+					static_cast<std::uint32_t>(product_1 >> 32) ^ counter[1] ^ key[0],
+					static_cast<std::uint32_t>(product_1),
+					static_cast<std::uint32_t>(product_0 >> 32) ^ counter[3] ^ key[1],
+					static_cast<std::uint32_t>(product_0)
+				};
+			}
+			return counter;
+		}
+
+		static constexpr result_type min() {
+			return 0;
+		}
+
+		static constexpr result_type max() {
+			return std::numeric_limits<result_type>::max();
+		}
+
+		result_type operator()() {
+			if (_used == 2) {
+				next_block();
+			}
+			auto rv = (static_cast<std::uint64_t>(_output[2 * _used]) << 32) | _output[2 * _used + 1];
+			_used++;
+			return rv;
+		}
+
+		/* Skips count numbers in constant time */
+		void discard(std::uint64_t count) {
+			auto position = 2 * _block - (2 - _used) + count;
+			_block = position / 2;
+			_used = 2;
+			if (position % 2 != 0) {
+				next_block();
+				_used = 1;
+			}
+		}
+
+		/* Writes or reads the state, see CheckpointWriter */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_key, _stream, _block, _output, _used);
+		}
+
+		friend bool operator==(const Philox4x32& a, const Philox4x32& b) {
+			return a._key == b._key && a._stream == b._stream && a._block == b._block && a._used == b._used;
+		}
+	};
+
+	/* xoshiro256++ by Blackman & Vigna, a small and fast generator. Streams are made by jumping
+	   2^128 numbers ahead once per stream, which is guaranteed not to overlap but costs
+	   time linear in the stream number, so Philox4x32 is the better choice for large ensembles */
+	class Xoshiro256PlusPlus {
+		std::array<std::uint64_t, 4> _state;
+
+		static std::uint64_t rotate_left(std::uint64_t x, int k) {
+			return (x << k) | (x >> (64 - k));
+		}
+
+	public:
+		using result_type = std::uint64_t;
+
+		Xoshiro256PlusPlus(std::uint64_t seed, std::uint64_t stream = 0) {
+			/* splitmix64 fills the state, as recommended by the authors */
+			for (auto& word : _state) {
+				auto z = (seed += 0x9E3779B97F4A7C15ull);
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+				word = z ^ (z >> 31);
+			}
+			for (std::uint64_t i = 0; i < stream; i++) {
+				jump();
+			}
+		}
+
+		static constexpr result_type min() {
+			return 0;
+		}
+
+		static constexpr result_type max() {
+			return std::numeric_limits<result_type>::max();
+		}
+
+		result_type operator()() {
+			auto rv = rotate_left(_state[0] + _state[3], 23) + _state[0];
+			auto t = _state[1] << 17;
+			_state[2] ^= _state[0];
+			_state[3] ^= _state[1];
+			_state[1] ^= _state[2];
+			_state[0] ^= _state[3];
+			_state[2] ^= t;
+			_state[3] = rotate_left(_state[3], 45);
+			return rv;
+		}
+
+		/* Advances the generator by 2^128 numbers */
+		void jump() {
+			static constexpr std::array<std::uint64_t, 4> polynomial = { 0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull, 0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull };
+			std::array<std::uint64_t, 4> jumped{};
+			for (auto word : polynomial) {
+				for (int bit = 0; bit < 64; bit++) {
+					if (word & (1ull << bit)) {
+						for (std::size_t i = 0; i < 4; i++) {
+							jumped[i] ^= _state[i];
+						}
+					}
+					(*this)();
+				}
+			}
+			_state = jumped;
+		}
+
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_state);
+		}
+
+		friend bool operator==(const Xoshiro256PlusPlus& a, const Xoshiro256PlusPlus& b) {
+			return a._state == b._state;
+		}
+	};
+
+	using default_random_t = Philox4x32;
+
+	/* A seed for simulations that were not given one */
+	inline std::uint64_t random_seed() {
+		std::random_device rd;
+		return (static_cast<std::uint64_t>(rd()) << 32) ^ rd();
+	}
+}
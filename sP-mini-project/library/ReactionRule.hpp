@@ -0,0 +1,203 @@
+#pragma once
+#include <set>
+#include <vector>
+#include <span>
+#include <exception>
+
+namespace stosim {
+	using agent_token_t = size_t;
+	using agent_count_t = size_t;
+	
+	class AgentSetAndRate;
+	class ReactionRule;
+
+	/* The rate of a reaction rule, a constant times a product of parameters that are each raised to
+	   a whole power, so beta / N and R0 * gamma are rates when beta, R0 and gamma are parameters.
+	   A parameter is added with Vessel::add_parameter(), and a sweep gives it other values
+	   without building the vessel again. Sums of parameters are not rates */
+	class Rate {
+	public:
+		struct Factor {
+			std::size_t parameter;
+			int power;
+			/* The value the parameter was added with */
+			double value;
+		};
+
+	private:
+		double _coefficient;
+		/* Kept apart from the coefficient, so beta / N is exactly the double it would be without parameters */
+		double _divisor = 1;
+		std::vector<Factor> _factors;
+
+		template<typename Value>
+		double evaluate(Value value) const {
+			auto rv = _coefficient;
+			for (const auto& factor : _factors) {
+				for (int k = 0; k < factor.power; k++) {
+					rv *= value(factor);
+				}
+				for (int k = 0; k > factor.power; k--) {
+					rv /= value(factor);
+				}
+			}
+			return rv / _divisor;
+		}
+
+	public:
+		Rate(double coefficient = 1)
+			: _coefficient(coefficient) {}
+
+		/* The rate that is just the given parameter */
+		static Rate parameter(std::size_t parameter, double value) {
+			Rate rv;
+			rv._factors.push_back({ .parameter = parameter, .power = 1, .value = value });
+			return rv;
+		}
+
+		/* The rate with every parameter at the value it was added with */
+		double value() const {
+			return evaluate([](const Factor& factor) { return factor.value; });
+		}
+
+		/* The rate with parameter i at parameters[i] */
+		double value(std::span<const double> parameters) const {
+			return evaluate([&](const Factor& factor) { return parameters[factor.parameter]; });
+		}
+
+		const std::vector<Factor>& get_factors() const {
+			return _factors;
+		}
+
+		friend Rate operator*(Rate a, const Rate& b) {
+			a._coefficient *= b._coefficient;
+			a._divisor *= b._divisor;
+			a._factors.insert(std::end(a._factors), std::cbegin(b._factors), std::cend(b._factors));
+			return a;
+		}
+
+		friend Rate operator/(Rate a, const Rate& b) {
+			a._coefficient *= b._divisor;
+			a._divisor *= b._coefficient;
+			for (auto factor : b._factors) {
+				factor.power = -factor.power;
+				a._factors.push_back(factor);
+			}
+			return a;
+		}
+	};
+
+	/* An agent set holds a set of agents which can be composed using multiple operators*/
+	class AgentSet {
+		/*Using a multiset, since A + A means two A's. This is what allows stoichiometric
+		  coefficients like 2A in the reaction rules*/
+		std::multiset<agent_token_t> _agents;
+	public:
+		AgentSet(const AgentSet& other) = default;
+		AgentSet& operator=(const AgentSet& other) = default;
+
+		AgentSet(AgentSet&& other) = default;
+		AgentSet& operator=(AgentSet&& other) = default;
+
+		AgentSet() { }
+
+		AgentSet(agent_token_t agent_token) {
+			_agents.insert(agent_token);
+		}
+
+		/* According to requirement 1 we should create overloads that allows us to
+		   write reaction rules directly in the c++. Therefore a operator for +
+		   combines two agent sets into a single one containing all the agents from
+		   both agent sets*/
+		AgentSet operator+(const AgentSet& other) const {
+			AgentSet rv;
+			rv._agents.insert_range(_agents);
+			rv._agents.insert_range(other._agents);
+			return rv;
+		}
+
+		/* n * A is the same as adding A to itself n times */
+		friend AgentSet operator*(agent_count_t count, const AgentSet& agent_set) {
+			AgentSet rv;
+			for (agent_count_t i = 0; i < count; i++) {
+				rv._agents.insert_range(agent_set._agents);
+			}
+			return rv;
+		}
+
+		const std::multiset<agent_token_t>& get_agent_tokens() const {
+			return _agents;
+		}
+
+		const agent_token_t get_agent_token() const {
+			if (_agents.size() != 1) {
+				throw std::exception("Getting agent token is only supported when the agent set has a single token");
+			}
+			return *std::cbegin(_agents);
+		}
+		
+		/* Requirement 1 also requires that we should be able to set the rate of
+		   a reaction using >>, this creates a new class called AgentSetAndRate
+		   which suprisingly contains an agent set and a rate*/
+		AgentSetAndRate operator>>(Rate rate) const;
+	};
+
+	class AgentSetAndRate {
+		AgentSet _agent_set;
+		Rate _rate;
+	public:
+		AgentSetAndRate(AgentSet agent_set, Rate rate)
+			: _agent_set(std::move(agent_set)), _rate(std::move(rate)) { }
+		AgentSetAndRate(const AgentSetAndRate& other) = default;
+		AgentSetAndRate& operator=(const AgentSetAndRate& other) = default;
+		AgentSetAndRate(AgentSetAndRate&& other) = default;
+		AgentSetAndRate& operator=(AgentSetAndRate&& other) = default;
+
+		const AgentSet& get_agent_set() const {
+			return _agent_set;
+		}
+
+		double get_rate() const {
+			return _rate.value();
+		}
+
+		const Rate& get_rate_expression() const {
+			return _rate;
+		}
+
+		/* Requirement 1 requires that we can create a reaction rule using the >>= operator
+		   since we created the AgentSetAndRate from the reactants and the rate, we only need
+		   the products of the reaction. This is specified on the right side of this opreator.*/
+		ReactionRule operator>>=(AgentSet product) const;
+	};
+
+	class ReactionRule {
+		AgentSet _reactants;
+		Rate _rate;
+		AgentSet _products;
+	public:
+		ReactionRule(AgentSet reactants, Rate rate, AgentSet products)
+			: _reactants(std::move(reactants)), _rate(std::move(rate)), _products(std::move(products)) {}
+		ReactionRule(const ReactionRule& other) = default;
+		ReactionRule& operator=(const ReactionRule& other) = default;
+		ReactionRule(ReactionRule&& other) = default;
+		ReactionRule& operator=(ReactionRule&& other) = default;
+
+		const AgentSet& get_reactants() const {
+			return _reactants;
+		}
+
+		/* The rate with every parameter at the value it was added with */
+		double get_rate() const {
+			return _rate.value();
+		}
+
+		const Rate& get_rate_expression() const {
+			return _rate;
+		}
+
+		const AgentSet& get_products() const {
+			return _products;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,608 @@
+#pragma once
+#include <vector>
+#include <tuple>
+#include <cmath>
+#include <limits>
+#include <numbers>
+#include <algorithm>
+#include <concepts>
+#include <exception>
+#include "Simulation.hpp"
+
+namespace stosim {
+	struct ReducerMismatchException : public std::exception {
+		ReducerMismatchException(const char* message)
+			: std::exception(message) {}
+	};
+
+	/* A reducer folds an ensemble into statistics without keeping the trajectories. Every worker
+	   runs its simulations one after another into its own copy of the reducer, which sees
+	   start() with the initial state, event() after every event and finish() when the
+	   simulation stops, and the copies are merged at the end. The memory only depends on what is
+	   being measured and never on the number of simulations */
+	template<typename T>
+	concept Reducer = std::copyable<T> && requires(T reducer, const T& other, const VesselState& state, StopReason reason) {
+		reducer.start(state);
+		reducer.event(state);
+		reducer.finish(state, reason);
+		reducer.merge(other);
+	};
+
+	/* Count, mean and variance by Welford's method, merged with the formula by Chan, Golub & LeVeque */
+	class RunningStatistics {
+		std::size_t _count = 0;
+		double _mean = 0;
+		double _squared_deviations = 0;
+		double _min = std::numeric_limits<double>::infinity();
+		double _max = -std::numeric_limits<double>::infinity();
+
+	public:
+		void add(double x) {
+			_count++;
+			auto delta = x - _mean;
+			_mean += delta / _count;
+			_squared_deviations += delta * (x - _mean);
+			_min = std::min(_min, x);
+			_max = std::max(_max, x);
+		}
+
+		/* Writes or reads the statistics, see CheckpointWriter */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_count, _mean, _squared_deviations, _min, _max);
+		}
+
+		void merge(const RunningStatistics& other) {
+			if (other._count == 0) {
+				return;
+			}
+			if (_count == 0) {
+				*this = other;
+				return;
+			}
+			auto count = _count + other._count;
+			auto delta = other._mean - _mean;
+			_mean += delta * other._count / count;
+			_squared_deviations += other._squared_deviations + delta * delta * _count * other._count / count;
+			_count = count;
+			_min = std::min(_min, other._min);
+			_max = std::max(_max, other._max);
+		}
+
+		std::size_t count() const {
+			return _count;
+		}
+
+		double mean() const {
+			return _mean;
+		}
+
+		/* The sample variance */
+		double variance() const {
+			return _count > 1 ? _squared_deviations / (_count - 1) : 0;
+		}
+
+		double standard_deviation() const {
+			return std::sqrt(variance());
+		}
+
+		/* The standard error of the mean */
+		double standard_error() const {
+			return _count > 0 ? std::sqrt(variance() / _count) : std::numeric_limits<double>::infinity();
+		}
+
+		double min() const {
+			return _min;
+		}
+
+		double max() const {
+			return _max;
+		}
+	};
+
+	/* Streaming quantiles with the merging t-digest by Dunning & Ertl. Values are kept as weighted
+	   centroids that are small near the tails and large near the median, which keeps the extreme
+	   quantiles accurate in a size that only depends on the compression. Unlike the P² algorithm
+	   two digests can be merged, which is what lets every worker keep its own */
+	class QuantileDigest {
+		struct Centroid {
+			double mean;
+			double weight;
+
+			template<typename Archive>
+			void checkpoint(Archive& archive) {
+				archive(mean, weight);
+			}
+		};
+
+		double _compression;
+		/* New values are buffered and merged into the centroids in batches */
+		std::vector<Centroid> _centroids;
+		std::vector<Centroid> _buffer;
+		double _total_weight = 0;
+		double _min = std::numeric_limits<double>::infinity();
+		double _max = -std::numeric_limits<double>::infinity();
+
+		/* The k1 scale function, two values can share a centroid if their k differs by at most one */
+		double scale(double quantile) const {
+			return _compression / (2 * std::numbers::pi) * std::asin(2 * std::clamp(quantile, 0.0, 1.0) - 1);
+		}
+
+		void compress() {
+			if (_buffer.empty()) {
+				return;
+			}
+			_buffer.insert(_buffer.end(), _centroids.begin(), _centroids.end());
+			std::ranges::sort(_buffer, {}, &Centroid::mean);
+
+			_centroids.clear();
+			_centroids.push_back(_buffer.front());
+			double weight_before = 0;
+			for (std::size_t i = 1; i < _buffer.size(); i++) {
+				auto& last = _centroids.back();
+				const auto& next = _buffer[i];
+				auto merged_weight = last.weight + next.weight;
+				if (scale((weight_before + merged_weight) / _total_weight) - scale(weight_before / _total_weight) <= 1) {
+					last.mean += (next.mean - last.mean) * next.weight / merged_weight;
+					last.weight = merged_weight;
+				}
+				else {
+					weight_before += last.weight;
+					_centroids.push_back(next);
+				}
+			}
+			_buffer.clear();
+		}
+
+	public:
+		explicit QuantileDigest(double compression = 100)
+			: _compression(compression) {}
+
+		void add(double x) {
+			_buffer.push_back({ x, 1 });
+			_total_weight += 1;
+			_min = std::min(_min, x);
+			_max = std::max(_max, x);
+			if (_buffer.size() >= 5 * _compression) {
+				compress();
+			}
+		}
+
+		/* The compression is not written, the digest that is read into must have the same one */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_centroids, _buffer, _total_weight, _min, _max);
+		}
+
+		void merge(const QuantileDigest& other) {
+			_buffer.insert(_buffer.end(), other._centroids.begin(), other._centroids.end());
+			_buffer.insert(_buffer.end(), other._buffer.begin(), other._buffer.end());
+			_total_weight += other._total_weight;
+			_min = std::min(_min, other._min);
+			_max = std::max(_max, other._max);
+			compress();
+		}
+
+		std::size_t count() const {
+			return static_cast<std::size_t>(_total_weight);
+		}
+
+		/* Interpolates between the centers of the centroids, and between the extremes and the
+		   outermost centroids. NaN if nothing was added. A digest with buffered values is
+		   compressed into a copy, so reading never changes the digest and threads can read the
+		   same one at the same time */
+		double quantile(double q) const {
+			if (!_buffer.empty()) {
+				auto compressed = *this;
+				compressed.compress();
+				return compressed.quantile(q);
+			}
+			if (_centroids.empty()) {
+				return std::numeric_limits<double>::quiet_NaN();
+			}
+			auto target = std::clamp(q, 0.0, 1.0) * _total_weight;
+			double previous_center = 0;
+			double previous_mean = _min;
+			double weight_before = 0;
+			for (const auto& centroid : _centroids) {
+				auto center = weight_before + centroid.weight / 2;
+				if (target < center) {
+					auto fraction = center > previous_center ? (target - previous_center) / (center - previous_center) : 0;
+					return previous_mean + fraction * (centroid.mean - previous_mean);
+				}
+				previous_center = center;
+				previous_mean = centroid.mean;
+				weight_before += centroid.weight;
+			}
+			auto fraction = _total_weight > previous_center ? (target - previous_center) / (_total_weight - previous_center) : 0;
+			return previous_mean + fraction * (_max - previous_mean);
+		}
+	};
+
+	/* Counts values in equal bins over [low, high), with the values outside counted separately */
+	class Histogram {
+		double _low;
+		double _high;
+		std::vector<std::size_t> _bins;
+		std::size_t _underflow = 0;
+		std::size_t _overflow = 0;
+
+	public:
+		Histogram(double low = 0, double high = 0, std::size_t bin_count = 0)
+			: _low(low), _high(high), _bins(bin_count, 0) {}
+
+		void add(double x) {
+			if (x < _low) {
+				_underflow++;
+			}
+			else if (x >= _high || _bins.empty()) {
+				_overflow++;
+			}
+			else {
+				auto bin = static_cast<std::size_t>((x - _low) / (_high - _low) * _bins.size());
+				_bins[std::min(bin, _bins.size() - 1)]++;
+			}
+		}
+
+		/* The range is not written, the histogram that is read into must have the same one */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_bins, _underflow, _overflow);
+		}
+
+		/* Both histograms must have the same bins */
+		void merge(const Histogram& other) {
+			if (_bins.size() != other._bins.size() || _low != other._low || _high != other._high) {
+				throw ReducerMismatchException("merge() The histograms have different bins");
+			}
+			for (std::size_t i = 0; i < _bins.size(); i++) {
+				_bins[i] += other._bins[i];
+			}
+			_underflow += other._underflow;
+			_overflow += other._overflow;
+		}
+
+		std::size_t bin_count() const {
+			return _bins.size();
+		}
+
+		std::size_t count(std::size_t bin) const {
+			return _bins[bin];
+		}
+
+		double bin_low(std::size_t bin) const {
+			return _low + (_high - _low) * bin / _bins.size();
+		}
+
+		std::size_t underflow() const {
+			return _underflow;
+		}
+
+		std::size_t overflow() const {
+			return _overflow;
+		}
+
+		std::size_t total() const {
+			auto rv = _underflow + _overflow;
+			for (auto count : _bins) {
+				rv += count;
+			}
+			return rv;
+		}
+	};
+
+	/* The mean and variance of some agents at every point of a time grid. The state at a point is
+	   the last state at or before it, like stosim::sample, and a simulation that stopped before
+	   the end of the grid only counts towards the points it reached, unless it stopped because
+	   nothing could fire, then its final state holds for the rest of the grid */
+	class TimeBinnedStatistics {
+		TimeGrid _grid;
+		std::vector<agent_token_t> _tokens;
+		/* The statistics of token k at point p are at p * _tokens.size() + k */
+		std::vector<RunningStatistics> _bins;
+
+		/* The simulation that is running */
+		std::size_t _next_point = 0;
+		std::vector<agent_count_t> _previous;
+
+		void record_until(double time, bool inclusive) {
+			for (; _next_point < _grid.size() && (_grid[_next_point] < time || (inclusive && _grid[_next_point] == time)); _next_point++) {
+				for (std::size_t k = 0; k < _tokens.size(); k++) {
+					_bins[_next_point * _tokens.size() + k].add(static_cast<double>(_previous[k]));
+				}
+			}
+		}
+
+		void remember(const VesselState& state) {
+			for (std::size_t k = 0; k < _tokens.size(); k++) {
+				_previous[k] = state.agent_count[_tokens[k]];
+			}
+		}
+
+	public:
+		TimeBinnedStatistics(TimeGrid grid, std::vector<agent_token_t> tokens)
+			: _grid(grid), _tokens(std::move(tokens)), _previous(_tokens.size()) {
+			if (!_grid.valid()) {
+				throw InvalidTimeGridException("TimeBinnedStatistics() The time grid needs a positive step and an end of at least 0");
+			}
+			_bins.resize(_grid.size() * _tokens.size());
+		}
+
+		void start(const VesselState& state) {
+			_next_point = 0;
+			remember(state);
+		}
+
+		void event(const VesselState& state) {
+			record_until(state.time, false);
+			remember(state);
+		}
+
+		void finish(const VesselState& state, StopReason reason) {
+			remember(state);
+			record_until(reason == StopReason::exhausted ? std::numeric_limits<double>::infinity() : state.time, true);
+		}
+
+		/* Only the statistics are written, the reducer that is read into must have the same grid and agents */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_bins);
+		}
+
+		/* Both must have the same grid and agents */
+		void merge(const TimeBinnedStatistics& other) {
+			if (other._grid.step != _grid.step || other._grid.end != _grid.end || other._tokens != _tokens) {
+				throw ReducerMismatchException("merge() The statistics have different grids or agents");
+			}
+			for (std::size_t i = 0; i < _bins.size(); i++) {
+				_bins[i].merge(other._bins[i]);
+			}
+		}
+
+		const TimeGrid& grid() const {
+			return _grid;
+		}
+
+		/* The statistics of the k'th agent given to the constructor at point p of the grid */
+		const RunningStatistics& at(std::size_t point, std::size_t k) const {
+			return _bins[point * _tokens.size() + k];
+		}
+	};
+
+	/* The highest count an agent reaches in every simulation and when it first reaches it */
+	class PeakStatistics {
+		agent_token_t _token;
+		RunningStatistics _value;
+		RunningStatistics _time;
+		QuantileDigest _quantiles;
+		Histogram _histogram;
+
+		agent_count_t _peak = 0;
+		double _peak_time = 0;
+
+	public:
+		PeakStatistics(agent_token_t token, Histogram histogram = {})
+			: _token(token), _histogram(std::move(histogram)) {}
+
+		void start(const VesselState& state) {
+			_peak = state.agent_count[_token];
+			_peak_time = state.time;
+		}
+
+		void event(const VesselState& state) {
+			if (state.agent_count[_token] > _peak) {
+				_peak = state.agent_count[_token];
+				_peak_time = state.time;
+			}
+		}
+
+		void finish(const VesselState& state, StopReason reason) {
+			_value.add(static_cast<double>(_peak));
+			_time.add(_peak_time);
+			_quantiles.add(static_cast<double>(_peak));
+			_histogram.add(static_cast<double>(_peak));
+		}
+
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_value, _time, _quantiles, _histogram);
+		}
+
+		void merge(const PeakStatistics& other) {
+			_value.merge(other._value);
+			_time.merge(other._time);
+			_quantiles.merge(other._quantiles);
+			_histogram.merge(other._histogram);
+		}
+
+		const RunningStatistics& value() const {
+			return _value;
+		}
+
+		const RunningStatistics& time() const {
+			return _time;
+		}
+
+		const QuantileDigest& quantiles() const {
+			return _quantiles;
+		}
+
+		const Histogram& histogram() const {
+			return _histogram;
+		}
+	};
+
+	/* The first time the count of an agent reaches a threshold, from below or from above */
+	class FirstPassageStatistics {
+	public:
+		enum class Direction {
+			/* The count becomes at least the threshold */
+			upward,
+			/* The count becomes at most the threshold */
+			downward,
+		};
+
+	private:
+		agent_token_t _token;
+		agent_count_t _threshold;
+		Direction _direction;
+		RunningStatistics _time;
+		QuantileDigest _quantiles;
+		Histogram _histogram;
+		std::size_t _never_reached = 0;
+
+		bool _reached = false;
+
+		void check(const VesselState& state) {
+			auto count = state.agent_count[_token];
+			if (!_reached && (_direction == Direction::upward ? count >= _threshold : count <= _threshold)) {
+				_reached = true;
+				_time.add(state.time);
+				_quantiles.add(state.time);
+				_histogram.add(state.time);
+			}
+		}
+
+	public:
+		FirstPassageStatistics(agent_token_t token, agent_count_t threshold, Direction direction = Direction::upward, Histogram histogram = {})
+			: _token(token), _threshold(threshold), _direction(direction), _histogram(std::move(histogram)) {}
+
+		void start(const VesselState& state) {
+			_reached = false;
+			check(state);
+		}
+
+		void event(const VesselState& state) {
+			check(state);
+		}
+
+		void finish(const VesselState& state, StopReason reason) {
+			if (!_reached) {
+				_never_reached++;
+			}
+		}
+
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_time, _quantiles, _histogram, _never_reached);
+		}
+
+		void merge(const FirstPassageStatistics& other) {
+			_time.merge(other._time);
+			_quantiles.merge(other._quantiles);
+			_histogram.merge(other._histogram);
+			_never_reached += other._never_reached;
+		}
+
+		/* Only the simulations that reached the threshold */
+		const RunningStatistics& time() const {
+			return _time;
+		}
+
+		const QuantileDigest& quantiles() const {
+			return _quantiles;
+		}
+
+		const Histogram& histogram() const {
+			return _histogram;
+		}
+
+		std::size_t never_reached() const {
+			return _never_reached;
+		}
+	};
+
+	/* Runs several reducers over the same simulations */
+	template<Reducer... Reducers>
+	struct CombinedReducer {
+		std::tuple<Reducers...> reducers;
+
+		void start(const VesselState& state) {
+			std::apply([&](auto&... reducer) { (reducer.start(state), ...); }, reducers);
+		}
+
+		void event(const VesselState& state) {
+			std::apply([&](auto&... reducer) { (reducer.event(state), ...); }, reducers);
+		}
+
+		void finish(const VesselState& state, StopReason reason) {
+			std::apply([&](auto&... reducer) { (reducer.finish(state, reason), ...); }, reducers);
+		}
+
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			std::apply([&](auto&... reducer) { archive(reducer...); }, reducers);
+		}
+
+		void merge(const CombinedReducer& other) {
+			[&]<std::size_t... I>(std::index_sequence<I...>) {
+				(std::get<I>(reducers).merge(std::get<I>(other.reducers)), ...);
+			}(std::index_sequence_for<Reducers...>{});
+		}
+	};
+
+	template<Reducer... Reducers>
+	CombinedReducer<Reducers...> combine(Reducers... reducers) {
+		return { { std::move(reducers)... } };
+	}
+
+	/* How precise an estimate of a mean has to be, a criterion left at 0 is not used */
+	struct Precision {
+		/* The half width of the confidence interval relative to the mean */
+		double relative_half_width = 0;
+		double standard_error = 0;
+		/* The confidence interval is the mean plus minus z standard errors, 1.96 is 95% */
+		double z = 1.96;
+
+		double half_width(const RunningStatistics& statistics) const {
+			return z * statistics.standard_error();
+		}
+
+		bool met(const RunningStatistics& statistics) const {
+			if (statistics.count() < 2) {
+				return false;
+			}
+			return (relative_half_width <= 0 || half_width(statistics) <= relative_half_width * std::abs(statistics.mean()))
+				&& (standard_error <= 0 || statistics.standard_error() <= standard_error);
+		}
+
+		/* The number of simulations it would take with the spread seen so far, at most limit */
+		std::size_t simulations_needed(const RunningStatistics& statistics, std::size_t limit) const {
+			double needed = 0;
+			auto deviation = statistics.standard_deviation();
+			if (relative_half_width > 0) {
+				auto target = relative_half_width * std::abs(statistics.mean());
+				needed = std::max(needed, target > 0 ? std::pow(z * deviation / target, 2) : static_cast<double>(limit));
+			}
+			if (standard_error > 0) {
+				needed = std::max(needed, std::pow(deviation / standard_error, 2));
+			}
+			return static_cast<std::size_t>(std::min(std::ceil(needed), static_cast<double>(limit)));
+		}
+	};
+
+	struct AdaptiveOptions {
+		std::size_t min_simulations = 32;
+		std::size_t max_simulations = 1000000;
+	};
+
+	template<Reducer T>
+	struct AdaptiveResult {
+		T reducer;
+		/* The monitored statistics of the final reducer, every one has mean() and standard_error() */
+		std::vector<RunningStatistics> statistics = {};
+		std::size_t simulation_count = 0;
+		/* False if max_simulations was reached first */
+		bool converged = false;
+	};
+
+	/* Runs one simulation into a reducer */
+	template<Reducer T, std::uniform_random_bit_generator R>
+	void reduce_simulation(T& reducer, Simulation<R>& simulation, const StopCondition& stop) {
+		reducer.start(simulation.state());
+		auto reason = simulation.run(stop, [&](const VesselState& state, std::size_t) {
+			reducer.event(state);
+		});
+		reducer.finish(simulation.state(), reason);
+	}
+}
@@ -0,0 +1,210 @@
+#include "Sharding.hpp"
+#include <vector>
+#include <thread>
+#include <cstring>
+#include <algorithm>
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace stosim {
+#ifdef _WIN32
+	ShardingStatistics run_sharded(std::size_t replica_count, const ShardingOptions& options,
+		const std::function<std::string(std::size_t first, std::size_t count)>& run_chunk,
+		const std::function<void(std::size_t first, std::string_view bytes)>& receive)
+	{
+		throw ShardingException("run_sharded() Worker processes are only supported on POSIX systems");
+	}
+#else
+	namespace {
+		struct FrameHeader {
+			std::uint64_t first;
+			std::uint64_t count;
+			std::uint64_t size;
+		};
+
+		bool write_all(int socket, const void* data, std::size_t size) {
+			const auto* position = static_cast<const char*>(data);
+			while (size > 0) {
+				auto written = ::write(socket, position, size);
+				if (written < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				position += written;
+				size -= static_cast<std::size_t>(written);
+			}
+			return true;
+		}
+
+		/* Runs in the forked process, it never returns and never runs the destructors of the coordinator */
+		[[noreturn]] void run_worker(int socket, std::size_t first, std::size_t end, std::size_t chunk_size,
+			const std::function<std::string(std::size_t first, std::size_t count)>& run_chunk)
+		{
+			try {
+				for (auto chunk = first; chunk < end; chunk += chunk_size) {
+					auto count = std::min(chunk_size, end - chunk);
+					auto bytes = run_chunk(chunk, count);
+					auto header = FrameHeader{ .first = chunk, .count = count, .size = bytes.size() };
+					if (!write_all(socket, &header, sizeof(header)) || !write_all(socket, bytes.data(), bytes.size())) {
+						_exit(2);
+					}
+				}
+			}
+			catch (...) {
+				_exit(1);
+			}
+			_exit(0);
+		}
+
+		struct Worker {
+			pid_t pid;
+			int socket;
+			/* The replicas of the shard that have not been sent back yet */
+			std::size_t next;
+			std::size_t end;
+			std::size_t attempt;
+			/* What has been read of a frame that is not complete yet */
+			std::string buffer;
+		};
+	}
+
+	ShardingStatistics run_sharded(std::size_t replica_count, const ShardingOptions& options,
+		const std::function<std::string(std::size_t first, std::size_t count)>& run_chunk,
+		const std::function<void(std::size_t first, std::string_view bytes)>& receive)
+	{
+		ShardingStatistics statistics;
+		if (replica_count == 0) {
+			return statistics;
+		}
+		auto process_count = options.process_count != 0 ? options.process_count : std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+		process_count = std::min(process_count, replica_count);
+		auto chunk_size = std::max<std::size_t>(options.chunk_size, 1);
+		std::vector<Worker> workers;
+
+		auto start = [&](std::size_t first, std::size_t end, std::size_t attempt) {
+			int sockets[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+				throw ShardingException("run_sharded() A socket could not be created");
+			}
+			auto pid = fork();
+			if (pid < 0) {
+				close(sockets[0]);
+				close(sockets[1]);
+				throw ShardingException("run_sharded() A worker process could not be started");
+			}
+			if (pid == 0) {
+				close(sockets[0]);
+				for (const auto& worker : workers) {
+					close(worker.socket);
+				}
+				run_worker(sockets[1], first, end, chunk_size, run_chunk);
+			}
+			close(sockets[1]);
+			workers.push_back({ .pid = pid, .socket = sockets[0], .next = first, .end = end, .attempt = attempt });
+			statistics.processes_started++;
+		};
+
+		auto wait_for = [](pid_t pid) {
+			int status = 0;
+			while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+			return status;
+		};
+
+		try {
+			for (std::size_t shard = 0; shard < process_count; shard++) {
+				start(shard * replica_count / process_count, (shard + 1) * replica_count / process_count, 1);
+			}
+
+			std::vector<pollfd> polled;
+			std::vector<char> block(1 << 16);
+			while (!workers.empty()) {
+				polled.clear();
+				for (const auto& worker : workers) {
+					polled.push_back({ .fd = worker.socket, .events = POLLIN, .revents = 0 });
+				}
+				if (poll(polled.data(), polled.size(), -1) < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					throw ShardingException("run_sharded() Waiting for the workers failed");
+				}
+
+				/* Backwards, so removing a worker does not move the ones that are left to look at */
+				for (auto i = polled.size(); i-- > 0;) {
+					if (polled[i].revents == 0) {
+						continue;
+					}
+					auto& worker = workers[i];
+					auto read = ::read(worker.socket, block.data(), block.size());
+					if (read < 0 && errno == EINTR) {
+						continue;
+					}
+					bool broken = false;
+					if (read > 0) {
+						worker.buffer.append(block.data(), static_cast<std::size_t>(read));
+						/* The frames are parsed from consumed on and the buffer is only shortened once per read */
+						std::size_t consumed = 0;
+						FrameHeader header;
+						while (worker.buffer.size() - consumed >= sizeof(header)) {
+							std::memcpy(&header, worker.buffer.data() + consumed, sizeof(header));
+							if (header.first != worker.next || header.count == 0 || header.count > worker.end - worker.next || header.size > options.max_result_bytes) {
+								broken = true;
+								break;
+							}
+							if (worker.buffer.size() - consumed - sizeof(header) < header.size) {
+								break;
+							}
+							receive(header.first, std::string_view(worker.buffer).substr(consumed + sizeof(header), header.size));
+							worker.next += header.count;
+							statistics.chunks++;
+							statistics.bytes += header.size;
+							consumed += sizeof(header) + header.size;
+						}
+						worker.buffer.erase(0, consumed);
+						if (!broken) {
+							continue;
+						}
+						/* A frame that does not fit the shard cannot be skipped, so the worker is replaced */
+						kill(worker.pid, SIGKILL);
+					}
+
+					/* The worker closed its socket, by exiting or by dying, or was killed for a broken frame */
+					close(worker.socket);
+					auto status = wait_for(worker.pid);
+					auto done = worker;
+					workers.erase(workers.begin() + i);
+					if (!broken && WIFEXITED(status) && WEXITSTATUS(status) == 0 && done.next == done.end) {
+						continue;
+					}
+					statistics.worker_failures++;
+					if (done.next == done.end) {
+						/* Every result arrived, so only the exit went wrong */
+						continue;
+					}
+					if (done.attempt >= options.max_attempts) {
+						throw ShardingException("run_sharded() A shard failed in every attempt");
+					}
+					start(done.next, done.end, done.attempt + 1);
+				}
+			}
+		}
+		catch (...) {
+			for (const auto& worker : workers) {
+				kill(worker.pid, SIGKILL);
+				close(worker.socket);
+				wait_for(worker.pid);
+			}
+			throw;
+		}
+		return statistics;
+	}
+#endif
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <functional>
+#include <optional>
+#include <exception>
+#include <cstdint>
+#include <cstddef>
+
+namespace stosim {
+	struct ShardingException : public std::exception {
+		ShardingException(const char* message)
+			: std::exception(message) {}
+	};
+
+	struct ShardingOptions {
+		/* Worker processes, 0 for one per core */
+		std::size_t process_count = 0;
+		/* Replicas per result a worker sends back. A worker that dies only loses the replicas after its last result */
+		std::size_t chunk_size = 64;
+		/* How often the replicas of a shard are started in a new process before the whole run fails */
+		std::size_t max_attempts = 3;
+		/* The largest result a worker may send back, a larger one is taken for a broken worker */
+		std::size_t max_result_bytes = std::size_t{ 64 } << 20;
+		/* The seed of the replicas, a random one if empty */
+		std::optional<std::uint64_t> seed = std::nullopt;
+	};
+
+	struct ShardingStatistics {
+		std::size_t processes_started = 0;
+		/* Workers that died, exited without finishing their shard or sent a broken frame */
+		std::size_t worker_failures = 0;
+		std::size_t chunks = 0;
+		/* The bytes of the results sent back */
+		std::size_t bytes = 0;
+	};
+
+	/* The reducer of every replica merged in the order of the replicas, see Vessel::reduce_sharded */
+	template<typename T>
+	struct ShardedResult {
+		T reducer;
+		ShardingStatistics statistics;
+	};
+
+	/* Runs the replicas [0, replica_count) in worker processes. Every worker is given a contiguous
+	   shard of the replicas, runs run_chunk(first, count) on consecutive chunks of it and sends
+	   every result back over a local socket as a frame of the first replica, the count and the
+	   bytes. The coordinator calls receive(first, bytes) for every frame, in the order they
+	   arrive. A worker that dies, exits before its shard is done or sends a frame that does not
+	   fit its shard or options.max_result_bytes is replaced by a new process for the replicas
+	   it did not send back, up to options.max_attempts times per shard.
+
+	   The workers are forked, so they start with the model of the coordinator and nothing has to
+	   be sent to them but the replica numbers. They only simulate and write to their socket and
+	   leave with _exit, so the threads of the coordinator, which are not in the fork, are never
+	   waited for. Since the frames are plain bytes over a stream socket, workers on other
+	   machines only need another kind of socket. Only available on POSIX systems */
+	ShardingStatistics run_sharded(std::size_t replica_count, const ShardingOptions& options,
+		const std::function<std::string(std::size_t first, std::size_t count)>& run_chunk,
+		const std::function<void(std::size_t first, std::string_view bytes)>& receive);
+}
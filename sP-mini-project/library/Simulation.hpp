@@ -0,0 +1,479 @@
+#pragma once
+#include <memory>
+#include <variant>
+#include <optional>
+#include <cmath>
+#include <limits>
+#include <functional>
+#include <span>
+#include <cstdint>
+#include <utility>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <iterator>
+#include <exception>
+#include <coro/coro.hpp>
+#include "CompiledNetwork.hpp"
+#include "SimulationEngine.hpp"
+#include "NextReactionEngine.hpp"
+#include "DirectMethodEngine.hpp"
+#include "CompositionRejectionEngine.hpp"
+#include "TauLeapingEngine.hpp"
+#include "HybridEngine.hpp"
+#include "Random.hpp"
+#include "Instrumentation.hpp"
+#include "Checkpoint.hpp"
+
+namespace stosim {
+	using simulation_engine_t = std::variant<FirstReactionEngine, NextReactionEngine, DirectMethodEngine, CompositionRejectionEngine, TauLeapingEngine, HybridEngine>;
+
+	simulation_engine_t make_engine(SimulationAlgorithm algorithm, const CompiledNetwork& network);
+
+	/* Stops once the count of an agent leaves [low, high] */
+	struct SpeciesThreshold {
+		agent_token_t token;
+		agent_count_t low = 0;
+		agent_count_t high = std::numeric_limits<agent_count_t>::max();
+
+		bool reached(const VesselState& state) const {
+			auto count = state.agent_count[token];
+			return count < low || count > high;
+		}
+	};
+
+	/* When a simulation should stop, every criterion that is left at its default never stops it */
+	struct StopCondition {
+		/* Events at or after this time do not happen */
+		double time_horizon = std::numeric_limits<double>::infinity();
+		std::size_t event_budget = std::numeric_limits<std::size_t>::max();
+		std::optional<SpeciesThreshold> threshold = std::nullopt;
+		/* Stops when this returns true */
+		std::function<bool(const VesselState&)> predicate = nullptr;
+	};
+
+	enum class StopReason {
+		/* No rule can fire anymore */
+		exhausted,
+		time_horizon,
+		event_budget,
+		threshold,
+		predicate,
+	};
+
+	/* A running simulation, the engine together with the state it advances and the random numbers
+	   it draws. Stepping it is a plain function call, so loops that do not need every event can
+	   run here without going through a generator */
+	template<std::uniform_random_bit_generator R = default_random_t>
+	class Simulation {
+		std::shared_ptr<const CompiledNetwork> _network;
+		SimulationAlgorithm _algorithm;
+		simulation_engine_t _engine;
+		VesselState _state;
+		R _rng;
+		std::size_t _events = 0;
+		/* Only used to take back a leap that went past the time horizon */
+		std::vector<agent_count_t> _before_step;
+		SimulationStatistics _statistics;
+
+		/* Calls f(engine, rng), and when instrumented counts and times what the engine does */
+		template<typename F>
+		auto with_engine(double& seconds, F&& f) {
+			if constexpr (instrumentation_enabled) {
+				instrumentation::Scope scope(_statistics);
+				instrumentation::Timer timer(seconds);
+				instrumentation::CountingRandom<R> rng(_rng, _statistics.random_draws);
+				return std::visit([&](auto& e) { return f(e, rng); }, _engine);
+			}
+			else {
+				return std::visit([&](auto& e) { return f(e, _rng); }, _engine);
+			}
+		}
+
+		void reset_engine() {
+			with_engine(_statistics.setup_seconds, [&](auto& e, auto& rng) { e.reset(_state, rng); });
+		}
+
+		std::optional<std::size_t> step_engine() {
+			return with_engine(_statistics.step_seconds, [&](auto& e, auto& rng) { return e.step(_state, rng); });
+		}
+
+		void count_event(std::size_t rule_index) {
+			_events++;
+			if constexpr (instrumentation_enabled) {
+				_statistics.events++;
+				if (rule_index == leap_rule_index) {
+					_statistics.leaps++;
+				}
+				else {
+					_statistics.rule_events[rule_index]++;
+				}
+			}
+		}
+
+		void reset_statistics() {
+			_statistics = {};
+			if constexpr (instrumentation_enabled) {
+				_statistics.simulations = 1;
+				_statistics.rule_events.resize(_network->rule_count());
+			}
+		}
+
+		/* Everything a simulation needs to continue where it was, the network is not part of it */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_state.time, _state.agent_count, _events);
+			_rng.checkpoint(archive);
+			std::visit([&](auto& e) { e.checkpoint(archive); }, _engine);
+		}
+
+	public:
+		Simulation(std::shared_ptr<const CompiledNetwork> network, SimulationAlgorithm algorithm, VesselState initial_state, R rng)
+			: _network(std::move(network)), _algorithm(algorithm), _engine(make_engine(algorithm, *_network)), _state(std::move(initial_state)), _rng(std::move(rng)) {
+			reset_statistics();
+			reset_engine();
+		}
+
+		/* A copy of the simulation is a snapshot of it, engine caches included, that continues
+		   exactly like the original. A fork instead continues from the current state with its own
+		   random numbers, so the prefix is only simulated once for any number of continuations.
+		   The engine is reset since it may hold numbers drawn from the old generator, which is
+		   valid since the waiting times are memoryless. The statistics of the fork start at zero */
+		Simulation fork(R rng) const {
+			Simulation rv = *this;
+			rv._rng = std::move(rng);
+			rv.reset_statistics();
+			rv.reset_engine();
+			return rv;
+		}
+
+		/* Forks the simulation into count continuations, continuation i uses stream i of seed. The
+		   seed should differ from the one of the simulation, or a continuation reuses the numbers of the prefix */
+		std::vector<Simulation> fork(std::size_t count, std::uint64_t seed) const requires RandomStream<R> {
+			std::vector<Simulation> rv;
+			rv.reserve(count);
+			for (std::size_t i = 0; i < count; i++) {
+				rv.push_back(fork(R(seed, i)));
+			}
+			return rv;
+		}
+
+		/* Writes the state, the random number generator and the caches of the engine, so the
+		   simulation restored by load() continues exactly like this one. The statistics are
+		   not saved */
+		void save(std::ostream& out) const requires Checkpointable<R> {
+			CheckpointWriter writer;
+			writer(static_cast<std::uint32_t>(_algorithm), static_cast<std::uint64_t>(_network->agent_type_count()), static_cast<std::uint64_t>(_network->rule_count()));
+			/* The writer only reads the members, checkpoint() takes them as mutable since the reader shares it */
+			const_cast<Simulation&>(*this).checkpoint(writer);
+			out.write(checkpoint_format::magic, sizeof(checkpoint_format::magic));
+			out.write(reinterpret_cast<const char*>(&checkpoint_format::version), sizeof(checkpoint_format::version));
+			out.write(writer.bytes().data(), static_cast<std::streamsize>(writer.bytes().size()));
+			if (!out) {
+				throw CheckpointException("save() The checkpoint could not be written");
+			}
+		}
+
+		/* Restores a simulation saved by save(), network has to be the network it was saved with */
+		static Simulation load(std::istream& in, std::shared_ptr<const CompiledNetwork> network) requires Checkpointable<R> && RandomStream<R> {
+			std::string bytes(std::istreambuf_iterator<char>(in), {});
+			constexpr auto header_size = sizeof(checkpoint_format::magic) + sizeof(checkpoint_format::version);
+			if (bytes.size() < header_size || bytes.compare(0, sizeof(checkpoint_format::magic), checkpoint_format::magic, sizeof(checkpoint_format::magic)) != 0) {
+				throw CheckpointException("load() The data is not a checkpoint");
+			}
+			std::uint32_t version;
+			std::memcpy(&version, bytes.data() + sizeof(checkpoint_format::magic), sizeof(version));
+			if (version != checkpoint_format::version) {
+				throw CheckpointException("load() The checkpoint has an unknown version");
+			}
+
+			CheckpointReader reader(std::string_view(bytes).substr(header_size));
+			std::uint32_t algorithm;
+			std::uint64_t agent_type_count, rule_count;
+			reader(algorithm, agent_type_count, rule_count);
+			if (algorithm > static_cast<std::uint32_t>(SimulationAlgorithm::hybrid)) {
+				throw CheckpointException("load() The checkpoint has an unknown algorithm");
+			}
+			if (agent_type_count != network->agent_type_count() || rule_count != network->rule_count()) {
+				throw CheckpointException("load() The checkpoint was saved with a different network");
+			}
+
+			auto initial_state = VesselState{ .agent_count = std::vector<agent_count_t>(network->agent_type_count()), .time = 0 };
+			Simulation rv(std::move(network), static_cast<SimulationAlgorithm>(algorithm), std::move(initial_state), R(0, 0));
+			rv.checkpoint(reader);
+			if (rv._state.agent_count.size() != agent_type_count || reader.remaining() != 0) {
+				throw CheckpointException("load() The checkpoint does not match its network");
+			}
+			/* The caches of the engine are indexed without checks while stepping */
+			if (!std::visit([](const auto& e) { return e.consistent(); }, rv._engine)) {
+				throw CheckpointException("load() The caches of the engine do not match the network");
+			}
+			return rv;
+		}
+
+		/* See SimulationEngine */
+		std::optional<std::size_t> step() {
+			auto fired_rule = step_engine();
+			if (fired_rule.has_value()) {
+				count_event(fired_rule.value());
+			}
+			return fired_rule;
+		}
+
+		/* Takes a step unless the simulation should stop, in which case it returns why. An event
+		   that lands at or after the time horizon is taken back and the simulation is left at
+		   the horizon instead. The engine is then reset, which is valid since the waiting times
+		   are memoryless, so the simulation can be continued with a later horizon */
+		std::optional<StopReason> step_until(const StopCondition& stop) {
+			std::size_t fired_rule;
+			return step_until(stop, fired_rule);
+		}
+
+		/* The same as above, fired_rule is set to the rule that fired if the simulation did not stop */
+		std::optional<StopReason> step_until(const StopCondition& stop, std::size_t& fired_rule) {
+			if (stop.threshold.has_value() && stop.threshold->reached(_state)) {
+				return StopReason::threshold;
+			}
+			if (stop.predicate && stop.predicate(_state)) {
+				return StopReason::predicate;
+			}
+			if (_events >= stop.event_budget) {
+				return StopReason::event_budget;
+			}
+
+			auto bounded = stop.time_horizon < std::numeric_limits<double>::infinity();
+			if (bounded && !exact()) {
+				_before_step = _state.agent_count;
+			}
+			auto rule_index = step_engine();
+			if (!rule_index.has_value()) {
+				return StopReason::exhausted;
+			}
+			if (bounded && _state.time >= stop.time_horizon) {
+				if (exact()) {
+					_network->revert(rule_index.value(), _state.agent_count);
+				}
+				else {
+					_state.agent_count = _before_step;
+				}
+				_state.time = stop.time_horizon;
+				reset_engine();
+				return StopReason::time_horizon;
+			}
+			count_event(rule_index.value());
+			fired_rule = rule_index.value();
+			return std::nullopt;
+		}
+
+		/* Steps until the simulation should stop, calling observe(state, rule_index) after every
+		   event. The observer is a template parameter so it is inlined into the event loop */
+		template<typename Observer>
+		StopReason run(const StopCondition& stop, Observer&& observe) {
+			std::size_t fired_rule;
+			while (true) {
+				if (auto reason = step_until(stop, fired_rule)) {
+					return reason.value();
+				}
+				observe(std::as_const(_state), fired_rule);
+			}
+		}
+
+		/* Steps until the simulation should stop without handing out the events */
+		StopReason run(const StopCondition& stop) {
+			return run(stop, [](const VesselState&, std::size_t) {});
+		}
+
+		/* The number of events so far, a leap counts as one */
+		std::size_t events() const {
+			return _events;
+		}
+
+		const VesselState& state() const {
+			return _state;
+		}
+
+		const CompiledNetwork& network() const {
+			return *_network;
+		}
+
+		/* For keeping the network alive beyond the simulation */
+		const std::shared_ptr<const CompiledNetwork>& shared_network() const {
+			return _network;
+		}
+
+		SimulationAlgorithm algorithm() const {
+			return _algorithm;
+		}
+
+		/* What the simulation did so far, see SimulationStatistics */
+		const SimulationStatistics& statistics() const {
+			return _statistics;
+		}
+
+		/* Called by the generators for every state they hand out */
+		void count_yield() {
+			if constexpr (instrumentation_enabled) {
+				_statistics.yields++;
+			}
+		}
+
+		/* Whether every step fires exactly one rule */
+		bool exact() const {
+			return _algorithm != SimulationAlgorithm::tau_leaping && _algorithm != SimulationAlgorithm::hybrid;
+		}
+	};
+
+	/* Yields the initial state and the state after every step */
+	template<std::uniform_random_bit_generator R>
+	coro::generator<const VesselState&> trajectory(Simulation<R> simulation) {
+		simulation.count_yield();
+		co_yield simulation.state();
+		while (simulation.step().has_value()) {
+			simulation.count_yield();
+			co_yield simulation.state();
+		}
+	}
+
+	/* Yields the initial state and the state after every step until the stop condition holds */
+	template<std::uniform_random_bit_generator R>
+	coro::generator<const VesselState&> trajectory(Simulation<R> simulation, StopCondition stop) {
+		simulation.count_yield();
+		co_yield simulation.state();
+		while (!simulation.step_until(stop).has_value()) {
+			simulation.count_yield();
+			co_yield simulation.state();
+		}
+	}
+
+	/* The same as above, statistics is set to the statistics of the simulation when the generator
+	   is done or destroyed, so it must outlive the generator */
+	template<std::uniform_random_bit_generator R>
+	coro::generator<const VesselState&> trajectory(Simulation<R> simulation, StopCondition stop, SimulationStatistics& statistics) {
+		struct Report {
+			const Simulation<R>& simulation;
+			SimulationStatistics& statistics;
+			~Report() {
+				statistics = simulation.statistics();
+			}
+		} report{ simulation, statistics };
+		simulation.count_yield();
+		co_yield simulation.state();
+		while (!simulation.step_until(stop).has_value()) {
+			simulation.count_yield();
+			co_yield simulation.state();
+		}
+	}
+
+	/* What happened in an event, the states can be replayed from these and the initial state */
+	struct EventRecord {
+		double time;
+		/* leap_record_index for a step that fired several rules */
+		std::uint32_t rule_index;
+	};
+
+	constexpr std::uint32_t leap_record_index = std::numeric_limits<std::uint32_t>::max();
+
+	/* Yields the events in blocks of batch_size records, the last block can be smaller. The events
+	   of a block run in a plain loop, so the consumer is only resumed once per block. A block is
+	   only valid until the next one is requested */
+	template<std::uniform_random_bit_generator R>
+	coro::generator<std::span<const EventRecord>> batches(Simulation<R> simulation, std::size_t batch_size, StopCondition stop = {}) {
+		std::vector<EventRecord> batch;
+		batch.reserve(batch_size);
+		std::size_t fired_rule;
+		while (true) {
+			auto reason = simulation.step_until(stop, fired_rule);
+			if (!reason.has_value()) {
+				batch.push_back({
+					.time = simulation.state().time,
+					.rule_index = fired_rule == leap_rule_index ? leap_record_index : static_cast<std::uint32_t>(fired_rule)
+				});
+			}
+			if (batch.size() == batch_size || (reason.has_value() && !batch.empty())) {
+				simulation.count_yield();
+				co_yield std::span<const EventRecord>(batch);
+				batch.clear();
+			}
+			if (reason.has_value()) {
+				co_return;
+			}
+		}
+	}
+
+	struct InvalidTimeGridException : public std::exception {
+		InvalidTimeGridException(const char* message)
+			: std::exception(message) {}
+	};
+
+	/* The points step, 2 step, ... up to and including end, starting at 0 */
+	struct TimeGrid {
+		double step;
+		double end;
+
+		/* A positive step and an end of at least 0, both finite and with a number of points that fits a size_t */
+		bool valid() const {
+			return std::isfinite(step) && std::isfinite(end) && step > 0 && end >= 0
+				&& end / step < static_cast<double>(std::numeric_limits<std::size_t>::max() / 2);
+		}
+
+		/* Only defined for a valid grid */
+		std::size_t size() const {
+			return static_cast<std::size_t>(std::floor(end / step + 1e-9)) + 1;
+		}
+
+		double operator[](std::size_t i) const {
+			return static_cast<double>(i) * step;
+		}
+	};
+
+	/* Yields the state at every point of the grid, which is the last state at or before that
+	   point, with the time set to the point. The events between two points run in a plain loop,
+	   so a long simulation only resumes the consumer once per point */
+	template<std::uniform_random_bit_generator R>
+	coro::generator<const VesselState&> sample(Simulation<R> simulation, TimeGrid grid) {
+		if (!grid.valid()) {
+			throw InvalidTimeGridException("sample() The time grid needs a positive step and an end of at least 0");
+		}
+		VesselState sample = simulation.state();
+		std::size_t point = 0;
+		const auto points = grid.size();
+		std::vector<agent_count_t> before_leap;
+
+		while (point < points) {
+			if (!simulation.exact()) {
+				before_leap = simulation.state().agent_count;
+			}
+			auto fired_rule = simulation.step();
+			if (!fired_rule.has_value()) {
+				break;
+			}
+			if (simulation.state().time <= grid[point]) {
+				continue;
+			}
+
+			/* The event is past the next point, so the state before it is the state at every point up to the event */
+			if (simulation.exact()) {
+				sample.agent_count = simulation.state().agent_count;
+				simulation.network().revert(fired_rule.value(), sample.agent_count);
+			}
+			else {
+				sample.agent_count = before_leap;
+			}
+			for (; point < points && grid[point] < simulation.state().time; point++) {
+				sample.time = grid[point];
+				simulation.count_yield();
+				co_yield sample;
+			}
+		}
+
+		/* Nothing fires anymore, so the final state holds for the rest of the grid */
+		sample.agent_count = simulation.state().agent_count;
+		for (; point < points; point++) {
+			sample.time = grid[point];
+			simulation.count_yield();
+			co_yield sample;
+		}
+	}
+}
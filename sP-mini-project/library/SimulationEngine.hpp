@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <random>
+#include <limits>
+#include <concepts>
+#include "CompiledNetwork.hpp"
+
+namespace stosim {
+	struct VesselState {
+		std::vector<agent_count_t> agent_count;
+		double time;
+	};
+
+	/* The algorithms Vessel::simulate() can use to pick the next reaction */
+	enum class SimulationAlgorithm {
+		/* Draws a delay for every rule on every event and picks the smallest one */
+		first_reaction,
+		/* Gibson & Bruck: only redraws the rules affected by the last event */
+		next_reaction,
+		/* Gillespie's direct method with cached propensities */
+		direct,
+		/* Slepoy, Thompson & Plimpton: constant time selection for very large networks */
+		composition_rejection,
+		/* Cao, Gillespie & Petzold: approximate, fires many rules per step for large populations */
+		tau_leaping,
+		/* Integrates rules between large populations as ODEs and fires the rest exactly */
+		hybrid,
+	};
+
+	/* Draws the waiting time until a rule with the given propensity fires, a rule that
+	   cannot fire never will */
+	template<std::uniform_random_bit_generator R>
+	double draw_delay(double propensity, R& rng) {
+		if (propensity <= 0) {
+			return std::numeric_limits<double>::infinity();
+		}
+		return std::exponential_distribution(propensity)(rng);
+	}
+
+	/* Returned by approximate engines instead of a rule index when a step fired several rules */
+	constexpr std::size_t leap_rule_index = std::numeric_limits<std::size_t>::max();
+
+	/* An engine advances a VesselState one event at a time. reset() is called once with the
+	   initial state before the first step, and step() returns the index of the rule that fired,
+	   leap_rule_index, or nullopt when no rule can fire anymore */
+	template<typename E, typename R>
+	concept SimulationEngine = std::uniform_random_bit_generator<R> && requires(E engine, VesselState& state, R& rng) {
+		engine.reset(state, rng);
+		{ engine.step(state, rng) } -> std::same_as<std::optional<std::size_t>>;
+	};
+
+	/*Requirement 4: here the next reaction rule that will be used is calculated using the given algorithm*/
+	class FirstReactionEngine {
+		const CompiledNetwork& _network;
+	public:
+		FirstReactionEngine(const CompiledNetwork& network)
+			: _network(network) {}
+
+		template<std::uniform_random_bit_generator R>
+		void reset(const VesselState& state, R& rng) {}
+
+		/* Writes or reads what the engine keeps between steps, see CheckpointWriter */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {}
+
+		/* True if what checkpoint() read fits the network, so step() stays inside the caches */
+		bool consistent() const {
+			return true;
+		}
+
+		template<std::uniform_random_bit_generator R>
+		std::optional<std::size_t> step(VesselState& state, R& rng) {
+			std::optional<std::size_t> current_best = std::nullopt;
+			double lowest_delay = std::numeric_limits<double>::max();
+			for (std::size_t i = 0; i < _network.rule_count(); i++) {
+				auto rule_propensity = _network.propensity(i, state.agent_count);
+
+				if (rule_propensity > 0) {
+					auto delay = draw_delay(rule_propensity, rng);
+
+					if (delay < lowest_delay) {
+						current_best.emplace(i);
+						lowest_delay = delay;
+					}
+				}
+			}
+			if (current_best == std::nullopt) {
+				return std::nullopt;
+			}
+
+			state.time += lowest_delay;
+			_network.apply(current_best.value(), state.agent_count);
+			return current_best;
+		}
+	};
+}
@@ -0,0 +1,282 @@
+#pragma once
+#include <array>
+#include <tuple>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <random>
+#include <coro/coro.hpp>
+#include "ReactionRule.hpp"
+#include "Ensemble.hpp"
+#include "Random.hpp"
+
+namespace stosim {
+	/* A token and how much of it, used both for reactant multiplicities and net changes */
+	struct StaticStoichiometry {
+		agent_token_t token;
+		std::int64_t amount;
+	};
+
+	/* The compile time counterpart of AgentSet. The agents are part of the type, so
+	   S + I is a StaticAgentSet<S, I> and 2A is a StaticAgentSet<A, A> */
+	template<agent_token_t... Tokens>
+	struct StaticAgentSet {
+	private:
+		static constexpr auto sorted_tokens() {
+			std::array<agent_token_t, sizeof...(Tokens)> tokens{ Tokens... };
+			std::ranges::sort(tokens);
+			return tokens;
+		}
+
+		static constexpr std::size_t distinct_count() {
+			auto tokens = sorted_tokens();
+			std::size_t rv = 0;
+			for (std::size_t i = 0; i < tokens.size(); i++) {
+				if (i == 0 || tokens[i] != tokens[i - 1]) {
+					rv++;
+				}
+			}
+			return rv;
+		}
+
+	public:
+		static constexpr std::size_t size = sizeof...(Tokens);
+
+		/* Every distinct agent with its multiplicity */
+		static constexpr std::array<StaticStoichiometry, distinct_count()> stoichiometry = [] {
+			std::array<StaticStoichiometry, distinct_count()> rv{};
+			auto tokens = sorted_tokens();
+			std::size_t next = 0;
+			for (std::size_t i = 0; i < tokens.size(); i++) {
+				if (i == 0 || tokens[i] != tokens[i - 1]) {
+					rv[next++] = { tokens[i], 0 };
+				}
+				rv[next - 1].amount++;
+			}
+			return rv;
+		}();
+
+		static constexpr std::int64_t count(agent_token_t token) {
+			std::int64_t rv = 0;
+			((rv += Tokens == token ? 1 : 0), ...);
+			return rv;
+		}
+
+		static constexpr agent_token_t get_agent_token() requires (sizeof...(Tokens) == 1) {
+			return (Tokens, ...);
+		}
+
+		/* The number of distinct combinations of these agents, see CompiledNetwork::propensity */
+		template<std::size_t N>
+		static double combinations(const std::array<agent_count_t, N>& agent_count) {
+			double rv = 1;
+			for (const auto& [token, multiplicity] : stoichiometry) {
+				auto count = agent_count[token];
+				if (multiplicity == 1) {
+					rv *= count;
+					continue;
+				}
+				if (count < static_cast<agent_count_t>(multiplicity)) {
+					return 0;
+				}
+				for (std::int64_t k = 0; k < multiplicity; k++) {
+					rv *= static_cast<double>(count - k) / (k + 1);
+				}
+			}
+			return rv;
+		}
+	};
+
+	template<agent_token_t... A, agent_token_t... B>
+	constexpr StaticAgentSet<A..., B...> operator+(StaticAgentSet<A...>, StaticAgentSet<B...>) {
+		return {};
+	}
+
+	/* The structure of a rule is in its type, only the rate is a value. Keeping the rate a value
+	   means models like covid19(N) can still compute their rates at runtime */
+	template<typename Reactants, typename Products>
+	struct StaticReactionRule {
+		using reactants = Reactants;
+		using products = Products;
+
+	private:
+		static constexpr std::size_t change_count() {
+			std::size_t rv = 0;
+			for (const auto& [token, amount] : Reactants::stoichiometry) {
+				if (Products::count(token) != amount) {
+					rv++;
+				}
+			}
+			for (const auto& [token, amount] : Products::stoichiometry) {
+				if (Reactants::count(token) == 0) {
+					rv++;
+				}
+			}
+			return rv;
+		}
+
+	public:
+		/* The net changes, catalysts are left out */
+		static constexpr std::array<StaticStoichiometry, change_count()> changes = [] {
+			std::array<StaticStoichiometry, change_count()> rv{};
+			std::size_t next = 0;
+			for (const auto& [token, amount] : Reactants::stoichiometry) {
+				if (Products::count(token) != amount) {
+					rv[next++] = { token, Products::count(token) - amount };
+				}
+			}
+			for (const auto& [token, amount] : Products::stoichiometry) {
+				if (Reactants::count(token) == 0) {
+					rv[next++] = { token, amount };
+				}
+			}
+			return rv;
+		}();
+
+		/* True if every agent of the rule is one of the first agent_count tokens */
+		static constexpr bool uses_tokens_below(std::size_t agent_count) {
+			for (const auto& [token, amount] : Reactants::stoichiometry) {
+				if (token >= agent_count) {
+					return false;
+				}
+			}
+			for (const auto& [token, amount] : Products::stoichiometry) {
+				if (token >= agent_count) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		double rate;
+	};
+
+	template<typename Reactants>
+	struct StaticAgentSetAndRate {
+		double rate;
+
+		template<agent_token_t... Products>
+		constexpr StaticReactionRule<Reactants, StaticAgentSet<Products...>> operator>>=(StaticAgentSet<Products...>) const {
+			return { rate };
+		}
+	};
+
+	template<agent_token_t... Tokens>
+	constexpr StaticAgentSetAndRate<StaticAgentSet<Tokens...>> operator>>(StaticAgentSet<Tokens...>, double rate) {
+		return { rate };
+	}
+
+	template<std::size_t AgentCount>
+	struct StaticVesselState {
+		std::array<agent_count_t, AgentCount> agent_count;
+		double time;
+	};
+
+	/* A vessel where the reaction network is fixed at compile time. The propensities and state
+	   updates of every rule are generated for that exact rule, so the direct method below runs
+	   over std::array state with constant trip counts that the compiler can fully unroll */
+	template<std::size_t AgentCount, typename... Rules>
+	class StaticVessel {
+		static constexpr std::size_t rule_count = sizeof...(Rules);
+		static_assert((Rules::uses_tokens_below(AgentCount) && ...), "A rule uses an agent the vessel does not have");
+
+		std::string _name;
+		std::array<agent_count_t, AgentCount> _initial_state;
+		std::array<double, rule_count> _rates;
+
+		template<std::size_t... I>
+		double propensities(const std::array<agent_count_t, AgentCount>& agent_count, std::array<double, rule_count>& out, std::index_sequence<I...>) const {
+			((out[I] = _rates[I] * Rules::reactants::combinations(agent_count)), ...);
+			return (0.0 + ... + out[I]);
+		}
+
+		template<typename Rule>
+		static bool apply(std::array<agent_count_t, AgentCount>& agent_count) {
+			for (const auto& [token, amount] : Rule::changes) {
+				agent_count[token] += amount;
+			}
+			return true;
+		}
+
+		template<std::size_t... I>
+		static void apply(std::size_t rule_index, std::array<agent_count_t, AgentCount>& agent_count, std::index_sequence<I...>) {
+			((rule_index == I && apply<Rules>(agent_count)) || ...);
+		}
+
+	public:
+		StaticVessel(std::string name, std::array<agent_count_t, AgentCount> initial_state, Rules... rules)
+			: _name(std::move(name)), _initial_state(initial_state), _rates{ rules.rate... } {}
+
+		template<std::uniform_random_bit_generator R>
+		coro::generator<const StaticVesselState<AgentCount>&> simulate(R rng) const {
+			StaticVesselState<AgentCount> state{
+				.agent_count = _initial_state,
+				.time = 0
+			};
+
+			auto uniform = std::uniform_real_distribution(0.0, 1.0);
+			std::array<double, rule_count> rule_propensities;
+
+			co_yield state;
+
+			while (true) {
+				auto total = propensities(state.agent_count, rule_propensities, std::index_sequence_for<Rules...>{});
+				if (total <= 0) {
+					co_return;
+				}
+
+				state.time += -std::log(1.0 - uniform(rng)) / total;
+
+				auto target = uniform(rng) * total;
+				std::size_t rule_index = 0;
+				double cumulative = 0;
+				for (std::size_t i = 0; i < rule_count; i++) {
+					if (rule_propensities[i] <= 0) {
+						continue;
+					}
+					cumulative += rule_propensities[i];
+					rule_index = i;
+					if (target < cumulative) {
+						break;
+					}
+				}
+
+				apply(rule_index, state.agent_count, std::index_sequence_for<Rules...>{});
+				co_yield state;
+			}
+		}
+
+		coro::generator<const StaticVesselState<AgentCount>&> simulate() const {
+			return simulate(default_random_t(random_seed()));
+		}
+
+		template<RandomStream R = default_random_t>
+		coro::generator<const StaticVesselState<AgentCount>&> simulate(std::uint64_t seed, std::uint64_t stream = 0) const {
+			return simulate(R(seed, stream));
+		}
+
+		/* See Vessel::multi_simulate */
+		template<RandomStream R = default_random_t, typename F>
+		coro::generator<std::invoke_result_t<F, coro::generator<const StaticVesselState<AgentCount>&>>> multi_simulate(size_t simulation_count, F f, EnsembleOptions options = {}) const {
+			auto seed = options.seed.value_or(random_seed());
+			return run_ensemble<std::invoke_result_t<F, coro::generator<const StaticVesselState<AgentCount>&>>>(simulation_count, [this, f, seed](std::size_t i) mutable {
+				return f(simulate(R(seed, i)));
+			}, std::move(options));
+		}
+
+		const std::array<agent_count_t, AgentCount>& get_initial_state() const {
+			return _initial_state;
+		}
+
+		const std::string& get_name() const {
+			return _name;
+		}
+	};
+
+	template<std::size_t AgentCount, typename... Rules>
+	StaticVessel<AgentCount, Rules...> make_static_vessel(std::string name, std::array<agent_count_t, AgentCount> initial_state, Rules... rules) {
+		return StaticVessel<AgentCount, Rules...>(std::move(name), initial_state, rules...);
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <span>
+#include <ostream>
+#include <functional>
+#include <numeric>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include "Random.hpp"
+
+namespace stosim {
+	/* A parameter or an agent and the values a grid gives it, see SweepDesign::grid */
+	struct SweepDimension {
+		std::string name;
+		std::vector<double> values;
+	};
+
+	/* A parameter or an agent and the range a latin hypercube spreads it over, see SweepDesign::latin_hypercube */
+	struct SweepRange {
+		std::string name;
+		double low;
+		double high;
+	};
+
+	/* The points of a sweep, every point gives a value to each of the named parameters or agents.
+	   A name is a parameter added with Vessel::add_parameter() or an agent, whose initial count
+	   becomes the value rounded to a whole number. Whatever is not named keeps its value */
+	class SweepDesign {
+		std::vector<std::string> _names;
+		/* Point i is [i * _names.size(), (i + 1) * _names.size()) */
+		std::vector<double> _values;
+
+	public:
+		SweepDesign(std::vector<std::string> names, std::vector<double> values)
+			: _names(std::move(names)), _values(std::move(values)) {}
+
+		/* Every combination of the values of the dimensions, the last dimension changes fastest */
+		static SweepDesign grid(const std::vector<SweepDimension>& dimensions) {
+			std::vector<std::string> names;
+			std::size_t point_count = 1;
+			for (const auto& dimension : dimensions) {
+				names.push_back(dimension.name);
+				point_count *= dimension.values.size();
+			}
+			std::vector<double> values;
+			values.reserve(point_count * dimensions.size());
+			for (std::size_t point = 0; point < point_count; point++) {
+				auto remaining = point;
+				auto first = values.size();
+				values.resize(first + dimensions.size());
+				for (auto d = dimensions.size(); d-- > 0;) {
+					values[first + d] = dimensions[d].values[remaining % dimensions[d].values.size()];
+					remaining /= dimensions[d].values.size();
+				}
+			}
+			return SweepDesign(std::move(names), std::move(values));
+		}
+
+		/* McKay, Beckman & Conover: every range is cut into point_count strata of equal width and
+		   every stratum of every range holds exactly one point, at a random place inside it. The
+		   strata are paired up at random, so a few points cover every range evenly. The points
+		   only depend on the seed */
+		static SweepDesign latin_hypercube(const std::vector<SweepRange>& ranges, std::size_t point_count, std::uint64_t seed) {
+			std::vector<std::string> names;
+			for (const auto& range : ranges) {
+				names.push_back(range.name);
+			}
+			std::vector<double> values(point_count * ranges.size());
+			std::vector<std::size_t> strata(point_count);
+			for (std::size_t d = 0; d < ranges.size(); d++) {
+				/* The numbers are turned into doubles and shuffles here instead of by the standard
+				   distributions, whose results differ between standard libraries */
+				auto rng = Philox4x32(seed, d);
+				std::iota(std::begin(strata), std::end(strata), std::size_t{ 0 });
+				for (auto i = point_count; i > 1; i--) {
+					std::swap(strata[i - 1], strata[rng() % i]);
+				}
+				for (std::size_t point = 0; point < point_count; point++) {
+					auto offset = static_cast<double>(rng() >> 11) * 0x1.0p-53;
+					auto fraction = (static_cast<double>(strata[point]) + offset) / static_cast<double>(point_count);
+					values[point * ranges.size() + d] = ranges[d].low + fraction * (ranges[d].high - ranges[d].low);
+				}
+			}
+			return SweepDesign(std::move(names), std::move(values));
+		}
+
+		const std::vector<std::string>& names() const {
+			return _names;
+		}
+
+		std::size_t size() const {
+			return _names.empty() ? 0 : _values.size() / _names.size();
+		}
+
+		/* The values of point i, in the order of names() */
+		std::span<const double> point(std::size_t i) const {
+			return std::span(_values).subspan(i * _names.size(), _names.size());
+		}
+	};
+
+	/* A column of the results table, value(reducer) is called once per point */
+	template<typename T>
+	struct SweepColumn {
+		std::string name;
+		std::function<double(const T&)> value;
+	};
+
+	/* The reducer of every point of a sweep, see Vessel::sweep */
+	template<typename T>
+	struct SweepResult {
+		SweepDesign design;
+		std::vector<T> results;
+
+		/* Writes a table with a row per point, the values of the point followed by the columns, as comma separated values */
+		void write_csv(std::ostream& out, const std::vector<SweepColumn<T>>& columns) const {
+			auto separator = "";
+			for (const auto& name : design.names()) {
+				out << separator << name;
+				separator = ",";
+			}
+			for (const auto& column : columns) {
+				out << separator << column.name;
+				separator = ",";
+			}
+			out << "\n";
+			for (std::size_t i = 0; i < results.size(); i++) {
+				separator = "";
+				for (auto value : design.point(i)) {
+					out << separator << value;
+					separator = ",";
+				}
+				for (const auto& column : columns) {
+					out << separator << column.value(results[i]);
+					separator = ",";
+				}
+				out << "\n";
+			}
+		}
+	};
+}
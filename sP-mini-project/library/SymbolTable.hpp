@@ -2,6 +2,13 @@
 #include <unordered_map>
 #include <algorithm>
 #include <iterator>
+#include <deque>
+#include <vector>
+#include <ranges>
+#include <limits>
+#include <cstdint>
+#include <functional>
+#include <bit>
 #include <coro/coro.hpp>
 #include <concepts>
 
@@ -19,74 +26,150 @@ namespace stosim {
 	template<typename T>
 	concept MoveableAndOrdered = std::movable<T> && std::totally_ordered<T>;
 
+	template<typename T>
+	concept Hashable = requires(const T& t) {
+		{ std::hash<T>{}(t) } -> std::convertible_to<std::size_t>;
+	};
+
 	/* Requirement 3 states that a generic symbol table for keys and values should be craeted
 	   We want to enforce that a token has only been used once and that a token name has only
-	   been used once, therefore we use a sorted list and an index to check uniqueness
-	   of both values
+	   been used once. Every pair is stored once, in the order it was stored, and a hash index
+	   on each side maps a key or a value to its position, so a lookup and a store take constant
+	   time. The pairs never move, so a reference to a key or a value stays valid for as long
+	   as the table lives
 	   */
-	template<MoveableAndOrdered K, MoveableAndOrdered V>
+	template<MoveableAndOrdered K, MoveableAndOrdered V> requires Hashable<K> && Hashable<V>
 	class SymbolTable {
-		std::vector<std::pair<K, V>> _key_sorted_values;
-		std::vector<std::size_t> _value_index;
+		static constexpr std::size_t empty_slot = std::numeric_limits<std::size_t>::max();
+
+		std::deque<std::pair<K, V>> _pairs;
+		/* Open addressing with linear probing, a slot holds the position of a pair in _pairs */
+		std::vector<std::size_t> _key_slots = std::vector<std::size_t>(16, empty_slot);
+		std::vector<std::size_t> _value_slots = std::vector<std::size_t>(16, empty_slot);
+
+		/* Fibonacci hashing, so hashes that are the identity like the one of integers still spread over the slots */
+		template<typename T>
+		static std::size_t first_slot(const T& t, std::size_t slot_count) {
+			auto hash = static_cast<std::uint64_t>(std::hash<T>{}(t)) * 0x9E3779B97F4A7C15ull;
+			return static_cast<std::size_t>(hash >> (64 - std::countr_zero(slot_count)));
+		}
+
+		/* The slot holding t, or the empty slot it would go into */
+		template<typename T, typename Projection>
+		std::size_t find_slot(const std::vector<std::size_t>& slots, const T& t, Projection project) const {
+			auto mask = slots.size() - 1;
+			for (auto slot = first_slot(t, slots.size());; slot = (slot + 1) & mask) {
+				if (slots[slot] == empty_slot || project(_pairs[slots[slot]]) == t) {
+					return slot;
+				}
+			}
+		}
+
+		static const K& key_of(const std::pair<K, V>& pair) {
+			return pair.first;
+		}
+
+		static const V& value_of(const std::pair<K, V>& pair) {
+			return pair.second;
+		}
+
+		/* Keeps the slots at most half full for pair_count pairs */
+		void reserve_slots(std::size_t pair_count) {
+			if (2 * pair_count <= _key_slots.size()) {
+				return;
+			}
+			_key_slots.resize(std::bit_ceil(2 * pair_count));
+			_value_slots.resize(_key_slots.size());
+			reindex();
+		}
 
-		static const K& key_proj(const std::pair<K, V>& a) {
-			return a.first;
+		void reindex() {
+			std::ranges::fill(_key_slots, empty_slot);
+			std::ranges::fill(_value_slots, empty_slot);
+			for (std::size_t i = 0; i < _pairs.size(); i++) {
+				index(i);
+			}
 		}
 
-		const V& value_index_proj(const std::size_t& v) const {
-			return _key_sorted_values[v].second;
+		void index(std::size_t position) {
+			_key_slots[find_slot(_key_slots, _pairs[position].first, key_of)] = position;
+			_value_slots[find_slot(_value_slots, _pairs[position].second, value_of)] = position;
 		}
 
 	public:
 		const V& lookup(const K& k) const {
-			auto key_it = std::ranges::lower_bound(_key_sorted_values, k, std::less<K>{}, key_proj);
-			
-			if (key_it == std::cend(_key_sorted_values) || key_proj(*key_it) != k) {
+			auto position = _key_slots[find_slot(_key_slots, k, key_of)];
+			if (position == empty_slot) {
 				throw SymbolDoesNotExistException("lookup() The requested symbol does not exist");
 			}
-
-			return key_it->second;
+			return _pairs[position].second;
 		}
 
 		const K& lookup_by_value(const V& v) const {
-			auto value_it = std::ranges::lower_bound(_value_index, v, std::less<V>{}, [&](const auto& o) {return value_index_proj(o);});
-			
-			if (value_it == std::cend(_value_index) || value_index_proj(*value_it) != v) {
+			auto position = _value_slots[find_slot(_value_slots, v, value_of)];
+			if (position == empty_slot) {
 				throw SymbolDoesNotExistException("lookup_by_value() The requested value does not exist");
 			}
+			return _pairs[position].first;
+		}
+
+		bool contains(const K& k) const {
+			return _key_slots[find_slot(_key_slots, k, key_of)] != empty_slot;
+		}
+
+		bool contains_value(const V& v) const {
+			return _value_slots[find_slot(_value_slots, v, value_of)] != empty_slot;
+		}
 
-			return _key_sorted_values[*value_it].first;
+		std::size_t size() const {
+			return _pairs.size();
 		}
 
 		void store(K k, V v) {
-			auto key_it = std::ranges::lower_bound(_key_sorted_values, k, std::less<K>{}, key_proj);
-			if (key_it != std::cend(_key_sorted_values) && key_proj(*key_it) == k) {
+			if (contains(k)) {
 				throw SymbolAlreadyExistsException("store() The key already exists");
 			}
-			auto value_it = std::ranges::lower_bound(_value_index, v, std::less<V>{}, [&](const auto& o) {return value_index_proj(o);});
-			if (value_it != std::cend(_value_index) && value_index_proj(*value_it) == v) {
+			if (contains_value(v)) {
 				throw SymbolAlreadyExistsException("store() The value already exists");
 			}
+			reserve_slots(_pairs.size() + 1);
+			_pairs.emplace_back(std::move(k), std::move(v));
+			index(_pairs.size() - 1);
+		}
 
-			auto emplaced_it = _key_sorted_values.emplace(key_it, std::make_pair(std::move(k), std::move(v)));
-
-			auto inserted_index = static_cast<std::size_t>(std::distance(std::begin(_key_sorted_values), emplaced_it));
-
-			for (auto& value : _value_index) {
-				if (value >= inserted_index) {
-					value++;
+		/* Stores every pair of the range, or none of them if a key or a value is already in the
+		   table or is in the range twice. The slots are grown once for the whole range, and a
+		   duplicate takes the pairs of the range back out again */
+		template<std::ranges::input_range Range>
+			requires std::convertible_to<std::ranges::range_reference_t<Range>, std::pair<K, V>>
+		void store_range(Range&& range) {
+			if constexpr (std::ranges::sized_range<Range>) {
+				reserve_slots(_pairs.size() + std::ranges::size(range));
+			}
+			auto first_position = _pairs.size();
+			for (auto&& pair : range) {
+				std::pair<K, V> converted = std::forward<decltype(pair)>(pair);
+				const char* duplicate = contains(converted.first) ? "store_range() The key already exists"
+					: contains_value(converted.second) ? "store_range() The value already exists"
+					: nullptr;
+				if (duplicate != nullptr) {
+					_pairs.erase(_pairs.begin() + first_position, _pairs.end());
+					reindex();
+					throw SymbolAlreadyExistsException(duplicate);
 				}
+				reserve_slots(_pairs.size() + 1);
+				_pairs.push_back(std::move(converted));
+				index(_pairs.size() - 1);
 			}
-
-			_value_index.emplace(value_it, inserted_index);
 		}
 
+		/* The pairs in the order they were stored */
 		coro::generator<const std::pair<K, V>&> symbol_table() const {
-			for (const auto& value : _key_sorted_values) {
+			for (const auto& value : _pairs) {
 				co_yield value;
 			}
 			co_return;
 		}
-		
+
 	};
-}
\ No newline at end of file
+}
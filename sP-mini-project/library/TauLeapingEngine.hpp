@@ -0,0 +1,242 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include "SimulationEngine.hpp"
+
+namespace stosim {
+	/* Explicit tau-leaping with the adaptive step size selection by Cao, Gillespie & Petzold (2006).
+	   Every leap fires a Poisson distributed number of each non critical rule, where a rule is
+	   critical when it can only fire a few more times before one of its reactants runs out.
+	   Critical rules fire at most once per leap, and when the selected leap would be too short to
+	   be worth it the engine takes exact direct method steps instead */
+	class TauLeapingEngine {
+		/* The bound on the relative change of the propensities during a leap */
+		static constexpr double epsilon = 0.03;
+		/* A rule that can fire fewer times than this is critical */
+		static constexpr std::int64_t critical_firings = 10;
+		/* When the leap is shorter than this many expected exact steps, exact steps are used instead */
+		static constexpr double exact_threshold = 10;
+		/* How many exact steps are taken before trying to leap again */
+		static constexpr std::size_t exact_step_count = 100;
+
+		const CompiledNetwork& _network;
+		/* The highest order of any rule consuming the agent, and the highest multiplicity of the
+		   agent among the rules of that order. Together they give the g_i of Cao et al. */
+		std::vector<agent_count_t> _highest_order;
+		std::vector<agent_count_t> _highest_multiplicity;
+		std::vector<double> _propensities;
+		std::vector<bool> _critical;
+		std::vector<std::int64_t> _firings;
+		std::vector<double> _mean_change;
+		std::vector<double> _variance_change;
+		std::vector<std::int64_t> _next_count;
+		std::size_t _exact_steps_remaining = 0;
+
+		/* How many times a rule can fire before one of its consumed reactants runs out */
+		std::int64_t remaining_firings(std::size_t rule_index, const std::vector<agent_count_t>& agent_count) const {
+			auto remaining = std::numeric_limits<std::int64_t>::max();
+			auto tokens = _network.change_tokens(rule_index);
+			auto amounts = _network.change_amounts(rule_index);
+			for (std::size_t k = 0; k < tokens.size(); k++) {
+				if (amounts[k] < 0) {
+					remaining = std::min(remaining, static_cast<std::int64_t>(agent_count[tokens[k]]) / -amounts[k]);
+				}
+			}
+			return remaining;
+		}
+
+		/* Cao, Gillespie & Petzold equation 27: how much the propensities of the highest order
+		   rule consuming the agent change relative to the agent itself */
+		double relative_order(agent_token_t token, agent_count_t count) const {
+			double x = static_cast<double>(count);
+			auto order = _highest_order[token];
+			auto multiplicity = _highest_multiplicity[token];
+			if (multiplicity <= 1 || x <= multiplicity) {
+				return static_cast<double>(order);
+			}
+			if (order == 2) {
+				return 2 + 1 / (x - 1);
+			}
+			if (order == 3 && multiplicity == 2) {
+				return 1.5 * (2 + 1 / (x - 1));
+			}
+			if (order == 3) {
+				return 3 + 1 / (x - 1) + 2 / (x - 2);
+			}
+			return static_cast<double>(order);
+		}
+
+		/* Cao, Gillespie & Petzold equation 33: the largest leap where the expected change and the
+		   standard deviation of the change of every reactant stays below epsilon * x_i / g_i */
+		double select_tau(const std::vector<agent_count_t>& agent_count) {
+			std::ranges::fill(_mean_change, 0.0);
+			std::ranges::fill(_variance_change, 0.0);
+			for (std::size_t j = 0; j < _network.rule_count(); j++) {
+				if (_critical[j] || _propensities[j] <= 0) {
+					continue;
+				}
+				auto tokens = _network.change_tokens(j);
+				auto amounts = _network.change_amounts(j);
+				for (std::size_t k = 0; k < tokens.size(); k++) {
+					_mean_change[tokens[k]] += amounts[k] * _propensities[j];
+					_variance_change[tokens[k]] += amounts[k] * amounts[k] * _propensities[j];
+				}
+			}
+
+			auto tau = std::numeric_limits<double>::infinity();
+			for (std::size_t i = 0; i < agent_count.size(); i++) {
+				if (_highest_order[i] == 0 || (_mean_change[i] == 0 && _variance_change[i] == 0)) {
+					continue;
+				}
+				auto bound = std::max(epsilon * agent_count[i] / relative_order(i, agent_count[i]), 1.0);
+				if (_mean_change[i] != 0) {
+					tau = std::min(tau, bound / std::abs(_mean_change[i]));
+				}
+				if (_variance_change[i] != 0) {
+					tau = std::min(tau, bound * bound / _variance_change[i]);
+				}
+			}
+			return tau;
+		}
+
+		/* Picks a rule with probability proportional to its propensity among the given rules */
+		template<std::uniform_random_bit_generator R>
+		std::optional<std::size_t> select_rule(double total, bool critical_only, R& rng) const {
+			auto target = std::uniform_real_distribution(0.0, total)(rng);
+			std::optional<std::size_t> last_enabled = std::nullopt;
+			double cumulative = 0;
+			for (std::size_t j = 0; j < _network.rule_count(); j++) {
+				if (_propensities[j] <= 0 || (critical_only && !_critical[j])) {
+					continue;
+				}
+				cumulative += _propensities[j];
+				last_enabled.emplace(j);
+				if (target < cumulative) {
+					break;
+				}
+			}
+			return last_enabled;
+		}
+
+		template<std::uniform_random_bit_generator R>
+		std::optional<std::size_t> exact_step(VesselState& state, double total_propensity, R& rng) {
+			auto rule_index = select_rule(total_propensity, false, rng);
+			if (!rule_index.has_value()) {
+				return std::nullopt;
+			}
+			state.time += draw_delay(total_propensity, rng);
+			_network.apply(rule_index.value(), state.agent_count);
+			return rule_index;
+		}
+
+	public:
+		TauLeapingEngine(const CompiledNetwork& network)
+			: _network(network), _highest_order(network.agent_type_count(), 0), _highest_multiplicity(network.agent_type_count(), 0),
+			  _propensities(network.rule_count()), _critical(network.rule_count()), _firings(network.rule_count()),
+			  _mean_change(network.agent_type_count()), _variance_change(network.agent_type_count()), _next_count(network.agent_type_count()) {
+			for (std::size_t j = 0; j < network.rule_count(); j++) {
+				auto order = network.order(j);
+				auto tokens = network.reactant_tokens(j);
+				auto multiplicities = network.reactant_multiplicities(j);
+				for (std::size_t k = 0; k < tokens.size(); k++) {
+					auto token = tokens[k];
+					if (order > _highest_order[token]) {
+						_highest_order[token] = order;
+						_highest_multiplicity[token] = multiplicities[k];
+					}
+					else if (order == _highest_order[token]) {
+						_highest_multiplicity[token] = std::max(_highest_multiplicity[token], multiplicities[k]);
+					}
+				}
+			}
+		}
+
+		template<std::uniform_random_bit_generator R>
+		void reset(const VesselState& state, R& rng) {
+			_exact_steps_remaining = 0;
+		}
+
+		/* The propensities and the critical rules are recomputed at the start of every step */
+		template<typename Archive>
+		void checkpoint(Archive& archive) {
+			archive(_exact_steps_remaining);
+		}
+
+		bool consistent() const {
+			return true;
+		}
+
+		/* Returns leap_rule_index when a leap was taken */
+		template<std::uniform_random_bit_generator R>
+		std::optional<std::size_t> step(VesselState& state, R& rng) {
+			double total_propensity = 0;
+			double critical_propensity = 0;
+			for (std::size_t j = 0; j < _network.rule_count(); j++) {
+				_propensities[j] = _network.propensity(j, state.agent_count);
+				total_propensity += _propensities[j];
+				_critical[j] = _propensities[j] > 0 && remaining_firings(j, state.agent_count) < critical_firings;
+				if (_critical[j]) {
+					critical_propensity += _propensities[j];
+				}
+			}
+			if (total_propensity <= 0) {
+				return std::nullopt;
+			}
+
+			if (_exact_steps_remaining > 0) {
+				_exact_steps_remaining--;
+				return exact_step(state, total_propensity, rng);
+			}
+
+			auto non_critical_tau = select_tau(state.agent_count);
+			if (std::isinf(non_critical_tau) || non_critical_tau < exact_threshold / total_propensity) {
+				_exact_steps_remaining = exact_step_count - 1;
+				return exact_step(state, total_propensity, rng);
+			}
+
+			while (true) {
+				/* Critical rules are treated exactly: the first one fires if it comes before the leap ends */
+				auto critical_tau = draw_delay(critical_propensity, rng);
+				auto tau = std::min(non_critical_tau, critical_tau);
+
+				for (std::size_t j = 0; j < _network.rule_count(); j++) {
+					auto mean = _propensities[j] * tau;
+					_firings[j] = (_critical[j] || mean <= 0) ? 0 : std::poisson_distribution<std::int64_t>(mean)(rng);
+				}
+				if (critical_tau <= non_critical_tau) {
+					_firings[select_rule(critical_propensity, true, rng).value()] = 1;
+				}
+
+				for (std::size_t i = 0; i < state.agent_count.size(); i++) {
+					_next_count[i] = static_cast<std::int64_t>(state.agent_count[i]);
+				}
+				for (std::size_t j = 0; j < _network.rule_count(); j++) {
+					if (_firings[j] == 0) {
+						continue;
+					}
+					auto tokens = _network.change_tokens(j);
+					auto amounts = _network.change_amounts(j);
+					for (std::size_t k = 0; k < tokens.size(); k++) {
+						_next_count[tokens[k]] += amounts[k] * _firings[j];
+					}
+				}
+
+				/* A leap that would make a count negative is rejected and retried with half the step */
+				if (std::ranges::any_of(_next_count, [](auto count) { return count < 0; })) {
+					non_critical_tau /= 2;
+					continue;
+				}
+
+				for (std::size_t i = 0; i < state.agent_count.size(); i++) {
+					state.agent_count[i] = static_cast<agent_count_t>(_next_count[i]);
+				}
+				state.time += tau;
+				return leap_rule_index;
+			}
+		}
+	};
+}
@@ -0,0 +1,459 @@
+#include "TrajectoryFile.hpp"
+#include "Varint.hpp"
+#include <cstring>
+#include <bit>
+#include <algorithm>
+#include <utility>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace stosim {
+	namespace {
+		template<typename T>
+		void write_raw(std::ostream& out, T value) {
+			out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+
+		/* Reads from the mapping, every read checks that it stays inside it */
+		class ByteReader {
+			const std::byte* _position;
+			const std::byte* _end;
+
+		public:
+			ByteReader(const std::byte* begin, const std::byte* end)
+				: _position(begin), _end(end) {}
+
+			template<typename T>
+			T raw() {
+				if (static_cast<std::size_t>(_end - _position) < sizeof(T)) {
+					throw TrajectoryFileException("TrajectoryReader() The file is truncated");
+				}
+				T rv;
+				std::memcpy(&rv, _position, sizeof(T));
+				_position += sizeof(T);
+				return rv;
+			}
+
+			std::uint64_t varint() {
+				std::uint64_t rv = 0;
+				for (int shift = 0; shift < 64; shift += 7) {
+					if (_position == _end) {
+						throw TrajectoryFileException("TrajectoryReader() The file is truncated");
+					}
+					auto byte = static_cast<std::uint8_t>(*_position++);
+					rv |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+					if ((byte & 0x80) == 0) {
+						return rv;
+					}
+				}
+				throw TrajectoryFileException("TrajectoryReader() A varint is too long");
+			}
+
+			std::string string(std::size_t length) {
+				if (static_cast<std::size_t>(_end - _position) < length) {
+					throw TrajectoryFileException("TrajectoryReader() The file is truncated");
+				}
+				std::string rv(reinterpret_cast<const char*>(_position), length);
+				_position += length;
+				return rv;
+			}
+
+			void skip(std::size_t length) {
+				if (static_cast<std::size_t>(_end - _position) < length) {
+					throw TrajectoryFileException("TrajectoryReader() The file is truncated");
+				}
+				_position += length;
+			}
+
+			const std::byte* position() const {
+				return _position;
+			}
+		};
+	}
+
+	TrajectoryWriter::TrajectoryWriter(const std::filesystem::path& path, const std::vector<std::string>& species_names, std::size_t chunk_events)
+		: _out(path, std::ios::binary | std::ios::trunc), _species_count(species_names.size()), _chunk_events(std::max<std::size_t>(chunk_events, 1)),
+		  _counts(_species_count * _chunk_events)
+	{
+		if (!_out) {
+			throw TrajectoryFileException("TrajectoryWriter() The file could not be opened");
+		}
+		_times.reserve(_chunk_events);
+		_out.write(trajectory_format::magic, sizeof(trajectory_format::magic));
+		write_raw<std::uint32_t>(_out, trajectory_format::version);
+		write_raw<std::uint32_t>(_out, static_cast<std::uint32_t>(_species_count));
+		for (const auto& name : species_names) {
+			write_raw<std::uint32_t>(_out, static_cast<std::uint32_t>(name.size()));
+			_out.write(name.data(), name.size());
+		}
+	}
+
+	static std::vector<std::string> species_names_of(const Vessel& vessel)
+	{
+		std::vector<std::string> rv;
+		for (std::size_t i = 0; i < vessel.get_initial_state().size(); i++) {
+			rv.push_back(vessel.get_reaction_symbols().lookup(i));
+		}
+		return rv;
+	}
+
+	TrajectoryWriter::TrajectoryWriter(const std::filesystem::path& path, const Vessel& vessel, std::size_t chunk_events)
+		: TrajectoryWriter(path, species_names_of(vessel), chunk_events) {}
+
+	TrajectoryWriter::~TrajectoryWriter()
+	{
+		try {
+			close();
+		}
+		catch (...) {
+		}
+	}
+
+	void TrajectoryWriter::write(const VesselState& state)
+	{
+		if (_closed) {
+			throw TrajectoryFileException("write() The writer is closed");
+		}
+		if (state.agent_count.size() != _species_count) {
+			throw TrajectoryFileException("write() The state does not have the agents of the file");
+		}
+		auto event = _times.size();
+		_times.push_back(state.time);
+		for (std::size_t s = 0; s < _species_count; s++) {
+			_counts[s * _chunk_events + event] = state.agent_count[s];
+		}
+		if (_times.size() == _chunk_events) {
+			flush_chunk();
+		}
+	}
+
+	void TrajectoryWriter::flush_chunk()
+	{
+		if (_times.empty()) {
+			return;
+		}
+		auto event_count = _times.size();
+		_index.push_back({
+			.offset = static_cast<std::uint64_t>(_out.tellp()),
+			.first_event = _event_count,
+			.event_count = event_count,
+			.first_time = _times.front(),
+			.last_time = _times.back()
+		});
+
+		/* The byte length of every column comes first, so a reader can skip the columns it does not need */
+		std::vector<std::string> columns(1 + _species_count);
+		std::uint64_t previous_bits = 0;
+		for (auto time : _times) {
+			auto bits = std::bit_cast<std::uint64_t>(time);
+			append_varint(columns[0], bits - previous_bits);
+			previous_bits = bits;
+		}
+		for (std::size_t s = 0; s < _species_count; s++) {
+			agent_count_t previous = 0;
+			for (std::size_t i = 0; i < event_count; i++) {
+				auto count = _counts[s * _chunk_events + i];
+				append_varint(columns[1 + s], zigzag(static_cast<std::int64_t>(count - previous)));
+				previous = count;
+			}
+		}
+
+		for (const auto& column : columns) {
+			write_raw<std::uint32_t>(_out, static_cast<std::uint32_t>(column.size()));
+		}
+		for (const auto& column : columns) {
+			_out.write(column.data(), column.size());
+		}
+
+		_event_count += event_count;
+		_times.clear();
+	}
+
+	void TrajectoryWriter::close()
+	{
+		if (_closed) {
+			return;
+		}
+		_closed = true;
+		flush_chunk();
+
+		auto index_offset = static_cast<std::uint64_t>(_out.tellp());
+		for (const auto& entry : _index) {
+			write_raw(_out, entry.offset);
+			write_raw(_out, entry.first_event);
+			write_raw(_out, entry.event_count);
+			write_raw(_out, entry.first_time);
+			write_raw(_out, entry.last_time);
+		}
+		write_raw<std::uint64_t>(_out, index_offset);
+		write_raw<std::uint64_t>(_out, _index.size());
+		write_raw<std::uint64_t>(_out, _event_count);
+		_out.write(trajectory_format::magic, sizeof(trajectory_format::magic));
+		_out.close();
+		if (!_out) {
+			throw TrajectoryFileException("close() The file could not be written");
+		}
+	}
+
+#ifdef _WIN32
+	MappedFile::MappedFile(const std::filesystem::path& path)
+	{
+		_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (_file == INVALID_HANDLE_VALUE) {
+			_file = nullptr;
+			throw TrajectoryFileException("MappedFile() The file could not be opened");
+		}
+		LARGE_INTEGER size;
+		GetFileSizeEx(_file, &size);
+		_size = static_cast<std::size_t>(size.QuadPart);
+		if (_size > 0) {
+			_mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (_mapping == nullptr) {
+				unmap();
+				throw TrajectoryFileException("MappedFile() The file could not be mapped");
+			}
+			_data = static_cast<const std::byte*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+			if (_data == nullptr) {
+				unmap();
+				throw TrajectoryFileException("MappedFile() The file could not be mapped");
+			}
+		}
+	}
+
+	void MappedFile::unmap()
+	{
+		if (_data != nullptr) {
+			UnmapViewOfFile(_data);
+		}
+		if (_mapping != nullptr) {
+			CloseHandle(_mapping);
+		}
+		if (_file != nullptr) {
+			CloseHandle(_file);
+		}
+		_data = nullptr;
+		_mapping = nullptr;
+		_file = nullptr;
+		_size = 0;
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept
+		: _data(std::exchange(other._data, nullptr)), _size(std::exchange(other._size, 0)),
+		  _file(std::exchange(other._file, nullptr)), _mapping(std::exchange(other._mapping, nullptr)) {}
+
+	MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other) {
+			unmap();
+			_data = std::exchange(other._data, nullptr);
+			_size = std::exchange(other._size, 0);
+			_file = std::exchange(other._file, nullptr);
+			_mapping = std::exchange(other._mapping, nullptr);
+		}
+		return *this;
+	}
+#else
+	MappedFile::MappedFile(const std::filesystem::path& path)
+	{
+		auto fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw TrajectoryFileException("MappedFile() The file could not be opened");
+		}
+		struct stat status;
+		if (fstat(fd, &status) != 0) {
+			::close(fd);
+			throw TrajectoryFileException("MappedFile() The file could not be opened");
+		}
+		_size = static_cast<std::size_t>(status.st_size);
+		if (_size > 0) {
+			auto data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED) {
+				::close(fd);
+				throw TrajectoryFileException("MappedFile() The file could not be mapped");
+			}
+			_data = static_cast<const std::byte*>(data);
+		}
+		/* The mapping keeps the file alive */
+		::close(fd);
+	}
+
+	void MappedFile::unmap()
+	{
+		if (_data != nullptr) {
+			munmap(const_cast<std::byte*>(_data), _size);
+		}
+		_data = nullptr;
+		_size = 0;
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept
+		: _data(std::exchange(other._data, nullptr)), _size(std::exchange(other._size, 0)) {}
+
+	MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other) {
+			unmap();
+			_data = std::exchange(other._data, nullptr);
+			_size = std::exchange(other._size, 0);
+		}
+		return *this;
+	}
+#endif
+
+	MappedFile::~MappedFile()
+	{
+		unmap();
+	}
+
+	TrajectoryReader::TrajectoryReader(const std::filesystem::path& path)
+		: _file(path)
+	{
+		const auto* begin = _file.data();
+		const auto* end = begin + _file.size();
+		constexpr std::size_t footer_size = 3 * sizeof(std::uint64_t) + sizeof(trajectory_format::magic);
+		if (_file.size() < sizeof(trajectory_format::magic) + footer_size
+			|| std::memcmp(begin, trajectory_format::magic, sizeof(trajectory_format::magic)) != 0
+			|| std::memcmp(end - sizeof(trajectory_format::magic), trajectory_format::magic, sizeof(trajectory_format::magic)) != 0) {
+			throw TrajectoryFileException("TrajectoryReader() The file is not a complete trajectory file");
+		}
+
+		auto header = ByteReader(begin + sizeof(trajectory_format::magic), end);
+		if (header.raw<std::uint32_t>() != trajectory_format::version) {
+			throw TrajectoryFileException("TrajectoryReader() The file has an unknown version");
+		}
+		auto species_count = header.raw<std::uint32_t>();
+		for (std::uint32_t i = 0; i < species_count; i++) {
+			auto length = header.raw<std::uint32_t>();
+			_species_names.push_back(header.string(length));
+		}
+
+		auto footer = ByteReader(end - footer_size, end);
+		auto index_offset = footer.raw<std::uint64_t>();
+		auto chunk_count = footer.raw<std::uint64_t>();
+		_event_count = footer.raw<std::uint64_t>();
+		/* The index lies between the chunks and the footer, and every chunk starts before it */
+		constexpr std::size_t entry_size = 3 * sizeof(std::uint64_t) + 2 * sizeof(double);
+		auto index_end = _file.size() - footer_size;
+		if (index_offset > index_end || chunk_count > (index_end - index_offset) / entry_size) {
+			throw TrajectoryFileException("TrajectoryReader() The index is outside the file");
+		}
+		auto index = ByteReader(begin + index_offset, end - footer_size);
+		for (std::uint64_t i = 0; i < chunk_count; i++) {
+			trajectory_format::ChunkIndexEntry entry;
+			entry.offset = index.raw<std::uint64_t>();
+			entry.first_event = index.raw<std::uint64_t>();
+			entry.event_count = index.raw<std::uint64_t>();
+			entry.first_time = index.raw<double>();
+			entry.last_time = index.raw<double>();
+			if (entry.offset >= index_offset) {
+				throw TrajectoryFileException("TrajectoryReader() A chunk is outside the file");
+			}
+			_index.push_back(entry);
+		}
+	}
+
+	std::size_t TrajectoryReader::first_chunk(double time) const
+	{
+		auto it = std::ranges::lower_bound(_index, time, {}, &trajectory_format::ChunkIndexEntry::last_time);
+		return static_cast<std::size_t>(std::distance(_index.begin(), it));
+	}
+
+	void TrajectoryReader::decode_chunk(std::size_t chunk, std::vector<double>& times, const std::vector<agent_token_t>& species, std::vector<std::vector<agent_count_t>>& counts) const
+	{
+		const auto& entry = _index[chunk];
+		const auto* end = _file.data() + _file.size();
+		auto reader = ByteReader(_file.data() + entry.offset, end);
+		std::vector<std::uint32_t> column_sizes(1 + _species_names.size());
+		for (auto& size : column_sizes) {
+			size = reader.raw<std::uint32_t>();
+		}
+		std::vector<const std::byte*> columns;
+		for (auto size : column_sizes) {
+			columns.push_back(reader.position());
+			reader.skip(size);
+			/* Every event takes at least a byte of every column, so a broken count cannot allocate more than the chunk holds */
+			if (entry.event_count > size) {
+				throw TrajectoryFileException("TrajectoryReader() A chunk holds fewer events than its index says");
+			}
+		}
+
+		times.resize(entry.event_count);
+		auto time_reader = ByteReader(columns[0], columns[0] + column_sizes[0]);
+		std::uint64_t bits = 0;
+		for (auto& time : times) {
+			bits += time_reader.varint();
+			time = std::bit_cast<double>(bits);
+		}
+
+		counts.resize(species.size());
+		for (std::size_t k = 0; k < species.size(); k++) {
+			auto column = 1 + species[k];
+			auto count_reader = ByteReader(columns[column], columns[column] + column_sizes[column]);
+			counts[k].resize(entry.event_count);
+			agent_count_t count = 0;
+			for (auto& value : counts[k]) {
+				count += static_cast<agent_count_t>(unzigzag(count_reader.varint()));
+				value = count;
+			}
+		}
+	}
+
+	coro::generator<const VesselState&> TrajectoryReader::states(double from, double to) const
+	{
+		std::vector<agent_token_t> species(_species_names.size());
+		for (std::size_t i = 0; i < species.size(); i++) {
+			species[i] = i;
+		}
+		std::vector<double> times;
+		std::vector<std::vector<agent_count_t>> counts;
+		VesselState state{ .agent_count = std::vector<agent_count_t>(species.size()), .time = 0 };
+
+		for (auto chunk = first_chunk(from); chunk < _index.size() && _index[chunk].first_time <= to; chunk++) {
+			decode_chunk(chunk, times, species, counts);
+			for (std::size_t i = 0; i < times.size(); i++) {
+				if (times[i] < from) {
+					continue;
+				}
+				if (times[i] > to) {
+					co_return;
+				}
+				state.time = times[i];
+				for (std::size_t s = 0; s < species.size(); s++) {
+					state.agent_count[s] = counts[s][i];
+				}
+				co_yield state;
+			}
+		}
+	}
+
+	coro::generator<const TimedCount&> TrajectoryReader::counts(agent_token_t token, double from, double to) const
+	{
+		if (token >= _species_names.size()) {
+			throw TrajectoryFileException("counts() The agent is not in the file");
+		}
+		std::vector<agent_token_t> species = { token };
+		std::vector<double> times;
+		std::vector<std::vector<agent_count_t>> counts;
+
+		for (auto chunk = first_chunk(from); chunk < _index.size() && _index[chunk].first_time <= to; chunk++) {
+			decode_chunk(chunk, times, species, counts);
+			for (std::size_t i = 0; i < times.size(); i++) {
+				if (times[i] < from) {
+					continue;
+				}
+				if (times[i] > to) {
+					co_return;
+				}
+				co_yield TimedCount{ .time = times[i], .count = counts[0][i] };
+			}
+		}
+	}
+}
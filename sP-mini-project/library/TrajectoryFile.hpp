@@ -0,0 +1,140 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <exception>
+#include <coro/coro.hpp>
+#include "SimulationEngine.hpp"
+#include "stosim.hpp"
+
+namespace stosim {
+	struct TrajectoryFileException : public std::exception {
+		TrajectoryFileException(const char* message)
+			: std::exception(message) {}
+	};
+
+	/* The file starts with a header holding the names of the agents, followed by chunks of up to
+	   chunk_events states and ends with an index of the chunks and a footer pointing at it.
+	   A chunk is stored column by column, the times as the differences between the bit patterns
+	   of consecutive times, which are positive and lossless since the times never decrease, and
+	   every agent as zigzag encoded differences between consecutive counts, all as varints.
+	   An event changes only a few agents by a little, so most counts take a single byte.
+	   Multi byte integers are stored little endian */
+	namespace trajectory_format {
+		constexpr char magic[8] = { 'S', 'T', 'O', 'S', 'I', 'M', 'T', 'J' };
+		constexpr std::uint32_t version = 1;
+
+		struct ChunkIndexEntry {
+			std::uint64_t offset;
+			std::uint64_t first_event;
+			std::uint64_t event_count;
+			double first_time;
+			double last_time;
+		};
+	}
+
+	/* Writes the states it is given to a trajectory file, only the chunk being written is kept in
+	   memory. It can be used as an observer, see Simulation::run */
+	class TrajectoryWriter {
+		std::ofstream _out;
+		std::size_t _species_count;
+		std::size_t _chunk_events;
+		std::vector<double> _times;
+		/* The counts of agent s are at [s * _chunk_events, (s + 1) * _chunk_events) */
+		std::vector<agent_count_t> _counts;
+		std::vector<trajectory_format::ChunkIndexEntry> _index;
+		std::uint64_t _event_count = 0;
+		bool _closed = false;
+
+		void flush_chunk();
+
+	public:
+		TrajectoryWriter(const std::filesystem::path& path, const std::vector<std::string>& species_names, std::size_t chunk_events = 4096);
+		/* Takes the names of the agents from the symbol table of the vessel */
+		TrajectoryWriter(const std::filesystem::path& path, const Vessel& vessel, std::size_t chunk_events = 4096);
+		TrajectoryWriter(const TrajectoryWriter&) = delete;
+		TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+		~TrajectoryWriter();
+
+		void write(const VesselState& state);
+
+		void operator()(const VesselState& state, std::size_t rule_index) {
+			write(state);
+		}
+
+		/* Writes the last chunk and the index, the file is not readable before this */
+		void close();
+	};
+
+	/* A read only view of a whole file mapped into memory */
+	class MappedFile {
+		const std::byte* _data = nullptr;
+		std::size_t _size = 0;
+#ifdef _WIN32
+		void* _file = nullptr;
+		void* _mapping = nullptr;
+#endif
+		void unmap();
+
+	public:
+		explicit MappedFile(const std::filesystem::path& path);
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile();
+
+		const std::byte* data() const {
+			return _data;
+		}
+
+		std::size_t size() const {
+			return _size;
+		}
+	};
+
+	struct TimedCount {
+		double time;
+		agent_count_t count;
+	};
+
+	/* Reads a trajectory file straight from a memory mapping. The chunk index is searched for the
+	   chunks that overlap the requested times, and only the columns that are needed are decoded */
+	class TrajectoryReader {
+		MappedFile _file;
+		std::vector<std::string> _species_names;
+		std::vector<trajectory_format::ChunkIndexEntry> _index;
+		std::uint64_t _event_count = 0;
+
+		/* The index of the first chunk that can hold a state at or after time */
+		std::size_t first_chunk(double time) const;
+
+		/* Decodes the times of a chunk and, if species is not empty, the counts of the given species */
+		void decode_chunk(std::size_t chunk, std::vector<double>& times, const std::vector<agent_token_t>& species, std::vector<std::vector<agent_count_t>>& counts) const;
+
+	public:
+		explicit TrajectoryReader(const std::filesystem::path& path);
+
+		const std::vector<std::string>& species_names() const {
+			return _species_names;
+		}
+
+		std::uint64_t event_count() const {
+			return _event_count;
+		}
+
+		std::size_t chunk_count() const {
+			return _index.size();
+		}
+
+		/* The states with from <= time <= to */
+		coro::generator<const VesselState&> states(double from = -std::numeric_limits<double>::infinity(), double to = std::numeric_limits<double>::infinity()) const;
+
+		/* The counts of a single agent with from <= time <= to, without decoding the other agents */
+		coro::generator<const TimedCount&> counts(agent_token_t token, double from = -std::numeric_limits<double>::infinity(), double to = std::numeric_limits<double>::infinity()) const;
+	};
+}
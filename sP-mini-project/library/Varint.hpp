@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace stosim {
+	/* LEB128, 7 bits per byte with the high bit set on every byte but the last, so small values take a single byte */
+	inline void append_varint(std::string& out, std::uint64_t value) {
+		while (value >= 0x80) {
+			out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	/* Reads a varint written by append_varint and moves position past it, without checking for the end of the data */
+	inline std::uint64_t read_varint(const std::byte*& position) {
+		std::uint64_t rv = 0;
+		for (int shift = 0;; shift += 7) {
+			auto byte = static_cast<std::uint8_t>(*position++);
+			rv |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) {
+				return rv;
+			}
+		}
+	}
+
+	/* Maps small negative numbers to small positive ones, 0, -1, 1, -2, ... to 0, 1, 2, 3, ... */
+	inline std::uint64_t zigzag(std::int64_t value) {
+		return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+	}
+
+	inline std::int64_t unzigzag(std::uint64_t value) {
+		return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+namespace stosim {
+	/* A fixed number of threads that each have their own deque of tasks. A worker takes tasks from
+	   the back of its own deque and steals from the front of the others when it runs dry, so tasks
+	   that finish at different speeds still spread over every thread. Every deque has its own mutex,
+	   the tasks here are whole chunks of simulations so the locks are taken rarely */
+	class WorkStealingPool {
+	public:
+		using task_t = std::function<void()>;
+
+	private:
+		struct Worker {
+			std::mutex mutex;
+			std::deque<task_t> tasks;
+		};
+
+		std::vector<std::unique_ptr<Worker>> _workers;
+		std::vector<std::jthread> _threads;
+		std::mutex _sleep_mutex;
+		std::condition_variable _wake;
+		/* The number of tasks in the deques that no worker has claimed yet */
+		std::size_t _unclaimed = 0;
+		bool _stopping = false;
+		std::atomic<std::size_t> _next_worker = 0;
+
+		std::optional<task_t> take(std::size_t self) {
+			{
+				auto& own = *_workers[self];
+				std::lock_guard lock(own.mutex);
+				if (!own.tasks.empty()) {
+					auto task = std::move(own.tasks.back());
+					own.tasks.pop_back();
+					return task;
+				}
+			}
+			for (std::size_t i = 1; i < _workers.size(); i++) {
+				auto& victim = *_workers[(self + i) % _workers.size()];
+				std::lock_guard lock(victim.mutex);
+				if (!victim.tasks.empty()) {
+					auto task = std::move(victim.tasks.front());
+					victim.tasks.pop_front();
+					return task;
+				}
+			}
+			return std::nullopt;
+		}
+
+		void work(std::size_t self) {
+			while (true) {
+				{
+					std::unique_lock lock(_sleep_mutex);
+					_wake.wait(lock, [&]() { return _unclaimed > 0 || _stopping; });
+					if (_unclaimed == 0) {
+						return;
+					}
+					_unclaimed--;
+				}
+				/* Claiming a task above guarantees there is one in some deque, but another worker
+				   can be holding the lock of the deque it is in */
+				std::optional<task_t> task;
+				while (!(task = take(self)).has_value()) {
+					std::this_thread::yield();
+				}
+				task.value()();
+			}
+		}
+
+	public:
+		explicit WorkStealingPool(std::size_t thread_count = std::max(1u, std::thread::hardware_concurrency())) {
+			thread_count = std::max<std::size_t>(thread_count, 1);
+			for (std::size_t i = 0; i < thread_count; i++) {
+				_workers.push_back(std::make_unique<Worker>());
+			}
+			for (std::size_t i = 0; i < thread_count; i++) {
+				_threads.emplace_back([this, i]() { work(i); });
+			}
+		}
+
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+		/* Runs the tasks that are already submitted and then joins the threads */
+		~WorkStealingPool() {
+			{
+				std::lock_guard lock(_sleep_mutex);
+				_stopping = true;
+			}
+			_wake.notify_all();
+			_threads.clear();
+		}
+
+		/* Spreads the tasks round robin over the deques of the workers */
+		void submit(std::vector<task_t> tasks) {
+			for (auto& task : tasks) {
+				auto& worker = *_workers[_next_worker++ % _workers.size()];
+				std::lock_guard lock(worker.mutex);
+				worker.tasks.push_back(std::move(task));
+			}
+			{
+				std::lock_guard lock(_sleep_mutex);
+				_unclaimed += tasks.size();
+			}
+			_wake.notify_all();
+		}
+
+		std::size_t thread_count() const {
+			return _threads.size();
+		}
+
+		/* The pool multi_simulate uses unless it is given one, sized to the hardware concurrency */
+		static WorkStealingPool& shared() {
+			static WorkStealingPool pool;
+			return pool;
+		}
+	};
+}
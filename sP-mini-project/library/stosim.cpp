@@ -7,106 +7,156 @@
 #include <numeric>
 #include <ranges>
 namespace stosim {
-	AgentSetAndRate AgentSet::operator>>(double rate) const {
-		return AgentSetAndRate(*this, rate);
+	AgentSetAndRate AgentSet::operator>>(Rate rate) const {
+		return AgentSetAndRate(*this, std::move(rate));
 	}
 
 	ReactionRule AgentSetAndRate::operator>>=(AgentSet product) const {
 		return ReactionRule(_agent_set, _rate, std::move(product));
 	}
 
-	/*Requirement 4: here the next reaction rule that will be used is calculated using the given algorithm*/
-	std::optional<std::tuple<std::size_t, double>> Vessel::get_next_reaction_rule(const std::vector<agent_count_t>& agent_count, std::mt19937& mt) const
-	{
-		std::optional<std::size_t> current_best = std::nullopt;
-		double lowest_delay = std::numeric_limits<double>::max();
-		for (auto i = 0; i < _reaction_rules.size(); i++) {
-			const auto& reaction_rule = _reaction_rules[i];
-			const auto& reactant_tokens = reaction_rule.get_reactants().get_agent_tokens();
-			
-			auto reactant_product = (std::size_t) 1;
-			for (const auto& token : reactant_tokens) {
-				reactant_product = reactant_product * agent_count[token];
-			}
-
-			if (reactant_product > 0) {
-				auto distribution = std::exponential_distribution(reactant_product * reaction_rule.get_rate());
-				auto delay = distribution(mt);
-
-				if (delay < lowest_delay) {
-					current_best.emplace(i);
-					lowest_delay = delay;
-				}
-			}
-		}
-		if (current_best != std::nullopt) {
-			return std::make_optional(std::make_tuple(current_best.value(), lowest_delay));
-		}
-		return std::nullopt;
-	}
-
 	AgentSet Vessel::add(std::string name, agent_count_t init) {
+		if (_parameter_symbols.contains_value(name)) {
+			throw SymbolAlreadyExistsException("add() A parameter already has the name");
+		}
 		auto id = _initial_state.size();
 		_reaction_symbols.store(id, std::move(name));
 		_initial_state.push_back(init);
+		_compiled_network.reset();
 		return AgentSet(id);
 	}
 
+	std::vector<AgentSet> Vessel::add(std::vector<std::pair<std::string, agent_count_t>> agents) {
+		auto first_id = _initial_state.size();
+		std::vector<std::pair<agent_token_t, std::string>> symbols;
+		symbols.reserve(agents.size());
+		for (auto& [name, init] : agents) {
+			if (_parameter_symbols.contains_value(name)) {
+				throw SymbolAlreadyExistsException("add() A parameter already has the name");
+			}
+			symbols.emplace_back(first_id + symbols.size(), std::move(name));
+		}
+		_reaction_symbols.store_range(std::move(symbols));
+
+		std::vector<AgentSet> rv;
+		rv.reserve(agents.size());
+		for (const auto& [name, init] : agents) {
+			rv.push_back(AgentSet(_initial_state.size()));
+			_initial_state.push_back(init);
+		}
+		_compiled_network.reset();
+		return rv;
+	}
+
 	void Vessel::add(ReactionRule rule) {
+		for (const auto& factor : rule.get_rate_expression().get_factors()) {
+			if (factor.parameter >= _parameter_values.size()) {
+				throw SymbolDoesNotExistException("add() The rate has a parameter that is not in the vessel");
+			}
+		}
 		_reaction_rules.push_back(std::move(rule));
+		_compiled_network.reset();
+	}
+
+	Rate Vessel::add_parameter(std::string name, double value) {
+		if (_reaction_symbols.contains_value(name)) {
+			throw SymbolAlreadyExistsException("add_parameter() An agent already has the name");
+		}
+		auto id = _parameter_values.size();
+		_parameter_symbols.store(id, std::move(name));
+		_parameter_values.push_back(value);
+		return Rate::parameter(id, value);
+	}
+
+	std::vector<Vessel::SweepTarget> Vessel::sweep_targets(const SweepDesign& design) const {
+		std::vector<SweepTarget> rv;
+		for (const auto& name : design.names()) {
+			if (_parameter_symbols.contains_value(name)) {
+				rv.push_back({ .parameter = true, .index = _parameter_symbols.lookup_by_value(name) });
+			}
+			else if (_reaction_symbols.contains_value(name)) {
+				rv.push_back({ .parameter = false, .index = _reaction_symbols.lookup_by_value(name) });
+			}
+			else {
+				throw SymbolDoesNotExistException("sweep() The design has a name that is neither a parameter nor an agent");
+			}
+		}
+		return rv;
 	}
 
 	AgentSet Vessel::environment() const {
 		return AgentSet();
 	}
 
-	std::vector<std::tuple<std::string, agent_count_t>> Vessel::translate_state(std::vector<agent_count_t> agent_count) const
+	std::shared_ptr<const CompiledNetwork> Vessel::compile()
 	{
-		std::vector<std::tuple<std::string, agent_count_t>> rv;
-		for (auto i = 0; i < agent_count.size(); i++) {
-			auto name = _reaction_symbols.lookup(i);
-			rv.push_back(std::make_tuple(name, agent_count[i]));
+		if (!_compiled_network) {
+			_compiled_network = std::make_shared<const CompiledNetwork>(_reaction_rules, _initial_state.size());
+		}
+		return _compiled_network;
+	}
+
+	std::shared_ptr<const CompiledNetwork> Vessel::compiled_network() const
+	{
+		if (_compiled_network) {
+			return _compiled_network;
+		}
+		return std::make_shared<const CompiledNetwork>(_reaction_rules, _initial_state.size());
+	}
+
+	simulation_engine_t make_engine(SimulationAlgorithm algorithm, const CompiledNetwork& network)
+	{
+		switch (algorithm) {
+		case SimulationAlgorithm::next_reaction:
+			return NextReactionEngine(network);
+		case SimulationAlgorithm::direct:
+			return DirectMethodEngine(network);
+		case SimulationAlgorithm::composition_rejection:
+			return CompositionRejectionEngine(network);
+		case SimulationAlgorithm::tau_leaping:
+			return TauLeapingEngine(network);
+		case SimulationAlgorithm::hybrid:
+			return HybridEngine(network);
+		case SimulationAlgorithm::first_reaction:
+		default:
+			return FirstReactionEngine(network);
 		}
-		return rv;
 	}
 
 	/*Requirement 4 & 7 here we implement the simulation using the rules.
 	* The simulation steps are returned by yielding them.
 	* */
-	coro::generator<const VesselState&> Vessel::simulate() const
+	coro::generator<const VesselState&> Vessel::simulate(SimulationAlgorithm algorithm) const
 	{
-		VesselState state {
-			.agent_count = _initial_state,
-			.time = 0
-		};
-
-		auto rd = std::random_device();
-		auto mt = std::mt19937(rd());
-
-		co_yield state;
-
-		while (true) {
-			auto rule_and_delay = get_next_reaction_rule(state.agent_count, mt);
-			if (!rule_and_delay.has_value()) {
-				co_return;
-			}
-
-			auto [rule_index, delay] = rule_and_delay.value();
+		return simulate(compiled_network(), algorithm, default_random_t(random_seed()));
+	}
 
-			const auto& rule = _reaction_rules[rule_index];
+	coro::generator<const VesselState&> Vessel::simulate(StopCondition stop, SimulationAlgorithm algorithm) const
+	{
+		return simulate(compiled_network(), algorithm, default_random_t(random_seed()), std::move(stop));
+	}
 
-			state.time += delay;
+	coro::generator<std::span<const EventRecord>> Vessel::simulate_batched(std::size_t batch_size, StopCondition stop, SimulationAlgorithm algorithm) const
+	{
+		return batches(start(algorithm), batch_size, std::move(stop));
+	}
 
-			for (auto reactant : rule.get_reactants().get_agent_tokens()) {
-				state.agent_count[reactant] -= 1;
-			}
+	EventLog Vessel::record(const StopCondition& stop, SimulationAlgorithm algorithm, std::size_t keyframe_interval) const
+	{
+		auto simulation = start(algorithm);
+		auto log = EventLog(simulation, keyframe_interval);
+		simulation.run(stop, log);
+		return log;
+	}
 
-			for (auto product : rule.get_products().get_agent_tokens()) {
-				state.agent_count[product] += 1;
-			}
+	Simulation<> Vessel::start(SimulationAlgorithm algorithm) const
+	{
+		return start(random_seed(), algorithm);
+	}
 
-			co_yield state;
-		}
+	coro::generator<const VesselState&> Vessel::sample(TimeGrid grid, SimulationAlgorithm algorithm) const
+	{
+		return stosim::sample(start(algorithm), grid);
 	}
 
 	void Vessel::pretty_print_dot(std::ostream& out) const
@@ -145,6 +195,14 @@ namespace stosim {
 		return _reaction_symbols;
 	}
 
+	const SymbolTable<std::size_t, std::string>& Vessel::get_parameter_symbols() const {
+		return _parameter_symbols;
+	}
+
+	const std::vector<double>& Vessel::get_parameter_values() const {
+		return _parameter_values;
+	}
+
 	const std::string& Vessel::get_name() const {
 		return _name;
 	}
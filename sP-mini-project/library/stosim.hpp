@@ -1,155 +1,398 @@
 #pragma once
 #include <string>
 #include <set>
+#include <map>
 #include "SymbolTable.hpp"
 #include <ostream>
 #include <optional>
-#include <future>
 #include <coro/coro.hpp>
-#include <random>
+#include <memory>
+#include <span>
+#include <cmath>
+#include <utility>
+#include <ranges>
+#include <string_view>
+#include "ReactionRule.hpp"
+#include "CompiledNetwork.hpp"
+#include "Simulation.hpp"
+#include "EventLog.hpp"
+#include "Ensemble.hpp"
+#include "Pipeline.hpp"
+#include "Reducers.hpp"
+#include "Sweep.hpp"
+#include "Sharding.hpp"
+#include "Async.hpp"
+#include "Random.hpp"
 
 namespace stosim {
-	using agent_token_t = size_t;
-	using agent_count_t = size_t;
-	
-	class AgentSetAndRate;
-	class ReactionRule;
-
-	/* An agent set holds a set of agents which can be composed using multiple operators*/
-	class AgentSet {
-		/*Using a set, since each agent set should only contain distinct agents*/
-		std::set<agent_token_t> _agents;
-	public:
-		AgentSet(const AgentSet& other) = default;
-		AgentSet& operator=(const AgentSet& other) = default;
+	class Vessel {
+		std::string _name;
+		std::vector<ReactionRule> _reaction_rules;
+		SymbolTable<agent_token_t, std::string> _reaction_symbols;
+		std::vector<agent_count_t> _initial_state;
+		SymbolTable<std::size_t, std::string> _parameter_symbols;
+		std::vector<double> _parameter_values;
+		/* Set by compile() and discarded whenever an agent or a rule is added */
+		std::shared_ptr<const CompiledNetwork> _compiled_network;
 
-		AgentSet(AgentSet&& other) = default;
-		AgentSet& operator=(AgentSet&& other) = default;
+		/* The compiled network if the vessel has been compiled, otherwise a freshly compiled one */
+		std::shared_ptr<const CompiledNetwork> compiled_network() const;
 
-		AgentSet() { }
+		template<std::uniform_random_bit_generator R>
+		coro::generator<const VesselState&> simulate(std::shared_ptr<const CompiledNetwork> network, SimulationAlgorithm algorithm, R rng) const {
+			return trajectory(Simulation<R>(std::move(network), algorithm, VesselState{ .agent_count = _initial_state, .time = 0 }, std::move(rng)));
+		}
 
-		AgentSet(agent_token_t agent_token) {
-			_agents.insert(agent_token);
+		template<std::uniform_random_bit_generator R>
+		coro::generator<const VesselState&> simulate(std::shared_ptr<const CompiledNetwork> network, SimulationAlgorithm algorithm, R rng, StopCondition stop) const {
+			return trajectory(Simulation<R>(std::move(network), algorithm, VesselState{ .agent_count = _initial_state, .time = 0 }, std::move(rng)), std::move(stop));
 		}
 
-		/* According to requirement 1 we should create overloads that allows us to
-		   write reaction rules directly in the c++. Therefore a operator for +
-		   combines two agent sets into a single one containing all the agents from
-		   both agent sets*/
-		AgentSet operator+(const AgentSet& other) const {
-			AgentSet rv;
-			rv._agents.insert_range(_agents);
-			rv._agents.insert_range(other._agents);
+		/* Where the values of a dimension of a sweep go */
+		struct SweepTarget {
+			bool parameter;
+			/* The index of the parameter or the token of the agent */
+			std::size_t index;
+		};
+
+		std::vector<SweepTarget> sweep_targets(const SweepDesign& design) const;
+
+		/* Runs simulations first_stream, first_stream + 1, ... made by start(stream) into copies of the prototype */
+		template<Reducer T, typename Start>
+		T reduce_streams(std::uint64_t first_stream, size_t simulation_count, const T& prototype, const StopCondition& stop, Start start, EnsembleOptions options) const {
+			auto& pool = options.pool != nullptr ? *options.pool : WorkStealingPool::shared();
+			auto chunk_size = options.chunk_size != 0 ? options.chunk_size : ensemble_chunk_size(simulation_count, pool);
+			auto chunk_count = (simulation_count + chunk_size - 1) / chunk_size;
+			options.chunk_size = 1;
+
+			auto partials = run_ensemble<T>(chunk_count, [&](std::size_t chunk) {
+				auto reducer = prototype;
+				for (auto i = chunk * chunk_size; i < std::min((chunk + 1) * chunk_size, simulation_count); i++) {
+					auto simulation = start(first_stream + i);
+					reduce_simulation(reducer, simulation, stop);
+				}
+				return reducer;
+			}, std::move(options));
+
+			auto rv = prototype;
+			for (const auto& partial : partials) {
+				rv.merge(partial);
+			}
 			return rv;
 		}
 
-		const std::set<agent_token_t>& get_agent_tokens() const {
-			return _agents;
+	public:
+		Vessel(std::string name) : _name(std::move(name)) {}
+
+		AgentSet add(std::string name, agent_count_t init);
+		/* Adds many agents at once, which checks the names for duplicates once for all of them */
+		std::vector<AgentSet> add(std::vector<std::pair<std::string, agent_count_t>> agents);
+		void add(ReactionRule rule);
+		/* A named parameter for the rates of the rules, such as beta in (S + I) >> beta / N >>= E + I.
+		   A sweep gives it other values without building the vessel again, see sweep() */
+		Rate add_parameter(std::string name, double value);
+
+		AgentSet environment() const;
+
+		/* The name and the count of every agent. The names are views into the symbol table and
+		   nothing is allocated, so agent_count has to outlive the view */
+		auto translate_state(std::span<const agent_count_t> agent_count) const {
+			return std::views::iota(std::size_t{ 0 }, agent_count.size()) | std::views::transform([this, agent_count](std::size_t i) {
+				return std::pair<std::string_view, agent_count_t>(_reaction_symbols.lookup(i), agent_count[i]);
+			});
 		}
 
-		const agent_token_t get_agent_token() const {
-			if (_agents.size() != 1) {
-				throw std::exception("Getting agent token is only supported when the agent set has a single token");
-			}
-			return *std::cbegin(_agents);
+		/* A temporary would be gone before the view is read */
+		auto translate_state(std::vector<agent_count_t>&& agent_count) const = delete;
+
+		/* Freezes the rules into the flat arrays the engines run on. Simulating a vessel that has
+		   not been compiled compiles it for every simulation. The vessel lets go of the network
+		   when an agent or a rule is added, the pointer keeps it alive for the caller */
+		std::shared_ptr<const CompiledNetwork> compile();
+
+		/* Simulates with a random seed */
+		coro::generator<const VesselState&> simulate(SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction) const;
+
+		/* Simulates with the given stream of the given seed, the same seed and stream give the same trajectory */
+		template<RandomStream R = default_random_t>
+		coro::generator<const VesselState&> simulate(std::uint64_t seed, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, std::uint64_t stream = 0) const {
+			return simulate(compiled_network(), algorithm, R(seed, stream));
 		}
-		
-		/* Requirement 1 also requires that we should be able to set the rate of
-		   a reaction using >>, this creates a new class called AgentSetAndRate
-		   which suprisingly contains an agent set and a rate*/
-		AgentSetAndRate operator>>(double rate) const;
-	};
 
-	class AgentSetAndRate {
-		AgentSet _agent_set;
-		double _rate;
-	public:
-		AgentSetAndRate(AgentSet agent_set, const double rate)
-			: _agent_set(std::move(agent_set)), _rate(rate) { }
-		AgentSetAndRate(const AgentSetAndRate& other) = default;
-		AgentSetAndRate& operator=(const AgentSetAndRate& other) = default;
-		AgentSetAndRate(AgentSetAndRate&& other) = default;
-		AgentSetAndRate& operator=(AgentSetAndRate&& other) = default;
+		/* Simulates with a random seed until the stop condition holds. The condition is checked in
+		   the event loop, Simulation::run tells why a simulation stopped */
+		coro::generator<const VesselState&> simulate(StopCondition stop, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction) const;
 
-		const AgentSet& get_agent_set() const {
-			return _agent_set;
+		/* Simulates with a random seed and calls observe(state, rule_index) after every event, see
+		   Simulation::run. This is the cheapest way to look at every event */
+		template<typename Observer>
+		StopReason simulate_with(Observer&& observe, const StopCondition& stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction) const {
+			auto simulation = start(algorithm);
+			return simulation.run(stop, std::forward<Observer>(observe));
 		}
 
-		const double get_rate() const {
-			return _rate;
+		/* Simulates with a random seed and yields the events in blocks, see stosim::batches */
+		coro::generator<std::span<const EventRecord>> simulate_batched(std::size_t batch_size, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction) const;
+
+		/* Simulates with a random seed and keeps only the events, see EventLog */
+		EventLog record(const StopCondition& stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, std::size_t keyframe_interval = 1024) const;
+
+		/* A simulation of this vessel that is stepped directly, see Simulation */
+		Simulation<> start(SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction) const;
+
+		template<RandomStream R = default_random_t>
+		Simulation<R> start(std::uint64_t seed, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, std::uint64_t stream = 0) const {
+			return Simulation<R>(compiled_network(), algorithm, VesselState{ .agent_count = _initial_state, .time = 0 }, R(seed, stream));
 		}
 
-		/* Requirement 1 requires that we can create a reaction rule using the >>= operator
-		   since we created the AgentSetAndRate from the reactants and the rate, we only need
-		   the products of the reaction. This is specified on the right side of this opreator.*/
-		ReactionRule operator>>=(AgentSet product) const;
-	};
+		/* Only yields the state at the points of the grid, see stosim::sample */
+		coro::generator<const VesselState&> sample(TimeGrid grid, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction) const;
 
-	class ReactionRule {
-		AgentSet _reactants;
-		double _rate;
-		AgentSet _products;
-	public:
-		ReactionRule(AgentSet reactants, double rate, AgentSet products)
-			: _reactants(std::move(reactants)), _rate(rate), _products(std::move(products)) {}
-		ReactionRule(const ReactionRule& other) = default;
-		ReactionRule& operator=(const ReactionRule& other) = default;
-		ReactionRule(ReactionRule&& other) = default;
-		ReactionRule& operator=(ReactionRule&& other) = default;
+		/* Runs the simulations on a work stealing pool and yields f of every simulation in the
+		   order they complete, see run_ensemble. f is called from several threads at once.
+		   Simulation i uses stream i of options.seed, so a seeded ensemble gives the same
+		   results no matter how many threads run it */
+		template<RandomStream R = default_random_t, typename F>
+		coro::generator<std::invoke_result_t<F, coro::generator<const VesselState&>>> multi_simulate(size_t simulation_count, F f, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, EnsembleOptions options = {}) const {
+			auto network = compiled_network();
+			auto seed = options.seed.value_or(random_seed());
+			return run_ensemble<std::invoke_result_t<F, coro::generator<const VesselState&>>>(simulation_count, [this, network, algorithm, f, seed](std::size_t i) mutable {
+				return f(simulate(network, algorithm, R(seed, i)));
+			}, std::move(options));
+		}
+		/* The same as multi_simulate above with every simulation stopping at the stop condition */
+		template<RandomStream R = default_random_t, typename F>
+		coro::generator<std::invoke_result_t<F, coro::generator<const VesselState&>>> multi_simulate(size_t simulation_count, F f, StopCondition stop, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, EnsembleOptions options = {}) const {
+			auto network = compiled_network();
+			auto seed = options.seed.value_or(random_seed());
+			return run_ensemble<std::invoke_result_t<F, coro::generator<const VesselState&>>>(simulation_count, [this, network, algorithm, f, seed, stop](std::size_t i) mutable {
+				return f(simulate(network, algorithm, R(seed, i), stop));
+			}, std::move(options));
+		}
 
-		const AgentSet& get_reactants() const {
-			return _reactants;
+		/* Runs the simulations like multi_simulate, going through every state, and adds up their
+		   statistics. The counters are only filled in when built with STOSIM_INSTRUMENTATION */
+		template<RandomStream R = default_random_t>
+		SimulationStatistics measure(size_t simulation_count, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, EnsembleOptions options = {}) const {
+			auto network = compiled_network();
+			auto seed = options.seed.value_or(random_seed());
+			SimulationStatistics rv;
+			for (const auto& statistics : run_ensemble<SimulationStatistics>(simulation_count, [&, network](std::size_t i) {
+				SimulationStatistics statistics;
+				for ([[maybe_unused]] const auto& state : trajectory(Simulation<R>(network, algorithm, VesselState{ .agent_count = _initial_state, .time = 0 }, R(seed, i)), stop, statistics)) {
+				}
+				return statistics;
+			}, std::move(options))) {
+				rv.merge(statistics);
+			}
+			return rv;
 		}
 
-		const double& get_rate() const {
-			return _rate;
+		/* Runs the simulations on a work stealing pool and hands the initial state and the state
+		   after every event to the pipeline, see StatePipeline. The pipeline is not closed, so
+		   several ensembles can feed it. Simulation i uses stream i of options.seed */
+		template<RandomStream R = default_random_t>
+		void simulate_into(StatePipeline& pipeline, size_t simulation_count, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, EnsembleOptions options = {}) const {
+			auto network = compiled_network();
+			auto seed = options.seed.value_or(random_seed());
+			for ([[maybe_unused]] auto done : run_ensemble<bool>(simulation_count, [&, network](std::size_t i) {
+				auto producer = pipeline.producer(i);
+				auto simulation = Simulation<R>(network, algorithm, VesselState{ .agent_count = _initial_state, .time = 0 }, R(seed, i));
+				producer.push(simulation.state());
+				simulation.run(stop, producer);
+				producer.finish();
+				return true;
+			}, std::move(options))) {
+			}
 		}
 
-		const AgentSet& get_products() const {
-			return _products;
+		/* Runs the simulations into copies of the prototype, a copy per chunk of simulations, and
+		   merges the copies as they finish. Simulation i uses stream i of options.seed like multi_simulate */
+		template<Reducer T, RandomStream R = default_random_t>
+		T reduce(size_t simulation_count, const T& prototype, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, EnsembleOptions options = {}) const {
+			auto network = compiled_network();
+			auto seed = options.seed.value_or(random_seed());
+			return reduce_streams(0, simulation_count, prototype, stop, [&](std::uint64_t stream) {
+				return Simulation<R>(network, algorithm, VesselState{ .agent_count = _initial_state, .time = 0 }, R(seed, stream));
+			}, std::move(options));
 		}
-	};
-	
-	struct VesselState {
-		std::vector<agent_count_t> agent_count;
-		double time;
-	};
 
-	class Vessel {
-		std::string _name;
-		std::vector<ReactionRule> _reaction_rules;
-		SymbolTable<agent_token_t, std::string> _reaction_symbols;
-		std::vector<agent_count_t> _initial_state;
+		/* The same as reduce, but every simulation is a fork of the snapshot, see Simulation::fork.
+		   A burn-in is then simulated once for the whole ensemble instead of once per simulation */
+		template<Reducer T, RandomStream R>
+		T reduce_from(const Simulation<R>& snapshot, size_t simulation_count, const T& prototype, StopCondition stop = {}, EnsembleOptions options = {}) const {
+			auto seed = options.seed.value_or(random_seed());
+			return reduce_streams(0, simulation_count, prototype, stop, [&](std::uint64_t stream) {
+				return snapshot.fork(R(seed, stream));
+			}, std::move(options));
+		}
 
-		std::optional<std::tuple<std::size_t, double>> get_next_reaction_rule(const std::vector<agent_count_t>& agent_count, std::mt19937& mt) const;
+		/* Runs simulations in waves until every statistic monitor(reducer) returns meets the
+		   precision, or until adaptive.max_simulations. Every wave is sized from the spread seen so
+		   far, and the waves use consecutive streams of the seed, so the result only depends on the seed */
+		template<Reducer T, RandomStream R = default_random_t, typename Monitor>
+		AdaptiveResult<T> reduce_until(const T& prototype, Monitor monitor, Precision precision, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, AdaptiveOptions adaptive = {}, EnsembleOptions options = {}) const {
+			auto network = compiled_network();
+			auto seed = options.seed.value_or(random_seed());
+			auto& pool = options.pool != nullptr ? *options.pool : WorkStealingPool::shared();
+			AdaptiveResult<T> rv{ .reducer = prototype };
 
-	public:
-		Vessel(std::string name) : _name(std::move(name)) {}
+			auto wave = std::max(adaptive.min_simulations, pool.thread_count());
+			while (true) {
+				wave = std::min(wave, adaptive.max_simulations - rv.simulation_count);
+				rv.reducer.merge(reduce_streams(rv.simulation_count, wave, prototype, stop, [&](std::uint64_t stream) {
+					return Simulation<R>(network, algorithm, VesselState{ .agent_count = _initial_state, .time = 0 }, R(seed, stream));
+				}, options));
+				rv.simulation_count += wave;
 
-		AgentSet add(std::string name, agent_count_t init);
-		void add(ReactionRule rule);
+				std::vector<RunningStatistics> statistics = monitor(std::as_const(rv.reducer));
+				rv.converged = rv.simulation_count >= adaptive.min_simulations && std::ranges::all_of(statistics, [&](const auto& s) { return precision.met(s); });
+				if (rv.converged || rv.simulation_count >= adaptive.max_simulations) {
+					rv.statistics = std::move(statistics);
+					return rv;
+				}
 
-		AgentSet environment() const;
+				/* At least a simulation per thread, and at most doubling, since the spread of a few simulations can be far off */
+				std::size_t needed = rv.simulation_count;
+				for (const auto& s : statistics) {
+					needed = std::max(needed, precision.simulations_needed(s, adaptive.max_simulations));
+				}
+				wave = std::max(std::min(needed - rv.simulation_count, rv.simulation_count), pool.thread_count());
+			}
+		}
+
+		/* Runs the simulations like reduce, but in worker processes instead of threads, see
+		   run_sharded. Every chunk of simulations is reduced in a worker and sent back through its
+		   checkpoint(), and the chunks are merged in the order of the simulations. Simulation i uses
+		   stream i of options.seed like reduce, and a worker that dies is replaced without losing
+		   the chunks it already sent back */
+		template<Reducer T, RandomStream R = default_random_t> requires Checkpointable<T>
+		ShardedResult<T> reduce_sharded(size_t simulation_count, const T& prototype, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, ShardingOptions options = {}) const {
+			auto network = compiled_network();
+			auto seed = options.seed.value_or(random_seed());
+			ShardedResult<T> rv{ .reducer = prototype };
+			/* The chunks arrive in whatever order the workers finish them, keyed by their first simulation */
+			std::map<std::size_t, T> chunks;
+
+			rv.statistics = run_sharded(simulation_count, options, [&](std::size_t first, std::size_t count) {
+				auto reducer = prototype;
+				for (auto i = first; i < first + count; i++) {
+					auto simulation = Simulation<R>(network, algorithm, VesselState{ .agent_count = _initial_state, .time = 0 }, R(seed, i));
+					reduce_simulation(reducer, simulation, stop);
+				}
+				CheckpointWriter writer;
+				reducer.checkpoint(writer);
+				return writer.bytes();
+			}, [&](std::size_t first, std::string_view bytes) {
+				auto reducer = prototype;
+				CheckpointReader reader(bytes);
+				reducer.checkpoint(reader);
+				if (reader.remaining() != 0) {
+					throw ShardingException("reduce_sharded() A worker sent a result that does not fit the reducer");
+				}
+				chunks.insert_or_assign(first, std::move(reducer));
+			});
+			for (auto& [first, reducer] : chunks) {
+				rv.reducer.merge(reducer);
+			}
+			return rv;
+		}
+
+		/* Simulates with the given stream of the given seed as a task on a libcoro pool, see
+		   run_async. Nothing runs until the task is awaited, and the simulation goes back to the
+		   queue of the pool every options.yield_interval events, so many of them share the threads
+		   of the pool without a thread per simulation */
+		template<RandomStream R = default_random_t>
+		coro::task<AsyncRun<R>> simulate_async(coro::thread_pool& pool, std::uint64_t seed, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, std::uint64_t stream = 0, AsyncOptions options = {}) const {
+			return run_async(pool, start<R>(seed, algorithm, stream), std::move(stop), std::move(options));
+		}
 
-		std::vector<std::tuple<std::string, agent_count_t>> translate_state(std::vector<agent_count_t> agent_count) const;
+		/* The same simulations as reduce, but as a task on a libcoro pool. Unlike reduce, the
+		   chunks are merged in their order instead of as they finish, so the result only depends
+		   on the seed and the chunk size. A stop through options.stop_token shows in the stopped
+		   flag and the simulation count of the result */
+		template<Reducer T, RandomStream R = default_random_t>
+		coro::task<AsyncReduction<T>> reduce_async(coro::thread_pool& pool, size_t simulation_count, const T& prototype, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, AsyncOptions options = {}) const {
+			auto seed = options.seed.value_or(random_seed());
+			return stosim::reduce_async(pool, simulation_count, prototype, std::move(stop), [network = compiled_network(), initial_state = _initial_state, algorithm, seed](std::size_t i) {
+				return Simulation<R>(network, algorithm, VesselState{ .agent_count = initial_state, .time = 0 }, R(seed, i));
+			}, std::move(options));
+		}
+
+		/* Looks for a simulation that ends with accept(final_state, reason), trying the streams
+		   0 ... simulation_count - 1 of the seed with options.concurrency of them at a time. The
+		   result is the accepted simulation with the lowest stream, and the simulations after it
+		   are stopped at their next yield, see when_first */
+		template<RandomStream R = default_random_t, typename Accept>
+		coro::task<std::optional<Found<AsyncRun<R>>>> search_async(coro::thread_pool& pool, size_t simulation_count, Accept accept, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, AsyncOptions options = {}) const {
+			auto seed = options.seed.value_or(random_seed());
+			auto concurrency = options.concurrency != 0 ? options.concurrency : 4 * pool.thread_count();
+			auto stop_token = options.stop_token;
+			return when_first<AsyncRun<R>>(simulation_count, concurrency, [&pool, network = compiled_network(), initial_state = _initial_state, algorithm, seed, stop = std::move(stop), accept = std::move(accept), options = std::move(options)](std::size_t i, std::stop_token token) {
+				auto simulation = Simulation<R>(network, algorithm, VesselState{ .agent_count = initial_state, .time = 0 }, R(seed, i));
+				auto attempt_options = options;
+				attempt_options.stop_token = std::move(token);
+				return accept_async(pool, std::move(simulation), stop, std::move(attempt_options), accept);
+			}, std::move(stop_token));
+		}
+
+		/* Runs simulations_per_point simulations at every point of the design and reduces them into
+		   a copy of the prototype per point. Every point shares the compiled network of the vessel,
+		   only the rates are evaluated again, so a point costs no more than its simulations. The
+		   points and their simulations are spread over the pool in chunks, and simulation j of
+		   every point uses stream j of options.seed, so the points are compared on common random
+		   numbers and the results only depend on the seed */
+		template<Reducer T, RandomStream R = default_random_t>
+		SweepResult<T> sweep(const SweepDesign& design, size_t simulations_per_point, const T& prototype, StopCondition stop = {}, SimulationAlgorithm algorithm = SimulationAlgorithm::first_reaction, EnsembleOptions options = {}) const {
+			auto network = compiled_network();
+			auto targets = sweep_targets(design);
+			auto seed = options.seed.value_or(random_seed());
+			auto& pool = options.pool != nullptr ? *options.pool : WorkStealingPool::shared();
+			auto chunk_size = std::min(options.chunk_size != 0 ? options.chunk_size : ensemble_chunk_size(design.size() * simulations_per_point, pool), std::max<std::size_t>(simulations_per_point, 1));
+			auto chunks_per_point = (simulations_per_point + chunk_size - 1) / chunk_size;
+			options.chunk_size = 1;
 
-		coro::generator<const VesselState&> simulate() const;
+			std::vector<std::optional<T>> partials(design.size() * chunks_per_point);
+			for (auto&& [task, reducer] : run_ensemble<std::pair<std::size_t, T>>(partials.size(), [&](std::size_t task) {
+				auto point = design.point(task / chunks_per_point);
+				auto parameters = _parameter_values;
+				auto initial_state = _initial_state;
+				for (std::size_t d = 0; d < targets.size(); d++) {
+					if (targets[d].parameter) {
+						parameters[targets[d].index] = point[d];
+					}
+					else {
+						initial_state[targets[d].index] = static_cast<agent_count_t>(std::llround(std::max(point[d], 0.0)));
+					}
+				}
+				auto point_network = std::make_shared<const CompiledNetwork>(network->with_parameters(parameters));
 
-		template<typename F>
-		coro::generator<std::invoke_result_t<F, coro::generator<const VesselState&>>> multi_simulate(size_t simulation_count, F f) const {
-			std::vector<std::future<std::invoke_result_t<F, coro::generator<const VesselState&>>>> futures;
-			for (auto i = 0; i < simulation_count; i++) {
-				futures.push_back(std::async(std::launch::async, [&]() {
-					return f(simulate());
-				}));
+				auto reducer = prototype;
+				auto chunk = task % chunks_per_point;
+				for (auto j = chunk * chunk_size; j < std::min((chunk + 1) * chunk_size, simulations_per_point); j++) {
+					auto simulation = Simulation<R>(point_network, algorithm, VesselState{ .agent_count = initial_state, .time = 0 }, R(seed, j));
+					reduce_simulation(reducer, simulation, stop);
+				}
+				return std::pair<std::size_t, T>(task, std::move(reducer));
+			}, std::move(options))) {
+				partials[task].emplace(std::move(reducer));
 			}
 
-			for (auto& future : futures) {
-				co_yield future.get();
+			/* Merged in the order of the chunks, so the results do not depend on which chunk finished first */
+			SweepResult<T> rv{ .design = design };
+			rv.results.reserve(design.size());
+			for (std::size_t point = 0; point < design.size(); point++) {
+				auto result = prototype;
+				for (std::size_t chunk = 0; chunk < chunks_per_point; chunk++) {
+					if (partials[point * chunks_per_point + chunk].has_value()) {
+						result.merge(partials[point * chunks_per_point + chunk].value());
+					}
+				}
+				rv.results.push_back(std::move(result));
 			}
-			
-			co_return;
+			return rv;
 		}
+
 		/* Requirement 2 says that we should be able to pretty print the
 		   reaction network, therfore we overload the << operator for
 		   ostreams */
@@ -162,6 +405,11 @@ namespace stosim {
 
 		const SymbolTable<agent_token_t, std::string>& get_reaction_symbols() const;
 
+		const SymbolTable<std::size_t, std::string>& get_parameter_symbols() const;
+
+		/* The values the parameters were added with */
+		const std::vector<double>& get_parameter_values() const;
+
 		const std::string& get_name() const;
 	};
 }
\ No newline at end of file
@@ -1,4 +1,8 @@
 #include "library/stosim.hpp"
+#include "library/StaticVessel.hpp"
+#include <random>
+#include <cstdint>
+#include <algorithm>
 
 stosim::Vessel covid19(size_t N) {
 	auto v = stosim::Vessel("COVID19 SEIHR: " + std::to_string(N));
@@ -18,14 +22,48 @@ stosim::Vessel covid19(size_t N) {
 	const auto I = v.add("I", I0); // infectious
 	const auto H = v.add("H", 0); // hospitalized
 	const auto R = v.add("R", 0); // removed/immune (recovered + dead)
-	v.add((S + I) >> beta / N >>= E + I); // susceptible becomes exposed by infectious
-	v.add(E >> alpha >>= I); // exposed becomes infectious
-	v.add(I >> gamma >>= R); // infectious becomes removed
-	v.add(I >> kappa >>= H); // infectious becomes hospitalized
-	v.add(H >> tau >>= R); // hospitalized becomes removed
+	// the rates are parameters, so a sweep can change them without building the vessel again
+	const auto beta_rate = v.add_parameter("beta", beta);
+	const auto alpha_rate = v.add_parameter("alpha", alpha);
+	const auto gamma_rate = v.add_parameter("gamma", gamma);
+	const auto kappa_rate = v.add_parameter("kappa", kappa);
+	const auto tau_rate = v.add_parameter("tau", tau);
+	v.add((S + I) >> beta_rate / N >>= E + I); // susceptible becomes exposed by infectious
+	v.add(E >> alpha_rate >>= I); // exposed becomes infectious
+	v.add(I >> gamma_rate >>= R); // infectious becomes removed
+	v.add(I >> kappa_rate >>= H); // infectious becomes hospitalized
+	v.add(H >> tau_rate >>= R); // hospitalized becomes removed
 	return v;
 }
 
+/* covid19 with the network fixed at compile time, the agents have the same tokens as in covid19 */
+auto covid19_static(size_t N) {
+	const auto eps = 0.0009; // initial fraction of infectious
+	const auto I0 = size_t(std::round(eps * N)); // initial infectious
+	const auto E0 = size_t(std::round(eps * N * 15)); // initial exposed
+	const auto S0 = N - I0 - E0; // initial susceptible
+	const auto R0 = 2.4; // initial basic reproductive number
+	const auto alpha = 1.0 / 5.1; // incubation rate (E -> I) ~5.1 days
+	const auto gamma = 1.0 / 3.1; // recovery rate (I -> R) ~3.1 days
+	const auto beta = R0 * gamma; // infection/generation rate (S+I -> E+I)
+	const auto P_H = 0.9e-3; // probability of hospitalization
+	const auto kappa = gamma * P_H * (1.0 - P_H); // hospitalization rate (I -> H)
+	const auto tau = 1.0 / 10.12; // removal rate in hospital (H -> R) ~10.12 days
+	constexpr auto S = stosim::StaticAgentSet<0>{}; // susceptible
+	constexpr auto E = stosim::StaticAgentSet<1>{}; // exposed
+	constexpr auto I = stosim::StaticAgentSet<2>{}; // infectious
+	constexpr auto H = stosim::StaticAgentSet<3>{}; // hospitalized
+	constexpr auto R = stosim::StaticAgentSet<4>{}; // removed/immune (recovered + dead)
+	return stosim::make_static_vessel("COVID19 SEIHR: " + std::to_string(N),
+		std::array<stosim::agent_count_t, 5>{ S0, E0, I0, 0, 0 },
+		(S + I) >> beta / N >>= E + I, // susceptible becomes exposed by infectious
+		E >> alpha >>= I, // exposed becomes infectious
+		I >> gamma >>= R, // infectious becomes removed
+		I >> kappa >>= H, // infectious becomes hospitalized
+		H >> tau >>= R // hospitalized becomes removed
+	);
+}
+
 stosim::Vessel circadian_rhythm() {
 	using namespace std;
 	const auto alphaA = 50;
@@ -73,6 +111,54 @@ stosim::Vessel circadian_rhythm() {
 	return v;
 }
 
+/* circadian_rhythm with the network fixed at compile time, the agents have the same tokens as in circadian_rhythm */
+auto circadian_rhythm_static() {
+	const auto alphaA = 50;
+	const auto alpha_A = 500;
+	const auto alphaR = 0.01;
+	const auto alpha_R = 50;
+	const auto betaA = 50;
+	const auto betaR = 5;
+	const auto gammaA = 1;
+	const auto gammaR = 1;
+	const auto gammaC = 2;
+	const auto deltaA = 1;
+	const auto deltaR = 0.2;
+	const auto deltaMA = 10;
+	const auto deltaMR = 0.5;
+	const auto thetaA = 50;
+	const auto thetaR = 100;
+	constexpr auto env = stosim::StaticAgentSet<>{};
+	constexpr auto DA = stosim::StaticAgentSet<0>{};
+	constexpr auto D_A = stosim::StaticAgentSet<1>{};
+	constexpr auto DR = stosim::StaticAgentSet<2>{};
+	constexpr auto D_R = stosim::StaticAgentSet<3>{};
+	constexpr auto MA = stosim::StaticAgentSet<4>{};
+	constexpr auto MR = stosim::StaticAgentSet<5>{};
+	constexpr auto A = stosim::StaticAgentSet<6>{};
+	constexpr auto R = stosim::StaticAgentSet<7>{};
+	constexpr auto C = stosim::StaticAgentSet<8>{};
+	return stosim::make_static_vessel("Circadian Rhythm",
+		std::array<stosim::agent_count_t, 9>{ 1, 0, 1, 0, 0, 0, 0, 0, 0 },
+		(A + DA) >> gammaA >>= D_A,
+		D_A >> thetaA >>= DA + A,
+		(A + DR) >> gammaR >>= D_R,
+		D_R >> thetaR >>= DR + A,
+		D_A >> alpha_A >>= MA + D_A,
+		DA >> alphaA >>= MA + DA,
+		D_R >> alpha_R >>= MR + D_R,
+		DR >> alphaR >>= MR + DR,
+		MA >> betaA >>= MA + A,
+		MR >> betaR >>= MR + R,
+		(A + R) >> gammaC >>= C,
+		C >> deltaA >>= R,
+		A >> deltaA >>= env,
+		R >> deltaR >>= env,
+		MA >> deltaMA >>= env,
+		MR >> deltaMR >>= env
+	);
+}
+
 stosim::Vessel figure1() {
 	auto v = stosim::Vessel { "Figure 1" };
 	const auto A = v.add("A", 50);
@@ -80,4 +166,40 @@ stosim::Vessel figure1() {
 	const auto C = v.add("C", 1);
 	v.add((A + C) >> 0.001 >>= B + C);
 	return v;
-}
\ No newline at end of file
+}
+/* A random network for seeing how the engines scale with the shape of a network. Every rule
+   turns its reactants into as many products, so the population stays the same and a simulation
+   never runs out of events. A rule takes its agents from connectivity agents next to each other,
+   so a small connectivity wires the rules to their neighbours like a lattice and connectivity =
+   species wires them at random. How many rules an event touches grows with rules / species.
+   The rates are scaled so a rule of order 2 fires about as often as one of order 1 */
+stosim::Vessel synthetic(size_t species, size_t rules, size_t connectivity, size_t population, std::uint64_t seed = 1) {
+	auto v = stosim::Vessel("Synthetic " + std::to_string(species) + "x" + std::to_string(rules) + "x" + std::to_string(connectivity) + ": " + std::to_string(population));
+	/* Plain modulo instead of a distribution, so the same seed gives the same network with every standard library */
+	auto rng = std::mt19937_64(seed);
+	connectivity = std::clamp<size_t>(connectivity, 1, species);
+
+	std::vector<stosim::AgentSet> agents;
+	for (size_t i = 0; i < species; i++) {
+		agents.push_back(v.add("X" + std::to_string(i), population / species + (i < population % species ? 1 : 0)));
+	}
+	const auto mean_count = std::max(1.0, static_cast<double>(population) / species);
+	auto pick = [&](size_t first) { return agents[(first + rng() % connectivity) % species]; };
+	for (size_t r = 0; r < rules; r++) {
+		const auto first = rng() % species;
+		/* The picks are separate statements, the order of the arguments of a call is up to the compiler */
+		if (rng() % 2 == 0) {
+			const auto reactant = pick(first);
+			const auto product = pick(first);
+			v.add(reactant >> 1.0 >>= product);
+		}
+		else {
+			const auto a = pick(first);
+			const auto b = pick(first);
+			const auto c = pick(first);
+			const auto d = pick(first);
+			v.add((a + b) >> 1.0 / mean_count >>= c + d);
+		}
+	}
+	return v;
+}
@@ -2,8 +2,23 @@
 #include <string>
 #include <algorithm>
 #include <sstream>
+#include <cmath>
+#include <ranges>
+#include <functional>
+#include <atomic>
+#include <stdexcept>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <thread>
 #include "library/SymbolTable.hpp"
 #include "library/stosim.hpp"
+#include "library/IndexedPriorityQueue.hpp"
+#include "library/DependencyGraph.hpp"
+#include "library/StaticVessel.hpp"
+#include "library/LockstepEnsemble.hpp"
+#include "library/Random.hpp"
+#include "library/TrajectoryFile.hpp"
 
 //Requirement 3: Demonstrating the usage of the symbol table
 //Requirement 9: Unit tests for symbol table
@@ -65,6 +80,70 @@ TEST_CASE("symbol table")
 			std::make_pair("baba", 4)
 		});
 	}
+
+	SUBCASE("Store a range") {
+		st.store_range(std::vector<std::pair<std::string, int>>{ { "c", 10 }, { "cc", 11 }, { "ccc", 12 } });
+		CHECK(st.size() == 10);
+		CHECK(st.lookup("cc") == 11);
+		CHECK(st.lookup_by_value(12) == "ccc");
+	}
+
+	SUBCASE("A range with a duplicate stores nothing") {
+		CHECK_THROWS_AS(st.store_range(std::vector<std::pair<std::string, int>>{ { "d", 20 }, { "d", 21 } }), stosim::SymbolAlreadyExistsException);
+		CHECK_THROWS_AS(st.store_range(std::vector<std::pair<std::string, int>>{ { "d", 20 }, { "dd", 20 } }), stosim::SymbolAlreadyExistsException);
+		CHECK_THROWS_AS(st.store_range(std::vector<std::pair<std::string, int>>{ { "d", 20 }, { "ab", 21 } }), stosim::SymbolAlreadyExistsException);
+		CHECK_THROWS_AS(st.store_range(std::vector<std::pair<std::string, int>>{ { "d", 20 }, { "dd", 7 } }), stosim::SymbolAlreadyExistsException);
+		CHECK(st.size() == 7);
+		CHECK(!st.contains("d"));
+		CHECK(!st.contains_value(20));
+	}
+
+	SUBCASE("Many symbols") {
+		auto large = stosim::SymbolTable<std::size_t, std::string>();
+		for (std::size_t i = 0; i < 50000; i++) {
+			large.store(i, "s" + std::to_string(i));
+		}
+		large.store_range(std::views::iota(std::size_t{ 50000 }, std::size_t{ 100000 }) | std::views::transform([](std::size_t i) {
+			return std::pair<std::size_t, std::string>(i, "s" + std::to_string(i));
+		}));
+		CHECK(large.size() == 100000);
+		for (std::size_t i = 0; i < 100000; i += 997) {
+			CHECK(large.lookup(i) == "s" + std::to_string(i));
+			CHECK(large.lookup_by_value("s" + std::to_string(i)) == i);
+		}
+		CHECK_THROWS_AS(large.lookup(100000), stosim::SymbolDoesNotExistException);
+		CHECK_THROWS_AS(large.store(100000, "s5"), stosim::SymbolAlreadyExistsException);
+	}
+
+	SUBCASE("References stay valid") {
+		const auto& name = st.lookup_by_value(7);
+		for (int i = 0; i < 1000; i++) {
+			st.store("x" + std::to_string(i), 1000 + i);
+		}
+		CHECK(name == "ab");
+		CHECK(&name == &st.lookup_by_value(7));
+	}
+}
+
+/* The view of translate_state would outlive a temporary state */
+template<typename V>
+concept TranslatesTemporaries = requires(const V& vessel) {
+	vessel.translate_state(std::vector<stosim::agent_count_t>{ 1, 2 });
+};
+
+TEST_CASE("Vessel agents") {
+	auto vessel = stosim::Vessel("agents");
+	auto a = vessel.add("a", 1);
+	auto more = vessel.add(std::vector<std::pair<std::string, stosim::agent_count_t>>{ { "b", 2 }, { "c", 3 } });
+	REQUIRE(more.size() == 2);
+	CHECK(*std::cbegin(more[1].get_agent_tokens()) == 2);
+	CHECK(vessel.get_initial_state() == std::vector<stosim::agent_count_t>{ 1, 2, 3 });
+	CHECK_THROWS_AS(vessel.add(std::vector<std::pair<std::string, stosim::agent_count_t>>{ { "d", 4 }, { "a", 5 } }), stosim::SymbolAlreadyExistsException);
+	CHECK(vessel.get_initial_state().size() == 3);
+
+	static_assert(!TranslatesTemporaries<stosim::Vessel>);
+	auto translated = vessel.translate_state(vessel.get_initial_state()) | std::ranges::to<std::vector>();
+	CHECK(translated == std::vector<std::pair<std::string_view, stosim::agent_count_t>>{ { "a", 1 }, { "b", 2 }, { "c", 3 } });
 }
 
 TEST_CASE("AgentSet") {
@@ -107,6 +186,23 @@ TEST_CASE("AgentSet") {
 	}
 }
 
+TEST_CASE("AgentSet multiplicities") {
+	auto vessel = stosim::Vessel("vessel test");
+	auto a = vessel.add("a", 1);
+	auto b = vessel.add("b", 1);
+
+	SUBCASE("Adding an agent to itself counts it twice") {
+		auto tokens = (a + a + b).get_agent_tokens();
+		CHECK(tokens.count(a.get_agent_token()) == 2);
+		CHECK(tokens.count(b.get_agent_token()) == 1);
+	}
+
+	SUBCASE("Multiplying is the same as repeated adding") {
+		CHECK((3 * a).get_agent_tokens() == (a + a + a).get_agent_tokens());
+		CHECK((2 * (a + b)).get_agent_tokens() == (a + a + b + b).get_agent_tokens());
+	}
+}
+
 TEST_CASE("AgentSetAndRate") {
 	SUBCASE("AgentSet and rate can be combined") {
 		auto vessel = stosim::Vessel("vessel test");
@@ -194,4 +290,1788 @@ D_R --0.53> D_R + MR
 
 		CHECK(prettyPrinted.str() == expected);
 	}
-}
\ No newline at end of file
+}
+
+TEST_CASE("IndexedPriorityQueue") {
+	auto queue = stosim::IndexedPriorityQueue({ 5.0, 3.0, 8.0, 1.0, 4.0 });
+
+	SUBCASE("Top is the smallest priority") {
+		CHECK(queue.top() == 3);
+		CHECK(queue.top_priority() == 1.0);
+	}
+
+	SUBCASE("Decreasing a priority moves it to the top") {
+		queue.update(2, 0.5);
+		CHECK(queue.top() == 2);
+		CHECK(queue.priority(2) == 0.5);
+	}
+
+	SUBCASE("Increasing the top priority exposes the next smallest") {
+		queue.update(3, 10.0);
+		CHECK(queue.top() == 1);
+		queue.update(1, 10.0);
+		CHECK(queue.top() == 4);
+	}
+}
+
+TEST_CASE("DependencyGraph") {
+	auto v = stosim::Vessel("dependency test");
+	auto A = v.add("A", 1);
+	auto B = v.add("B", 1);
+	auto C = v.add("C", 1);
+
+	v.add((A + C) >> 1.0 >>= B + C);
+	v.add(B >> 1.0 >>= C);
+	v.add(C >> 1.0 >>= v.environment());
+	auto graph = stosim::DependencyGraph(*v.compile());
+
+	SUBCASE("Catalysts do not create dependencies") {
+		//Rule 0 only changes A and B, so C's decay is unaffected
+		CHECK(std::ranges::equal(graph.dependents(0), std::vector<std::size_t>{ 0, 1 }));
+	}
+
+	SUBCASE("Products create dependencies") {
+		CHECK(std::ranges::equal(graph.dependents(1), std::vector<std::size_t>{ 0, 1, 2 }));
+		CHECK(std::ranges::equal(graph.dependents(2), std::vector<std::size_t>{ 0, 2 }));
+	}
+}
+
+const auto exact_algorithms = {
+	stosim::SimulationAlgorithm::first_reaction,
+	stosim::SimulationAlgorithm::next_reaction,
+	stosim::SimulationAlgorithm::direct,
+	stosim::SimulationAlgorithm::composition_rejection
+};
+
+//Figure 1 always ends with every A converted to B, no matter which algorithm is used
+TEST_CASE("Simulation algorithms run figure 1 to completion") {
+	auto v = stosim::Vessel("Figure 1");
+	const auto A = v.add("A", 50);
+	const auto B = v.add("B", 50);
+	const auto C = v.add("C", 1);
+	v.add((A + C) >> 0.001 >>= B + C);
+
+	for (auto algorithm : exact_algorithms) {
+		std::size_t steps = 0;
+		double last_time = 0;
+		bool time_is_monotonic = true;
+		std::vector<stosim::agent_count_t> last_state;
+		for (const auto& state : v.simulate(algorithm)) {
+			time_is_monotonic = time_is_monotonic && state.time >= last_time;
+			last_time = state.time;
+			last_state = state.agent_count;
+			steps++;
+		}
+		CHECK(time_is_monotonic);
+		CHECK(steps == 51);
+		CHECK(last_state == std::vector<stosim::agent_count_t>{ 0, 100, 1 });
+	}
+}
+
+//A -> env with rate 1 leaves 1000 * e^-1 agents on average at time 1, the standard deviation over
+//200 runs is around 1.1 so the tolerance should never be hit by a correct algorithm
+TEST_CASE("Simulation algorithms agree on the mean of a decay") {
+	auto v = stosim::Vessel("decay");
+	const auto A = v.add("A", 1000);
+	v.add(A >> 1.0 >>= v.environment());
+
+	for (auto algorithm : exact_algorithms) {
+		const auto runs = 200;
+		double total = 0;
+		for (auto i = 0; i < runs; i++) {
+			stosim::agent_count_t at_time_one = 0;
+			for (const auto& state : v.simulate(algorithm)) {
+				if (state.time > 1) {
+					break;
+				}
+				at_time_one = state.agent_count[0];
+			}
+			total += at_time_one;
+		}
+		CHECK(std::abs(total / runs - 1000 * std::exp(-1.0)) < 6);
+	}
+}
+
+//The catalyst A never changes, so the three rules keep firing with probabilities 1/16, 3/16 and 12/16.
+//The rates fall in different power of two groups, which exercises the composition-rejection groups
+TEST_CASE("Simulation algorithms pick rules in proportion to their propensities") {
+	auto v = stosim::Vessel("proportions");
+	const auto A = v.add("A", 1);
+	const auto B1 = v.add("B1", 0);
+	const auto B2 = v.add("B2", 0);
+	const auto B3 = v.add("B3", 0);
+	v.add(A >> 1.0 >>= A + B1);
+	v.add(A >> 3.0 >>= A + B2);
+	v.add(A >> 12.0 >>= A + B3);
+
+	for (auto algorithm : exact_algorithms) {
+		const auto events = 16000;
+		std::vector<stosim::agent_count_t> last_state;
+		for (const auto& state : v.simulate(algorithm) | std::views::take(events + 1)) {
+			last_state = state.agent_count;
+		}
+		CHECK(std::abs(last_state[1] / (double)events - 1.0 / 16) < 0.01);
+		CHECK(std::abs(last_state[2] / (double)events - 3.0 / 16) < 0.02);
+		CHECK(std::abs(last_state[3] / (double)events - 12.0 / 16) < 0.02);
+	}
+}
+
+TEST_CASE("Tau leaping") {
+	SUBCASE("Figure 1 runs to completion since the catalyst makes every rule critical") {
+		auto v = stosim::Vessel("Figure 1");
+		const auto A = v.add("A", 50);
+		const auto B = v.add("B", 50);
+		const auto C = v.add("C", 1);
+		v.add((A + C) >> 0.001 >>= B + C);
+
+		std::vector<stosim::agent_count_t> last_state;
+		for (const auto& state : v.simulate(stosim::SimulationAlgorithm::tau_leaping)) {
+			last_state = state.agent_count;
+		}
+		CHECK(last_state == std::vector<stosim::agent_count_t>{ 0, 100, 1 });
+	}
+
+	SUBCASE("Leaps conserve the population and never go negative") {
+		auto v = stosim::Vessel("SEIR");
+		const auto S = v.add("S", 99000);
+		const auto E = v.add("E", 0);
+		const auto I = v.add("I", 1000);
+		const auto R = v.add("R", 0);
+		v.add((S + I) >> 3.0 / 100000 >>= E + I);
+		v.add(E >> 2.0 >>= I);
+		v.add(I >> 1.0 >>= R);
+
+		bool conserved = true;
+		std::size_t steps = 0;
+		for (const auto& state : v.simulate(stosim::SimulationAlgorithm::tau_leaping)
+			| std::views::take_while([](const auto& state) { return state.time < 10; })) {
+			conserved = conserved && std::ranges::fold_left(state.agent_count, (stosim::agent_count_t)0, std::plus<>{}) == 100000;
+			steps++;
+		}
+		CHECK(conserved);
+		//An exact simulation fires more than 100000 events in this time
+		CHECK(steps < 20000);
+	}
+
+	SUBCASE("The mean of a decay is close to the exact mean") {
+		auto v = stosim::Vessel("decay");
+		const auto A = v.add("A", 1000);
+		v.add(A >> 1.0 >>= v.environment());
+
+		const auto runs = 200;
+		double total = 0;
+		for (auto i = 0; i < runs; i++) {
+			stosim::agent_count_t at_time_one = 0;
+			for (const auto& state : v.simulate(stosim::SimulationAlgorithm::tau_leaping)) {
+				if (state.time > 1) {
+					break;
+				}
+				at_time_one = state.agent_count[0];
+			}
+			total += at_time_one;
+		}
+		//Leaps overshoot time 1 by up to one step, which biases the result upwards by a few agents
+		CHECK(std::abs(total / runs - 1000 * std::exp(-1.0)) < 20);
+	}
+}
+
+TEST_CASE("Hybrid") {
+	SUBCASE("Small populations are simulated exactly") {
+		auto v = stosim::Vessel("Figure 1");
+		const auto A = v.add("A", 50);
+		const auto B = v.add("B", 50);
+		const auto C = v.add("C", 1);
+		v.add((A + C) >> 0.001 >>= B + C);
+
+		std::size_t steps = 0;
+		std::vector<stosim::agent_count_t> last_state;
+		for (const auto& state : v.simulate(stosim::SimulationAlgorithm::hybrid)) {
+			last_state = state.agent_count;
+			steps++;
+		}
+		CHECK(steps == 51);
+		CHECK(last_state == std::vector<stosim::agent_count_t>{ 0, 100, 1 });
+	}
+
+	//A decays deterministically while B is produced by a slow rule, so B at time 1 is Poisson
+	//distributed with mean 10^-4 * 10^5 * (1 - e^-1)
+	SUBCASE("Slow agents keep the statistics of exact simulation") {
+		auto v = stosim::Vessel("hybrid decay");
+		const auto A = v.add("A", 100000);
+		const auto B = v.add("B", 0);
+		v.add(A >> 1.0 >>= v.environment());
+		v.add(A >> 0.0001 >>= A + B);
+
+		const auto runs = 200;
+		double total_a = 0;
+		double total_b = 0;
+		std::size_t total_steps = 0;
+		for (auto i = 0; i < runs; i++) {
+			std::vector<stosim::agent_count_t> at_time_one;
+			for (const auto& state : v.simulate(stosim::SimulationAlgorithm::hybrid)) {
+				if (state.time > 1) {
+					break;
+				}
+				at_time_one = state.agent_count;
+				total_steps++;
+			}
+			total_a += at_time_one[0];
+			total_b += at_time_one[1];
+		}
+		CHECK(std::abs(total_a / runs - 100000 * std::exp(-1.0)) < 100000 * std::exp(-1.0) * 0.02);
+		CHECK(std::abs(total_b / runs - 10 * (1 - std::exp(-1.0))) < 1);
+		//Exact simulation would take more than 60000 steps per run
+		CHECK(total_steps / runs < 1000);
+	}
+}
+
+TEST_CASE("CompiledNetwork") {
+	auto v = stosim::Vessel("compiled network test");
+	const auto A = v.add("A", 10);
+	const auto B = v.add("B", 4);
+	const auto C = v.add("C", 0);
+	v.add((A + B) >> 2.0 >>= C + B);
+	v.add(2 * A >> 0.5 >>= A);
+	v.add(C >> 1.0 >>= v.environment());
+	const auto network = v.compile();
+
+	SUBCASE("Rules are stored with their reactants and net changes") {
+		CHECK(network->rule_count() == 3);
+		CHECK(network->agent_type_count() == 3);
+		CHECK(std::ranges::equal(network->reactant_tokens(0), std::vector<stosim::agent_token_t>{ 0, 1 }));
+		CHECK(std::ranges::equal(network->change_tokens(0), std::vector<stosim::agent_token_t>{ 0, 2 }));
+		CHECK(std::ranges::equal(network->change_amounts(0), std::vector<std::int64_t>{ -1, 1 }));
+		CHECK(std::ranges::equal(network->reactant_multiplicities(1), std::vector<stosim::agent_count_t>{ 2 }));
+		CHECK(std::ranges::equal(network->change_amounts(1), std::vector<std::int64_t>{ -1 }));
+		CHECK(network->change_tokens(2).size() == 1);
+		CHECK(network->order(1) == 2);
+	}
+
+	SUBCASE("Propensities count distinct combinations of reactants") {
+		const auto state = v.get_initial_state();
+		CHECK(network->propensity(0, state) == 2.0 * 10 * 4);
+		//10 choose 2 pairs of A
+		CHECK(network->propensity(1, state) == 0.5 * 45);
+		CHECK(network->propensity(2, state) == 0);
+		CHECK(network->propensity(1, std::vector<stosim::agent_count_t>{ 1, 0, 0 }) == 0);
+	}
+
+	SUBCASE("Applying a rule uses the net changes") {
+		auto state = v.get_initial_state();
+		network->apply(1, state);
+		CHECK(state == std::vector<stosim::agent_count_t>{ 9, 4, 0 });
+		network->apply(0, state);
+		CHECK(state == std::vector<stosim::agent_count_t>{ 8, 4, 1 });
+	}
+
+	SUBCASE("Adding a rule discards the compiled network") {
+		v.add(B >> 1.0 >>= C);
+		CHECK(v.compile()->rule_count() == 4);
+		CHECK(network->rule_count() == 3);
+	}
+}
+
+//Dimerization removes A two at a time, so an odd number of A always ends with one left over
+TEST_CASE("Simulation algorithms handle stoichiometric coefficients") {
+	auto v = stosim::Vessel("dimerization");
+	const auto A = v.add("A", 101);
+	const auto D = v.add("D", 0);
+	v.add(2 * A >> 0.01 >>= D);
+
+	for (auto algorithm : exact_algorithms) {
+		std::vector<stosim::agent_count_t> last_state;
+		for (const auto& state : v.simulate(algorithm)) {
+			last_state = state.agent_count;
+		}
+		//Pairs are formed until a single A is left
+		CHECK(last_state == std::vector<stosim::agent_count_t>{ 1, 50 });
+	}
+}
+
+TEST_CASE("StaticVessel") {
+	constexpr auto A = stosim::StaticAgentSet<0>{};
+	constexpr auto B = stosim::StaticAgentSet<1>{};
+	constexpr auto C = stosim::StaticAgentSet<2>{};
+
+	SUBCASE("Rules have their structure in the type") {
+		auto rule = (A + A + C) >> 0.5 >>= B + C;
+		using rule_t = decltype(rule);
+		CHECK(rule.rate == 0.5);
+		CHECK(rule_t::reactants::stoichiometry.size() == 2);
+		CHECK(rule_t::reactants::count(0) == 2);
+		CHECK(rule_t::changes.size() == 2);
+		CHECK(rule_t::changes[0].token == 0);
+		CHECK(rule_t::changes[0].amount == -2);
+		CHECK(rule_t::changes[1].token == 1);
+		CHECK(rule_t::changes[1].amount == 1);
+		static_assert(rule_t::uses_tokens_below(3));
+		static_assert(!rule_t::uses_tokens_below(2));
+	}
+
+	SUBCASE("Static and dynamic propensities agree") {
+		auto static_rule = (A + A + B) >> 1.0 >>= C;
+		auto v = stosim::Vessel("propensity");
+		auto a = v.add("A", 7);
+		auto b = v.add("B", 3);
+		auto c = v.add("C", 0);
+		v.add((a + a + b) >> 1.0 >>= c);
+		CHECK(decltype(static_rule)::reactants::combinations(std::array<stosim::agent_count_t, 3>{ 7, 3, 0 }) == v.compile()->propensity(0, v.get_initial_state()));
+	}
+
+	SUBCASE("Figure 1 runs to completion") {
+		auto v = stosim::make_static_vessel("Figure 1", std::array<stosim::agent_count_t, 3>{ 50, 50, 1 },
+			(A + C) >> 0.001 >>= B + C);
+		std::size_t steps = 0;
+		std::array<stosim::agent_count_t, 3> last_state{};
+		for (const auto& state : v.simulate()) {
+			last_state = state.agent_count;
+			steps++;
+		}
+		CHECK(steps == 51);
+		CHECK(last_state == std::array<stosim::agent_count_t, 3>{ 0, 100, 1 });
+	}
+
+	SUBCASE("Static vessels work with multi_simulate") {
+		auto v = stosim::make_static_vessel("decay", std::array<stosim::agent_count_t, 1>{ 1000 },
+			A >> 1.0 >>= stosim::StaticAgentSet<>{});
+		auto results = v.multi_simulate(50, [](auto simulation) {
+			stosim::agent_count_t at_time_one = 0;
+			for (const auto& state : simulation) {
+				if (state.time > 1) {
+					break;
+				}
+				at_time_one = state.agent_count[0];
+			}
+			return (double)at_time_one;
+		});
+		auto mean = std::ranges::fold_left(results, 0.0, std::plus<>{}) / 50;
+		CHECK(std::abs(mean - 1000 * std::exp(-1.0)) < 10);
+	}
+}
+
+TEST_CASE("LockstepEnsemble") {
+	SUBCASE("Figure 1 runs to completion in every lane") {
+		auto v = stosim::Vessel("Figure 1");
+		auto A = v.add("A", 50);
+		auto B = v.add("B", 50);
+		auto C = v.add("C", 1);
+		v.add((A + C) >> 0.001 >>= B + C);
+		auto ensemble = stosim::LockstepEnsemble<4>(*v.compile(), v.get_initial_state());
+
+		std::vector<std::size_t> steps(11, 0);
+		std::vector<std::vector<stosim::agent_count_t>> last_state(11);
+		ensemble.run(11, 42, std::numeric_limits<double>::infinity(), [&](std::size_t replica, double, const auto& counts) {
+			steps[replica]++;
+			last_state[replica] = { counts[0], counts[1], counts[2] };
+		});
+		for (std::size_t i = 0; i < 11; i++) {
+			CHECK(steps[i] == 51);
+			CHECK(last_state[i] == std::vector<stosim::agent_count_t>{ 0, 100, 1 });
+		}
+	}
+
+	SUBCASE("Decay has the expected mean") {
+		auto v = stosim::Vessel("decay");
+		auto A = v.add("A", 1000);
+		v.add(A >> 1.0 >>= stosim::AgentSet());
+		auto ensemble = stosim::LockstepEnsemble<8>(*v.compile(), v.get_initial_state());
+
+		std::vector<stosim::agent_count_t> at_time_one(200, 0);
+		ensemble.run(200, 7, 1.0, [&](std::size_t replica, double, const auto& counts) {
+			at_time_one[replica] = counts[0];
+		});
+		auto mean = std::ranges::fold_left(at_time_one, 0.0, std::plus<>{}) / 200;
+		CHECK(std::abs(mean - 1000 * std::exp(-1.0)) < 6);
+	}
+
+	SUBCASE("Replicas are reproducible from the seed") {
+		auto v = stosim::Vessel("decay");
+		auto A = v.add("A", 100);
+		v.add(A >> 1.0 >>= stosim::AgentSet());
+		auto ensemble = stosim::LockstepEnsemble<8>(*v.compile(), v.get_initial_state());
+
+		auto run = [&](std::uint64_t seed) {
+			std::vector<double> end_times(20, 0);
+			ensemble.run(20, seed, std::numeric_limits<double>::infinity(), [&](std::size_t replica, double time, const auto&) {
+				end_times[replica] = time;
+			});
+			return end_times;
+		};
+		CHECK(run(1) == run(1));
+		CHECK(run(1) != run(2));
+	}
+}
+
+TEST_CASE("multi_simulate") {
+	auto v = stosim::Vessel("decay");
+	auto A = v.add("A", 10);
+	v.add(A >> 1.0 >>= stosim::AgentSet());
+	v.compile();
+	auto pool = stosim::WorkStealingPool(3);
+	auto final_count = [](auto simulation) {
+		stosim::agent_count_t last = 0;
+		for (const auto& state : simulation) {
+			last = state.agent_count[0];
+		}
+		return last;
+	};
+
+	SUBCASE("Every simulation yields one result") {
+		std::size_t results = 0;
+		for (auto count : v.multi_simulate(1000, final_count, stosim::SimulationAlgorithm::direct, { .chunk_size = 7, .max_buffered_results = 4, .pool = &pool })) {
+			CHECK(count == 0);
+			results++;
+		}
+		CHECK(results == 1000);
+	}
+
+	SUBCASE("Stopping early skips the remaining simulations") {
+		std::atomic<std::size_t> started = 0;
+		auto counting = [&](auto simulation) {
+			started++;
+			return final_count(std::move(simulation));
+		};
+		{
+			auto results = v.multi_simulate(100000, counting, stosim::SimulationAlgorithm::direct, { .chunk_size = 1, .max_buffered_results = 1, .pool = &pool });
+			std::size_t taken = 0;
+			for ([[maybe_unused]] auto count : results) {
+				if (++taken == 10) {
+					break;
+				}
+			}
+		}
+		CHECK(started < 100);
+	}
+
+	SUBCASE("A stop token ends the results") {
+		std::stop_source stop;
+		std::size_t results = 0;
+		for ([[maybe_unused]] auto count : v.multi_simulate(100000, final_count, stosim::SimulationAlgorithm::direct, { .chunk_size = 1, .max_buffered_results = 1, .stop_token = stop.get_token(), .pool = &pool })) {
+			if (++results == 5) {
+				stop.request_stop();
+			}
+		}
+		CHECK(results == 5);
+	}
+
+	SUBCASE("Exceptions reach the consumer") {
+		auto throwing = [](auto) -> int {
+			throw std::runtime_error("simulation failed");
+		};
+		auto results = v.multi_simulate(100, throwing, stosim::SimulationAlgorithm::direct, { .pool = &pool });
+		CHECK_THROWS_AS(std::ranges::for_each(results, [](int) {}), std::runtime_error);
+	}
+
+	SUBCASE("An ensemble can run inside the loop of another on the same pool") {
+		/* The outer ensemble must not hold both threads while its results wait for the loop */
+		auto small = stosim::WorkStealingPool(2);
+		auto extinction = stosim::FirstPassageStatistics(A.get_agent_token(), 0, stosim::FirstPassageStatistics::Direction::downward);
+		std::size_t results = 0;
+		for (auto count : v.multi_simulate(40, final_count, stosim::SimulationAlgorithm::direct, { .chunk_size = 1, .max_buffered_results = 2, .pool = &small })) {
+			CHECK(count == 0);
+			auto inner = v.reduce(20, extinction, {}, stosim::SimulationAlgorithm::direct, { .pool = &small });
+			CHECK(inner.time().count() == 20);
+			results++;
+		}
+		CHECK(results == 40);
+	}
+}
+
+TEST_CASE("Random streams") {
+	SUBCASE("Philox4x32 matches the known answers") {
+		CHECK(stosim::Philox4x32::generate({ 0, 0, 0, 0 }, { 0, 0 }) == std::array<std::uint32_t, 4>{ 0x6627E8D5, 0xE169C58D, 0xBC57AC4C, 0x9B00DBD8 });
+		CHECK(stosim::Philox4x32::generate({ 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF }, { 0xFFFFFFFF, 0xFFFFFFFF }) == std::array<std::uint32_t, 4>{ 0x408F276D, 0x41C83B0E, 0xA20BC7C6, 0x6D5451FD });
+	}
+
+	SUBCASE("Philox4x32 discards in constant time") {
+		auto a = stosim::Philox4x32(1, 2);
+		auto b = stosim::Philox4x32(1, 2);
+		for (int i = 0; i < 7; i++) {
+			a();
+		}
+		b.discard(3);
+		b.discard(4);
+		CHECK(a == b);
+		CHECK(a() == b());
+	}
+
+	SUBCASE("Xoshiro256PlusPlus streams are jumps") {
+		auto a = stosim::Xoshiro256PlusPlus(5, 0);
+		a.jump();
+		a.jump();
+		CHECK(a == stosim::Xoshiro256PlusPlus(5, 2));
+	}
+
+	auto v = stosim::Vessel("decay");
+	auto A = v.add("A", 20);
+	v.add(A >> 1.0 >>= stosim::AgentSet());
+	v.compile();
+	auto trajectory = [](auto simulation) {
+		std::vector<double> times;
+		for (const auto& state : simulation) {
+			times.push_back(state.time);
+		}
+		return times;
+	};
+
+	SUBCASE("A seed and stream give the same trajectory") {
+		for (auto algorithm : exact_algorithms) {
+			CHECK(trajectory(v.simulate(42, algorithm)) == trajectory(v.simulate(42, algorithm)));
+			CHECK(trajectory(v.simulate(42, algorithm)) != trajectory(v.simulate(42, algorithm, 1)));
+			CHECK(trajectory(v.simulate<stosim::Xoshiro256PlusPlus>(42, algorithm)) == trajectory(v.simulate<stosim::Xoshiro256PlusPlus>(42, algorithm)));
+		}
+	}
+
+	SUBCASE("Seeded ensembles are bit identical for any number of threads") {
+		auto run = [&](std::size_t thread_count) {
+			auto pool = stosim::WorkStealingPool(thread_count);
+			std::vector<std::vector<double>> results;
+			for (auto times : v.multi_simulate(200, trajectory, stosim::SimulationAlgorithm::direct, { .chunk_size = 3, .pool = &pool, .seed = 7 })) {
+				results.push_back(std::move(times));
+			}
+			/* The results come in completion order */
+			std::ranges::sort(results);
+			return results;
+		};
+		auto single = run(1);
+		CHECK(single.size() == 200);
+		CHECK(run(2) == single);
+		CHECK(run(5) == single);
+	}
+}
+
+TEST_CASE("Time grid sampling") {
+	auto v = stosim::Vessel("SEIR");
+	auto S = v.add("S", 200);
+	auto E = v.add("E", 0);
+	auto I = v.add("I", 5);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.005 >>= E + I);
+	v.add(E >> 0.5 >>= I);
+	v.add(I >> 0.2 >>= R);
+	v.compile();
+	auto grid = stosim::TimeGrid{ .step = 0.5, .end = 60 };
+	CHECK(grid.size() == 121);
+
+	auto algorithms = std::vector(exact_algorithms);
+	algorithms.push_back(stosim::SimulationAlgorithm::tau_leaping);
+	algorithms.push_back(stosim::SimulationAlgorithm::hybrid);
+	for (auto algorithm : algorithms) {
+		/* The last state at or before every point of the same trajectory */
+		std::vector<std::vector<stosim::agent_count_t>> expected(grid.size());
+		std::size_t point = 0;
+		std::vector<stosim::agent_count_t> previous;
+		for (const auto& state : v.simulate(11, algorithm)) {
+			for (; point < grid.size() && grid[point] < state.time; point++) {
+				expected[point] = previous;
+			}
+			previous = state.agent_count;
+		}
+		for (; point < grid.size(); point++) {
+			expected[point] = previous;
+		}
+
+		std::size_t i = 0;
+		for (const auto& state : stosim::sample(v.start(11, algorithm), grid)) {
+			REQUIRE(i < grid.size());
+			CHECK(state.time == grid[i]);
+			CHECK(state.agent_count == expected[i]);
+			i++;
+		}
+		CHECK(i == grid.size());
+	}
+
+	/* The generator only runs, and so only checks its grid, once it is iterated */
+	auto first_sample = [&](stosim::TimeGrid bad) {
+		for (const auto& state : stosim::sample(v.start(11, stosim::SimulationAlgorithm::direct), bad)) {
+			return state.time;
+		}
+		return 0.0;
+	};
+	for (auto bad : { stosim::TimeGrid{ .step = 0, .end = 10 }, stosim::TimeGrid{ .step = -1, .end = 10 }, stosim::TimeGrid{ .step = 1, .end = -1 },
+			stosim::TimeGrid{ .step = 1, .end = std::numeric_limits<double>::infinity() }, stosim::TimeGrid{ .step = std::numeric_limits<double>::quiet_NaN(), .end = 10 } }) {
+		CHECK_FALSE(bad.valid());
+		CHECK_THROWS_AS(first_sample(bad), stosim::InvalidTimeGridException);
+		CHECK_THROWS_AS(stosim::TimeBinnedStatistics(bad, { S.get_agent_token() }), stosim::InvalidTimeGridException);
+	}
+	CHECK(stosim::TimeGrid{ .step = 1, .end = 0 }.valid());
+}
+
+TEST_CASE("Stop conditions") {
+	auto v = stosim::Vessel("SEIR");
+	auto S = v.add("S", 200);
+	auto E = v.add("E", 0);
+	auto I = v.add("I", 5);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.005 >>= E + I);
+	v.add(E >> 0.5 >>= I);
+	v.add(I >> 0.2 >>= R);
+	v.compile();
+
+	SUBCASE("The time horizon gives the same trajectory as take_while") {
+		for (auto algorithm : exact_algorithms) {
+			std::vector<std::vector<stosim::agent_count_t>> expected;
+			for (const auto& state : v.simulate(3, algorithm) | std::views::take_while([](const auto& state) { return state.time < 20; })) {
+				expected.push_back(state.agent_count);
+			}
+			std::vector<std::vector<stosim::agent_count_t>> stopped;
+			for (const auto& state : stosim::trajectory(v.start(3, algorithm), { .time_horizon = 20 })) {
+				stopped.push_back(state.agent_count);
+			}
+			CHECK(stopped == expected);
+
+			auto simulation = v.start(3, algorithm);
+			CHECK(simulation.run({ .time_horizon = 20 }) == stosim::StopReason::time_horizon);
+			CHECK(simulation.state().time == 20);
+			CHECK(simulation.state().agent_count == expected.back());
+			CHECK(simulation.events() == expected.size() - 1);
+		}
+	}
+
+	SUBCASE("A simulation continues past a time horizon") {
+		for (auto algorithm : { stosim::SimulationAlgorithm::direct, stosim::SimulationAlgorithm::tau_leaping }) {
+			auto simulation = v.start(5, algorithm);
+			CHECK(simulation.run({ .time_horizon = 5 }) == stosim::StopReason::time_horizon);
+			CHECK(simulation.state().time == 5);
+			CHECK(simulation.run({}) == stosim::StopReason::exhausted);
+			CHECK(simulation.state().time > 5);
+			CHECK(simulation.state().agent_count[E.get_agent_token()] == 0);
+			CHECK(simulation.state().agent_count[I.get_agent_token()] == 0);
+		}
+	}
+
+	SUBCASE("The event budget") {
+		auto simulation = v.start(5, stosim::SimulationAlgorithm::next_reaction);
+		CHECK(simulation.run({ .event_budget = 17 }) == stosim::StopReason::event_budget);
+		CHECK(simulation.events() == 17);
+	}
+
+	SUBCASE("A species threshold") {
+		auto simulation = v.start(5, stosim::SimulationAlgorithm::direct);
+		CHECK(simulation.run({ .threshold = stosim::SpeciesThreshold{ .token = R.get_agent_token(), .high = 50 } }) == stosim::StopReason::threshold);
+		CHECK(simulation.state().agent_count[R.get_agent_token()] == 51);
+	}
+
+	SUBCASE("A predicate") {
+		auto simulation = v.start(5, stosim::SimulationAlgorithm::direct);
+		auto reason = simulation.run({ .predicate = [&](const stosim::VesselState& state) {
+			return state.agent_count[I.get_agent_token()] >= 20;
+		} });
+		CHECK(reason == stosim::StopReason::predicate);
+		CHECK(simulation.state().agent_count[I.get_agent_token()] == 20);
+	}
+
+	SUBCASE("Running out of events") {
+		auto simulation = v.start(5, stosim::SimulationAlgorithm::first_reaction);
+		CHECK(simulation.run({}) == stosim::StopReason::exhausted);
+	}
+}
+
+TEST_CASE("Observers and batches") {
+	auto v = stosim::Vessel("SEIR");
+	auto S = v.add("S", 200);
+	auto E = v.add("E", 0);
+	auto I = v.add("I", 5);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.005 >>= E + I);
+	v.add(E >> 0.5 >>= I);
+	v.add(I >> 0.2 >>= R);
+	v.compile();
+
+	std::vector<stosim::VesselState> expected;
+	for (const auto& state : v.simulate(9, stosim::SimulationAlgorithm::direct)) {
+		expected.push_back(state);
+	}
+
+	SUBCASE("The observer sees every event") {
+		std::vector<stosim::VesselState> observed = { expected.front() };
+		auto simulation = v.start(9, stosim::SimulationAlgorithm::direct);
+		auto reason = simulation.run({}, [&](const stosim::VesselState& state, std::size_t rule_index) {
+			CHECK(rule_index < 3);
+			observed.push_back(state);
+		});
+		CHECK(reason == stosim::StopReason::exhausted);
+		REQUIRE(observed.size() == expected.size());
+		for (std::size_t i = 0; i < observed.size(); i++) {
+			CHECK(observed[i].time == expected[i].time);
+			CHECK(observed[i].agent_count == expected[i].agent_count);
+		}
+	}
+
+	SUBCASE("Batches replay to the same trajectory") {
+		auto state = expected.front();
+		std::size_t i = 1;
+		std::size_t batch_count = 0;
+		for (auto batch : stosim::batches(v.start(9, stosim::SimulationAlgorithm::direct), 64)) {
+			CHECK(batch.size() <= 64);
+			batch_count++;
+			for (const auto& record : batch) {
+				v.compile()->apply(record.rule_index, state.agent_count);
+				REQUIRE(i < expected.size());
+				CHECK(record.time == expected[i].time);
+				CHECK(state.agent_count == expected[i].agent_count);
+				i++;
+			}
+		}
+		CHECK(i == expected.size());
+		CHECK(batch_count == (expected.size() - 1 + 63) / 64);
+	}
+
+	SUBCASE("Vessel shortcuts") {
+		auto f = stosim::Vessel("Figure 1");
+		auto A = f.add("A", 50);
+		auto B = f.add("B", 50);
+		auto C = f.add("C", 1);
+		f.add((A + C) >> 0.001 >>= B + C);
+		std::size_t events = 0;
+		CHECK(f.simulate_with([&](const auto&, std::size_t) { events++; }) == stosim::StopReason::exhausted);
+		CHECK(events == 50);
+
+		std::size_t records = 0;
+		for (auto batch : f.simulate_batched(16, { .event_budget = 20 })) {
+			records += batch.size();
+		}
+		CHECK(records == 20);
+	}
+}
+
+TEST_CASE("Reducers") {
+	SUBCASE("Merged running statistics equal sequential ones") {
+		stosim::RunningStatistics all, first, second;
+		for (int i = 0; i < 100; i++) {
+			auto x = std::sin(i) * 10 + i;
+			all.add(x);
+			(i < 37 ? first : second).add(x);
+		}
+		first.merge(second);
+		CHECK(first.count() == 100);
+		CHECK(first.mean() == doctest::Approx(all.mean()));
+		CHECK(first.variance() == doctest::Approx(all.variance()));
+		CHECK(first.min() == all.min());
+		CHECK(first.max() == all.max());
+	}
+
+	SUBCASE("Merged quantile digests") {
+		auto rng = stosim::Philox4x32(1);
+		auto uniform = std::uniform_real_distribution(0.0, 1.0);
+		std::vector<stosim::QuantileDigest> digests(4);
+		for (int i = 0; i < 100000; i++) {
+			digests[i % 4].add(uniform(rng));
+		}
+		for (std::size_t i = 1; i < digests.size(); i++) {
+			digests[0].merge(digests[i]);
+		}
+		CHECK(digests[0].count() == 100000);
+		CHECK(std::abs(digests[0].quantile(0.5) - 0.5) < 0.01);
+		CHECK(std::abs(digests[0].quantile(0.99) - 0.99) < 0.002);
+		CHECK(std::abs(digests[0].quantile(0.001) - 0.001) < 0.001);
+	}
+
+	SUBCASE("Reading a quantile does not change the digest") {
+		auto digest = stosim::QuantileDigest();
+		for (int i = 0; i < 50; i++) {
+			digest.add(i);
+		}
+		const auto& reader = digest;
+		auto median = reader.quantile(0.5);
+		std::vector<std::thread> threads;
+		std::atomic<int> different = 0;
+		for (int t = 0; t < 4; t++) {
+			threads.emplace_back([&]() {
+				for (int i = 0; i < 100; i++) {
+					different += reader.quantile(0.5) != median;
+				}
+			});
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		CHECK(different == 0);
+		CHECK(median == doctest::Approx(24.5));
+	}
+
+	SUBCASE("Histogram") {
+		auto histogram = stosim::Histogram(0, 10, 5);
+		for (auto x : { -1.0, 0.0, 1.9, 2.0, 9.99, 10.0 }) {
+			histogram.add(x);
+		}
+		CHECK(histogram.underflow() == 1);
+		CHECK(histogram.overflow() == 1);
+		CHECK(histogram.count(0) == 2);
+		CHECK(histogram.count(1) == 1);
+		CHECK(histogram.count(4) == 1);
+		CHECK(histogram.bin_low(1) == 2);
+		CHECK(histogram.total() == 6);
+		CHECK_THROWS_AS(histogram.merge(stosim::Histogram(0, 10, 4)), stosim::ReducerMismatchException);
+		CHECK_THROWS_AS(histogram.merge(stosim::Histogram(0, 20, 5)), stosim::ReducerMismatchException);
+	}
+
+	SUBCASE("Time binned statistics only merge with the same grid and agents") {
+		auto binned = stosim::TimeBinnedStatistics(stosim::TimeGrid{ .step = 1, .end = 10 }, { 0, 1 });
+		CHECK_NOTHROW(binned.merge(stosim::TimeBinnedStatistics(stosim::TimeGrid{ .step = 1, .end = 10 }, { 0, 1 })));
+		CHECK_THROWS_AS(binned.merge(stosim::TimeBinnedStatistics(stosim::TimeGrid{ .step = 1, .end = 20 }, { 0, 1 })), stosim::ReducerMismatchException);
+		CHECK_THROWS_AS(binned.merge(stosim::TimeBinnedStatistics(stosim::TimeGrid{ .step = 0.5, .end = 10 }, { 0, 1 })), stosim::ReducerMismatchException);
+		CHECK_THROWS_AS(binned.merge(stosim::TimeBinnedStatistics(stosim::TimeGrid{ .step = 1, .end = 10 }, { 1, 0 })), stosim::ReducerMismatchException);
+		CHECK_THROWS_AS(binned.merge(stosim::TimeBinnedStatistics(stosim::TimeGrid{ .step = 1, .end = 10 }, { 0 })), stosim::ReducerMismatchException);
+	}
+
+	auto v = stosim::Vessel("SEIR");
+	auto S = v.add("S", 200);
+	auto E = v.add("E", 0);
+	auto I = v.add("I", 5);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.005 >>= E + I);
+	v.add(E >> 0.5 >>= I);
+	v.add(I >> 0.2 >>= R);
+	v.compile();
+	auto pool = stosim::WorkStealingPool(3);
+	auto options = stosim::EnsembleOptions{ .chunk_size = 4, .pool = &pool, .seed = 21 };
+	const std::size_t count = 50;
+
+	SUBCASE("Time binned statistics agree with sampled trajectories") {
+		auto grid = stosim::TimeGrid{ .step = 1, .end = 40 };
+		auto result = v.reduce(count, stosim::TimeBinnedStatistics(grid, { I.get_agent_token(), R.get_agent_token() }), { .time_horizon = 30 }, stosim::SimulationAlgorithm::direct, options);
+
+		std::vector<stosim::RunningStatistics> expected(grid.size());
+		for (std::size_t i = 0; i < count; i++) {
+			for (const auto& state : stosim::sample(v.start(21, stosim::SimulationAlgorithm::direct, i), grid)) {
+				if (state.time <= 30) {
+					expected[static_cast<std::size_t>(state.time)].add(static_cast<double>(state.agent_count[R.get_agent_token()]));
+				}
+			}
+		}
+		for (std::size_t point = 0; point < grid.size(); point++) {
+			CHECK(result.at(point, 1).count() == expected[point].count());
+			CHECK(result.at(point, 1).mean() == doctest::Approx(expected[point].mean()));
+			CHECK(result.at(point, 1).variance() == doctest::Approx(expected[point].variance()));
+		}
+		CHECK(result.at(0, 0).mean() == 5);
+		CHECK(result.at(31, 0).count() == 0);
+	}
+
+	SUBCASE("Peaks and first passages agree with the trajectories") {
+		auto result = v.reduce(count, stosim::combine(
+			stosim::PeakStatistics(I.get_agent_token(), stosim::Histogram(0, 200, 20)),
+			stosim::FirstPassageStatistics(I.get_agent_token(), 0, stosim::FirstPassageStatistics::Direction::downward)
+		), {}, stosim::SimulationAlgorithm::direct, options);
+		const auto& [peaks, extinction] = result.reducers;
+
+		stosim::RunningStatistics expected_peaks, expected_extinction;
+		for (std::size_t i = 0; i < count; i++) {
+			stosim::agent_count_t peak = 0;
+			double end = 0;
+			for (const auto& state : v.simulate(21, stosim::SimulationAlgorithm::direct, i)) {
+				peak = std::max(peak, state.agent_count[I.get_agent_token()]);
+				end = state.time;
+			}
+			expected_peaks.add(static_cast<double>(peak));
+			expected_extinction.add(end);
+		}
+		CHECK(peaks.value().count() == count);
+		CHECK(peaks.value().mean() == doctest::Approx(expected_peaks.mean()));
+		CHECK(peaks.value().max() == expected_peaks.max());
+		CHECK(peaks.histogram().total() == count);
+		CHECK(peaks.quantiles().quantile(0) == expected_peaks.min());
+		CHECK(extinction.never_reached() == 0);
+		CHECK(extinction.time().mean() == doctest::Approx(expected_extinction.mean()));
+	}
+}
+
+TEST_CASE("Adaptive ensembles") {
+	auto v = stosim::Vessel("decay");
+	auto A = v.add("A", 10);
+	v.add(A >> 1.0 >>= stosim::AgentSet());
+	v.compile();
+	auto pool = stosim::WorkStealingPool(2);
+	auto extinction = stosim::FirstPassageStatistics(A.get_agent_token(), 0, stosim::FirstPassageStatistics::Direction::downward);
+	auto monitor = [](const stosim::FirstPassageStatistics& reducer) { return std::vector{ reducer.time() }; };
+	/* The extinction time is a sum of exponentials with rates 10, 9, ..., 1 */
+	double expected_mean = 0;
+	for (int k = 1; k <= 10; k++) {
+		expected_mean += 1.0 / k;
+	}
+
+	SUBCASE("Stops when the confidence interval is narrow enough") {
+		auto precision = stosim::Precision{ .relative_half_width = 0.02 };
+		auto result = v.reduce_until(extinction, monitor, precision, {}, stosim::SimulationAlgorithm::direct, {}, { .pool = &pool, .seed = 3 });
+		CHECK(result.converged);
+		CHECK(result.simulation_count == result.reducer.time().count());
+		CHECK(precision.half_width(result.statistics[0]) <= 0.02 * result.statistics[0].mean());
+		/* About (1.96 * 1.25 / (0.02 * 2.93))^2 = 1750 simulations are needed, and a wave at most doubles the count */
+		CHECK(result.simulation_count > 1000);
+		CHECK(result.simulation_count < 4000);
+		CHECK(std::abs(result.statistics[0].mean() - expected_mean) < 4 * result.statistics[0].standard_error());
+	}
+
+	SUBCASE("Stops at the standard error") {
+		auto result = v.reduce_until(extinction, monitor, { .standard_error = 0.1 }, {}, stosim::SimulationAlgorithm::direct, {}, { .pool = &pool, .seed = 3 });
+		CHECK(result.converged);
+		CHECK(result.statistics[0].standard_error() <= 0.1);
+		/* (1.25 / 0.1)^2 = 156 */
+		CHECK(result.simulation_count > 100);
+		CHECK(result.simulation_count < 400);
+	}
+
+	SUBCASE("Gives up at the maximum") {
+		auto result = v.reduce_until(extinction, monitor, { .relative_half_width = 1e-6 }, {}, stosim::SimulationAlgorithm::direct, { .max_simulations = 500 }, { .pool = &pool, .seed = 3 });
+		CHECK(!result.converged);
+		CHECK(result.simulation_count == 500);
+	}
+}
+
+TEST_CASE("Trajectory files") {
+	auto v = stosim::Vessel("SEIR");
+	auto S = v.add("S", 200);
+	auto E = v.add("E", 0);
+	auto I = v.add("I", 5);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.005 >>= E + I);
+	v.add(E >> 0.5 >>= I);
+	v.add(I >> 0.2 >>= R);
+	v.compile();
+
+	std::vector<stosim::VesselState> expected;
+	for (const auto& state : v.simulate(13, stosim::SimulationAlgorithm::direct)) {
+		expected.push_back(state);
+	}
+	REQUIRE(expected.size() > 100);
+
+	auto path = std::filesystem::temp_directory_path() / "stosim_unit_tests.stj";
+	{
+		auto writer = stosim::TrajectoryWriter(path, v, 64);
+		for (const auto& state : expected) {
+			writer.write(state);
+		}
+	}
+
+	auto reader = stosim::TrajectoryReader(path);
+	CHECK(reader.species_names() == std::vector<std::string>{ "S", "E", "I", "R" });
+	CHECK(reader.event_count() == expected.size());
+	CHECK(reader.chunk_count() == (expected.size() + 63) / 64);
+
+	SUBCASE("Every state is read back") {
+		std::size_t i = 0;
+		for (const auto& state : reader.states()) {
+			REQUIRE(i < expected.size());
+			CHECK(state.time == expected[i].time);
+			CHECK(state.agent_count == expected[i].agent_count);
+			i++;
+		}
+		CHECK(i == expected.size());
+	}
+
+	SUBCASE("A time range") {
+		auto from = expected[expected.size() / 3].time;
+		auto to = expected[2 * expected.size() / 3].time;
+		std::size_t i = expected.size() / 3;
+		for (const auto& state : reader.states(from, to)) {
+			REQUIRE(i <= 2 * expected.size() / 3);
+			CHECK(state.time == expected[i].time);
+			CHECK(state.agent_count == expected[i].agent_count);
+			i++;
+		}
+		CHECK(i == 2 * expected.size() / 3 + 1);
+	}
+
+	SUBCASE("A single agent") {
+		std::size_t i = 0;
+		for (const auto& count : reader.counts(I.get_agent_token())) {
+			REQUIRE(i < expected.size());
+			CHECK(count.time == expected[i].time);
+			CHECK(count.count == expected[i].agent_count[I.get_agent_token()]);
+			i++;
+		}
+		CHECK(i == expected.size());
+		CHECK_THROWS_AS(reader.counts(4).begin(), stosim::TrajectoryFileException);
+	}
+
+	SUBCASE("The writer observes a simulation") {
+		auto observed = std::filesystem::temp_directory_path() / "stosim_unit_tests_observed.stj";
+		{
+			auto writer = stosim::TrajectoryWriter(observed, v);
+			auto simulation = v.start(13, stosim::SimulationAlgorithm::direct);
+			writer.write(simulation.state());
+			simulation.run({}, writer);
+		}
+		auto observed_reader = stosim::TrajectoryReader(observed);
+		CHECK(observed_reader.chunk_count() == 1);
+		std::size_t i = 0;
+		for (const auto& state : observed_reader.states()) {
+			REQUIRE(i < expected.size());
+			CHECK(state.agent_count == expected[i].agent_count);
+			i++;
+		}
+		CHECK(i == expected.size());
+	}
+
+	SUBCASE("An incomplete file is rejected") {
+		auto truncated = std::filesystem::temp_directory_path() / "stosim_unit_tests_truncated.stj";
+		std::filesystem::copy_file(path, truncated, std::filesystem::copy_options::overwrite_existing);
+		std::filesystem::resize_file(truncated, std::filesystem::file_size(truncated) - 4);
+		CHECK_THROWS_AS(stosim::TrajectoryReader(truncated), stosim::TrajectoryFileException);
+	}
+
+	SUBCASE("A file with a broken index is rejected") {
+		/* The footer is the index offset, the chunk count, the event count and the magic, an
+		   entry of the index is the offset, the first event and the event count of a chunk
+		   followed by two times */
+		auto broken = std::filesystem::temp_directory_path() / "stosim_unit_tests_broken.stj";
+		auto size = std::filesystem::file_size(path);
+		auto footer = size - 3 * sizeof(std::uint64_t) - 8;
+		std::uint64_t index_offset;
+		{
+			std::ifstream in(path, std::ios::binary);
+			in.seekg(static_cast<std::streamoff>(footer));
+			in.read(reinterpret_cast<char*>(&index_offset), sizeof(index_offset));
+		}
+		auto patched = [&](std::uint64_t position, std::uint64_t value) {
+			std::filesystem::copy_file(path, broken, std::filesystem::copy_options::overwrite_existing);
+			std::fstream file(broken, std::ios::binary | std::ios::in | std::ios::out);
+			file.seekp(static_cast<std::streamoff>(position));
+			file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+			file.close();
+			return broken;
+		};
+		CHECK_THROWS_AS(stosim::TrajectoryReader(patched(footer, size - 4)), stosim::TrajectoryFileException);
+		CHECK_THROWS_AS(stosim::TrajectoryReader(patched(footer + sizeof(std::uint64_t), 1'000'000)), stosim::TrajectoryFileException);
+		CHECK_THROWS_AS(stosim::TrajectoryReader(patched(index_offset, index_offset)), stosim::TrajectoryFileException);
+		auto huge_chunk = stosim::TrajectoryReader(patched(index_offset + 2 * sizeof(std::uint64_t), std::uint64_t{ 1 } << 60));
+		CHECK_THROWS_AS(huge_chunk.states().begin(), stosim::TrajectoryFileException);
+	}
+}
+
+TEST_CASE("Event logs") {
+	auto v = stosim::Vessel("SEIR");
+	auto S = v.add("S", 200);
+	auto E = v.add("E", 0);
+	auto I = v.add("I", 5);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.005 >>= E + I);
+	v.add(E >> 0.5 >>= I);
+	v.add(I >> 0.2 >>= R);
+	v.compile();
+
+	/* Fast exchanges between A and B that the hybrid engine integrates, next to a slow rule */
+	auto exchange = stosim::Vessel("exchange");
+	auto A = exchange.add("A", 100000);
+	auto B = exchange.add("B", 100000);
+	auto C = exchange.add("C", 0);
+	exchange.add(A >> 1.0 >>= B);
+	exchange.add(B >> 1.0 >>= A);
+	exchange.add(A >> 0.00001 >>= C);
+	exchange.compile();
+
+	struct Recording {
+		stosim::SimulationAlgorithm algorithm;
+		std::vector<stosim::VesselState> expected;
+		stosim::EventLog log;
+	};
+	auto record = [](const stosim::Vessel& vessel, stosim::SimulationAlgorithm algorithm, const stosim::StopCondition& stop) {
+		auto simulation = vessel.start(17, algorithm);
+		std::vector<stosim::VesselState> expected{ simulation.state() };
+		auto log = stosim::EventLog(simulation, 16);
+		simulation.run(stop, [&](const stosim::VesselState& state, std::size_t rule_index) {
+			expected.push_back(state);
+			log.record(state, rule_index);
+		});
+		return Recording{ .algorithm = algorithm, .expected = std::move(expected), .log = std::move(log) };
+	};
+	std::vector<Recording> recordings;
+	for (auto algorithm : { stosim::SimulationAlgorithm::direct, stosim::SimulationAlgorithm::tau_leaping, stosim::SimulationAlgorithm::hybrid }) {
+		recordings.push_back(record(v, algorithm, {}));
+	}
+	recordings.push_back(record(exchange, stosim::SimulationAlgorithm::hybrid, { .event_budget = 3000 }));
+
+	SUBCASE("The whole trajectory is replayed") {
+		for (const auto& [algorithm, expected, log] : recordings) {
+			CAPTURE(algorithm);
+			REQUIRE(expected.size() > 20);
+			CHECK(log.event_count() == expected.size() - 1);
+			CHECK(log.keyframe_count() >= 1 + (expected.size() - 1) / 16);
+			std::size_t i = 0;
+			for (const auto& state : log.replay()) {
+				REQUIRE(i < expected.size());
+				CHECK(state.time == expected[i].time);
+				CHECK(state.agent_count == expected[i].agent_count);
+				i++;
+			}
+			CHECK(i == expected.size());
+		}
+	}
+
+	SUBCASE("A time range is replayed from the keyframe before it") {
+		for (const auto& [algorithm, expected, log] : recordings) {
+			CAPTURE(algorithm);
+			auto first = expected.size() / 3;
+			auto last = 2 * expected.size() / 3;
+			std::size_t i = first;
+			for (const auto& state : log.replay(expected[first].time, expected[last].time)) {
+				REQUIRE(i <= last);
+				CHECK(state.time == expected[i].time);
+				CHECK(state.agent_count == expected[i].agent_count);
+				i++;
+			}
+			CHECK(i == last + 1);
+		}
+	}
+
+	SUBCASE("Single states") {
+		for (const auto& [algorithm, expected, log] : recordings) {
+			CAPTURE(algorithm);
+			for (std::size_t i = 0; i < expected.size(); i += 7) {
+				CHECK(log.state_at_event(i).agent_count == expected[i].agent_count);
+				CHECK(log.state_at(expected[i].time).agent_count == expected[i].agent_count);
+			}
+			CHECK(log.state_at(-1).agent_count == expected.front().agent_count);
+			CHECK(log.state_at(expected.back().time + 1).agent_count == expected.back().agent_count);
+		}
+	}
+
+	SUBCASE("A simulation that runs out is recorded to its end") {
+		auto simulation = v.start(17, stosim::SimulationAlgorithm::direct);
+		auto log = stosim::EventLog(simulation, 16);
+		CHECK(simulation.run({}, log) == stosim::StopReason::exhausted);
+		CHECK(log.event_count() == simulation.events());
+	}
+
+	SUBCASE("An event takes far less than a state") {
+		auto log = v.record({}, stosim::SimulationAlgorithm::direct, 1 << 20);
+		CHECK(log.memory_size() < log.event_count() * (sizeof(double) + 4 * sizeof(stosim::agent_count_t)) / 2);
+	}
+}
+
+TEST_CASE("Checkpoints") {
+	auto v = stosim::Vessel("SEIR");
+	auto S = v.add("S", 5000);
+	auto E = v.add("E", 0);
+	auto I = v.add("I", 1500);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.00005 >>= E + I);
+	v.add(E >> 0.5 >>= I);
+	v.add(I >> 0.2 >>= R);
+	v.compile();
+
+	auto algorithms = {
+		stosim::SimulationAlgorithm::first_reaction, stosim::SimulationAlgorithm::next_reaction, stosim::SimulationAlgorithm::direct,
+		stosim::SimulationAlgorithm::composition_rejection, stosim::SimulationAlgorithm::tau_leaping, stosim::SimulationAlgorithm::hybrid
+	};
+
+	SUBCASE("A restored simulation continues exactly like the one that was saved") {
+		for (auto algorithm : algorithms) {
+			CAPTURE(algorithm);
+			auto simulation = v.start(3, algorithm);
+			simulation.run({ .event_budget = 200 });
+			std::stringstream checkpoint;
+			simulation.save(checkpoint);
+
+			auto restored = stosim::Simulation<>::load(checkpoint, simulation.shared_network());
+			CHECK(restored.algorithm() == algorithm);
+			CHECK(restored.events() == simulation.events());
+			CHECK(restored.state().time == simulation.state().time);
+			CHECK(restored.state().agent_count == simulation.state().agent_count);
+
+			auto copy = simulation;
+			for (int i = 0; i < 200; i++) {
+				auto fired = simulation.step();
+				REQUIRE(restored.step() == fired);
+				REQUIRE(copy.step() == fired);
+				REQUIRE(restored.state().time == simulation.state().time);
+				REQUIRE(restored.state().agent_count == simulation.state().agent_count);
+				REQUIRE(copy.state().agent_count == simulation.state().agent_count);
+			}
+		}
+	}
+
+	SUBCASE("Xoshiro256PlusPlus can be saved as well") {
+		auto simulation = v.start<stosim::Xoshiro256PlusPlus>(3, stosim::SimulationAlgorithm::next_reaction);
+		simulation.run({ .event_budget = 50 });
+		std::stringstream checkpoint;
+		simulation.save(checkpoint);
+		auto restored = stosim::Simulation<stosim::Xoshiro256PlusPlus>::load(checkpoint, simulation.shared_network());
+		simulation.run({ .event_budget = 100 });
+		restored.run({ .event_budget = 100 });
+		CHECK(restored.state().time == simulation.state().time);
+		CHECK(restored.state().agent_count == simulation.state().agent_count);
+	}
+
+	SUBCASE("Broken checkpoints are rejected") {
+		auto simulation = v.start(3, stosim::SimulationAlgorithm::direct);
+		std::stringstream checkpoint;
+		simulation.save(checkpoint);
+		auto bytes = checkpoint.str();
+
+		auto truncated = std::stringstream(bytes.substr(0, bytes.size() - 3));
+		CHECK_THROWS_AS(stosim::Simulation<>::load(truncated, simulation.shared_network()), stosim::CheckpointException);
+		auto garbage = std::stringstream("not a checkpoint");
+		CHECK_THROWS_AS(stosim::Simulation<>::load(garbage, simulation.shared_network()), stosim::CheckpointException);
+
+		auto other = stosim::Vessel("other");
+		auto A = other.add("A", 1);
+		other.add(A >> 1.0 >>= A + A);
+		auto other_simulation = other.start(1);
+		auto mismatched = std::stringstream(bytes);
+		CHECK_THROWS_AS(stosim::Simulation<>::load(mismatched, other_simulation.shared_network()), stosim::CheckpointException);
+	}
+
+	SUBCASE("Checkpoints with broken engine caches are rejected") {
+		auto load = [&](const std::string& bytes) {
+			auto in = std::stringstream(bytes);
+			return stosim::Simulation<>::load(in, v.compile());
+		};
+		auto set_u64 = [](std::string& bytes, std::size_t offset, std::uint64_t value) {
+			std::memcpy(bytes.data() + offset, &value, sizeof(value));
+		};
+
+		/* The queue of the next reaction method ends the checkpoint with the position of every rule in the heap */
+		auto next_reaction = v.start(3, stosim::SimulationAlgorithm::next_reaction);
+		next_reaction.run({ .event_budget = 200 });
+		std::stringstream checkpoint;
+		next_reaction.save(checkpoint);
+		auto bytes = checkpoint.str();
+		CHECK_NOTHROW(load(bytes));
+		auto outside = bytes;
+		set_u64(outside, outside.size() - 24, 7);
+		CHECK_THROWS_AS(load(outside), stosim::CheckpointException);
+		auto repeated = bytes;
+		std::memcpy(repeated.data() + repeated.size() - 24, repeated.data() + repeated.size() - 16, sizeof(std::uint64_t));
+		CHECK_THROWS_AS(load(repeated), stosim::CheckpointException);
+
+		/* The last group of the composition-rejection method is for propensities beyond any double, so it is
+		   always empty and ends the checkpoint as its length and its total. Here it claims the first rule */
+		auto composition_rejection = v.start(3, stosim::SimulationAlgorithm::composition_rejection);
+		composition_rejection.run({ .event_budget = 200 });
+		checkpoint = std::stringstream();
+		composition_rejection.save(checkpoint);
+		bytes = checkpoint.str();
+		CHECK_NOTHROW(load(bytes));
+		auto claimed = bytes;
+		claimed.insert(claimed.size() - 8, std::string(8, '\0'));
+		set_u64(claimed, claimed.size() - 24, 1);
+		CHECK_THROWS_AS(load(claimed), stosim::CheckpointException);
+		auto cut = bytes.substr(0, bytes.size() - 8);
+		CHECK_THROWS_AS(load(cut), stosim::CheckpointException);
+	}
+
+	SUBCASE("Forks start from the snapshot and continue independently") {
+		for (auto algorithm : algorithms) {
+			CAPTURE(algorithm);
+			auto simulation = v.start(3, algorithm);
+			simulation.run({ .event_budget = 100 });
+			auto forks = simulation.fork(4, 11);
+			REQUIRE(forks.size() == 4);
+			for (auto& fork : forks) {
+				CHECK(fork.state().time == simulation.state().time);
+				CHECK(fork.state().agent_count == simulation.state().agent_count);
+				CHECK(fork.events() == simulation.events());
+				fork.run({ .event_budget = 150 });
+			}
+			CHECK(forks[0].state().time != forks[1].state().time);
+			CHECK(forks[2].state().time != forks[3].state().time);
+
+			/* The same seed and stream give the same continuation */
+			auto again = simulation.fork(stosim::Philox4x32(11, 1));
+			again.run({ .event_budget = 150 });
+			CHECK(again.state().time == forks[1].state().time);
+			CHECK(again.state().agent_count == forks[1].state().agent_count);
+		}
+	}
+
+	SUBCASE("An ensemble runs from a snapshot") {
+		auto burn_in = v.start(3, stosim::SimulationAlgorithm::direct);
+		burn_in.run({ .time_horizon = 1 });
+		auto peak = stosim::PeakStatistics(I.get_agent_token());
+		auto options = stosim::EnsembleOptions{ .seed = 5 };
+		auto from_snapshot = v.reduce_from(burn_in, 20, peak, { .time_horizon = 5 }, options);
+		CHECK(from_snapshot.value().count() == 20);
+		CHECK(from_snapshot.value().mean() >= burn_in.state().agent_count[I.get_agent_token()]);
+		CHECK(from_snapshot.time().mean() >= 1);
+
+		auto repeated = v.reduce_from(burn_in, 20, peak, { .time_horizon = 5 }, options);
+		CHECK(repeated.value().mean() == doctest::Approx(from_snapshot.value().mean()));
+	}
+}
+
+TEST_CASE("Parameter sweeps") {
+	SUBCASE("Rates are products of parameters") {
+		auto v = stosim::Vessel("rates");
+		auto beta = v.add_parameter("beta", 0.3);
+		auto gamma = v.add_parameter("gamma", 0.25);
+		CHECK((beta / 1000).value() == 0.3 / 1000);
+		CHECK((beta * gamma).value() == 0.3 * 0.25);
+		CHECK((2 * beta / gamma).value() == doctest::Approx(2 * 0.3 / 0.25));
+		CHECK((beta / gamma).value(std::vector{ 1.0, 4.0 }) == 0.25);
+		CHECK(stosim::Rate(7).value() == 7);
+	}
+
+	SUBCASE("Names are unique between parameters and agents") {
+		auto v = stosim::Vessel("names");
+		auto A = v.add("A", 1);
+		v.add_parameter("k", 1);
+		CHECK_THROWS_AS(v.add_parameter("A", 1), stosim::SymbolAlreadyExistsException);
+		CHECK_THROWS_AS(v.add_parameter("k", 1), stosim::SymbolAlreadyExistsException);
+		CHECK_THROWS_AS(v.add("k", 1), stosim::SymbolAlreadyExistsException);
+
+		auto other = stosim::Vessel("other");
+		other.add_parameter("a", 1);
+		auto foreign = other.add_parameter("b", 1);
+		CHECK_THROWS_AS(v.add(A >> foreign >>= A + A), stosim::SymbolDoesNotExistException);
+	}
+
+	SUBCASE("A network with other parameters only has other rates") {
+		auto v = stosim::Vessel("network");
+		auto A = v.add("A", 10);
+		auto k = v.add_parameter("k", 2);
+		v.add(A >> k >>= A + A);
+		v.add(A >> 0.5 * k >>= stosim::AgentSet());
+		const auto network = v.compile();
+		CHECK(network->rate(0) == 2);
+		CHECK(network->rate(1) == 1);
+		auto changed = network->with_parameters(std::vector{ 4.0 });
+		CHECK(changed.rate(0) == 4);
+		CHECK(changed.rate(1) == 2);
+		CHECK(changed.reactant_tokens(0).data() == network->reactant_tokens(0).data());
+		CHECK(changed.propensity(0, { 10 }) == 40);
+	}
+
+	SUBCASE("Designs") {
+		auto grid = stosim::SweepDesign::grid({ { "a", { 1, 2 } }, { "b", { 10, 20, 30 } } });
+		CHECK(grid.size() == 6);
+		CHECK(grid.names() == std::vector<std::string>{ "a", "b" });
+		CHECK(std::ranges::equal(grid.point(0), std::vector{ 1.0, 10.0 }));
+		CHECK(std::ranges::equal(grid.point(4), std::vector{ 2.0, 20.0 }));
+
+		auto hypercube = stosim::SweepDesign::latin_hypercube({ { "a", 0, 1 }, { "b", -10, 10 } }, 50, 3);
+		CHECK(hypercube.size() == 50);
+		for (std::size_t d = 0; d < 2; d++) {
+			std::vector<int> strata(50);
+			for (std::size_t i = 0; i < 50; i++) {
+				auto fraction = d == 0 ? hypercube.point(i)[0] : (hypercube.point(i)[1] + 10) / 20;
+				strata[static_cast<std::size_t>(fraction * 50)]++;
+			}
+			CHECK(std::ranges::all_of(strata, [](int count) { return count == 1; }));
+		}
+		auto again = stosim::SweepDesign::latin_hypercube({ { "a", 0, 1 }, { "b", -10, 10 } }, 50, 3);
+		CHECK(std::ranges::equal(again.point(17), hypercube.point(17)));
+	}
+
+	SUBCASE("A sweep runs every point with the same streams as a vessel built for it") {
+		auto decay = [](double rate, stosim::agent_count_t count) {
+			auto v = stosim::Vessel("decay");
+			auto A = v.add("A", count);
+			auto k = v.add_parameter("k", rate);
+			v.add(A >> k >>= stosim::AgentSet());
+			return v;
+		};
+		auto v = decay(1, 10);
+		auto extinction = stosim::FirstPassageStatistics(0, 0, stosim::FirstPassageStatistics::Direction::downward);
+		auto design = stosim::SweepDesign::grid({ { "k", { 0.5, 1, 2 } }, { "A", { 10, 40 } } });
+		auto pool = stosim::WorkStealingPool(3);
+		auto result = v.sweep(design, 200, extinction, {}, stosim::SimulationAlgorithm::direct, { .chunk_size = 7, .pool = &pool, .seed = 9 });
+		REQUIRE(result.results.size() == 6);
+		for (std::size_t i = 0; i < 6; i++) {
+			auto point = design.point(i);
+			CAPTURE(i);
+			CHECK(result.results[i].time().count() == 200);
+			auto expected = decay(point[0], static_cast<stosim::agent_count_t>(point[1])).reduce(200, extinction, {}, stosim::SimulationAlgorithm::direct, { .seed = 9 });
+			CHECK(result.results[i].time().mean() == doctest::Approx(expected.time().mean()));
+		}
+		CHECK(result.results[0].time().mean() > result.results[2].time().mean());
+		CHECK(result.results[2].time().mean() > result.results[4].time().mean());
+		CHECK(result.results[0].time().mean() < result.results[1].time().mean());
+
+		auto repeated = v.sweep(design, 200, extinction, {}, stosim::SimulationAlgorithm::direct, { .chunk_size = 7, .seed = 9 });
+		CHECK(repeated.results[3].time().mean() == result.results[3].time().mean());
+
+		std::stringstream csv;
+		result.write_csv(csv, { { "mean_extinction", [](const stosim::FirstPassageStatistics& r) { return r.time().mean(); } } });
+		std::string header;
+		std::getline(csv, header);
+		CHECK(header == "k,A,mean_extinction");
+		CHECK(std::ranges::count(csv.str(), '\n') == 7);
+
+		CHECK_THROWS_AS(v.sweep(stosim::SweepDesign::grid({ { "unknown", { 1 } } }), 1, extinction), stosim::SymbolDoesNotExistException);
+	}
+}
+
+/* Records the final time, and ends the process of a worker without a result where the test asks for it */
+/* Removes the file however the test that made it ends */
+struct RemovedFile {
+	std::filesystem::path path;
+
+	~RemovedFile() {
+		std::error_code ignored;
+		std::filesystem::remove(path, ignored);
+	}
+};
+
+struct ExitingReducer {
+	stosim::RunningStatistics time;
+	/* Exits if this file can be removed, so only the first worker that gets here exits */
+	std::string marker;
+	bool always = false;
+
+	void start(const stosim::VesselState&) {}
+	void event(const stosim::VesselState&) {}
+	void finish(const stosim::VesselState& state, stosim::StopReason) {
+		if (always || (!marker.empty() && std::filesystem::remove(marker))) {
+			std::_Exit(3);
+		}
+		time.add(state.time);
+	}
+	void merge(const ExitingReducer& other) {
+		time.merge(other.time);
+	}
+	template<typename Archive>
+	void checkpoint(Archive& archive) {
+		archive(time);
+	}
+};
+
+TEST_CASE("Sharded ensembles") {
+	auto v = stosim::Vessel("SIR");
+	auto S = v.add("S", 200);
+	auto I = v.add("I", 5);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.002 >>= I + I);
+	v.add(I >> 0.1 >>= R);
+	v.compile();
+	auto peak = stosim::PeakStatistics(I.get_agent_token(), stosim::Histogram(0, 200, 20));
+	auto same_bins = [](const stosim::Histogram& a, const stosim::Histogram& b) {
+		for (std::size_t bin = 0; bin < a.bin_count(); bin++) {
+			if (a.count(bin) != b.count(bin)) {
+				return false;
+			}
+		}
+		return a.bin_count() == b.bin_count() && a.underflow() == b.underflow() && a.overflow() == b.overflow();
+	};
+
+	SUBCASE("A reducer survives its checkpoint") {
+		auto reducer = v.reduce(30, peak, {}, stosim::SimulationAlgorithm::direct, { .seed = 4 });
+		stosim::CheckpointWriter writer;
+		reducer.checkpoint(writer);
+		auto restored = peak;
+		stosim::CheckpointReader reader(writer.bytes());
+		restored.checkpoint(reader);
+		CHECK(reader.remaining() == 0);
+		CHECK(restored.value().count() == 30);
+		CHECK(restored.value().mean() == reducer.value().mean());
+		CHECK(restored.value().max() == reducer.value().max());
+		CHECK(restored.quantiles().quantile(0.5) == reducer.quantiles().quantile(0.5));
+		CHECK(same_bins(restored.histogram(), reducer.histogram()));
+	}
+
+#ifndef _WIN32
+	SUBCASE("Workers give the same result as threads") {
+		auto threaded = v.reduce(120, peak, {}, stosim::SimulationAlgorithm::direct, { .chunk_size = 10, .seed = 8 });
+		auto sharded = v.reduce_sharded(120, peak, {}, stosim::SimulationAlgorithm::direct, { .process_count = 3, .chunk_size = 10, .seed = 8 });
+		CHECK(sharded.statistics.processes_started == 3);
+		CHECK(sharded.statistics.worker_failures == 0);
+		CHECK(sharded.statistics.chunks == 12);
+		CHECK(sharded.statistics.bytes > 0);
+		CHECK(sharded.reducer.value().count() == 120);
+		CHECK(sharded.reducer.value().mean() == doctest::Approx(threaded.value().mean()));
+		CHECK(sharded.reducer.value().max() == threaded.value().max());
+		CHECK(same_bins(sharded.reducer.histogram(), threaded.histogram()));
+	}
+
+	SUBCASE("A worker that exits is replaced") {
+		/* Unique, so test runs at the same time each have their own */
+		auto marker = RemovedFile{ std::filesystem::temp_directory_path() / ("stosim_sharding_marker_" + std::to_string(stosim::random_seed())) };
+		{
+			std::ofstream file(marker.path);
+		}
+		auto reducer = ExitingReducer{ .marker = marker.path.string() };
+		auto sharded = v.reduce_sharded(40, reducer, {}, stosim::SimulationAlgorithm::direct, { .process_count = 2, .chunk_size = 4, .seed = 8 });
+		CHECK_FALSE(std::filesystem::exists(marker.path));
+		CHECK(sharded.statistics.worker_failures == 1);
+		CHECK(sharded.statistics.processes_started == 3);
+		CHECK(sharded.reducer.time.count() == 40);
+
+		auto expected = v.reduce(40, ExitingReducer{}, {}, stosim::SimulationAlgorithm::direct, { .seed = 8 });
+		CHECK(sharded.reducer.time.mean() == doctest::Approx(expected.time.mean()));
+	}
+
+	SUBCASE("A shard that fails every time fails the run") {
+		auto reducer = ExitingReducer{ .always = true };
+		CHECK_THROWS_AS(v.reduce_sharded(10, reducer, {}, stosim::SimulationAlgorithm::direct, { .process_count = 2, .max_attempts = 2, .seed = 1 }), stosim::ShardingException);
+	}
+
+	SUBCASE("A result larger than the limit fails the worker") {
+		CHECK_THROWS_AS(v.reduce_sharded(10, peak, {}, stosim::SimulationAlgorithm::direct, { .process_count = 2, .max_attempts = 2, .max_result_bytes = 16, .seed = 1 }), stosim::ShardingException);
+		auto sharded = v.reduce_sharded(10, peak, {}, stosim::SimulationAlgorithm::direct, { .process_count = 2, .max_result_bytes = 1 << 16, .seed = 1 });
+		CHECK(sharded.statistics.worker_failures == 0);
+		CHECK(sharded.reducer.value().count() == 10);
+	}
+#endif
+}
+
+/* The events of a simulation once it is done, and a stop for another one if stop_other is given */
+coro::task<std::size_t> events_when_done(coro::task<stosim::AsyncRun<>> run, std::stop_source stop_other = std::stop_source(std::nostopstate)) {
+	auto done = co_await std::move(run);
+	stop_other.request_stop();
+	co_return done.simulation.events();
+}
+
+coro::task<std::vector<std::size_t>> all_events(std::vector<coro::task<std::size_t>> runs) {
+	auto finished = co_await coro::when_all(std::move(runs));
+	std::vector<std::size_t> rv;
+	for (auto& run : finished) {
+		rv.push_back(run.return_value());
+	}
+	co_return rv;
+}
+
+TEST_CASE("Asynchronous simulations") {
+	auto v = stosim::Vessel("SIR");
+	auto S = v.add("S", 200);
+	auto I = v.add("I", 3);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.002 >>= I + I);
+	v.add(I >> 0.3 >>= R);
+	v.compile();
+	auto pool = coro::thread_pool(coro::thread_pool::options{ .thread_count = 2 });
+
+	SUBCASE("A task runs the same simulation as start") {
+		auto run = coro::sync_wait(v.simulate_async(pool, 5, { .time_horizon = 20 }, stosim::SimulationAlgorithm::direct, 2, { .yield_interval = 7 }));
+		auto simulation = v.start(5, stosim::SimulationAlgorithm::direct, 2);
+		auto reason = simulation.run({ .time_horizon = 20 });
+		REQUIRE(run.reason.has_value());
+		CHECK(run.reason.value() == reason);
+		CHECK(run.simulation.events() == simulation.events());
+		CHECK(run.simulation.state().time == simulation.state().time);
+		CHECK(run.simulation.state().agent_count == simulation.state().agent_count);
+	}
+
+	SUBCASE("An ensemble runs the simulations of reduce") {
+		auto peak = stosim::PeakStatistics(I.get_agent_token());
+		auto result = coro::sync_wait(v.reduce_async(pool, 90, peak, {}, stosim::SimulationAlgorithm::direct, { .yield_interval = 16, .chunk_size = 8, .seed = 3 }));
+		auto expected = v.reduce(90, peak, {}, stosim::SimulationAlgorithm::direct, { .chunk_size = 8, .seed = 3 });
+		CHECK(result.simulation_count == 90);
+		CHECK_FALSE(result.stopped);
+		CHECK(result.reducer.value().count() == 90);
+		CHECK(result.reducer.value().mean() == doctest::Approx(expected.value().mean()));
+		CHECK(result.reducer.time().mean() == doctest::Approx(expected.time().mean()));
+		CHECK(result.reducer.value().max() == expected.value().max());
+
+		auto single = coro::thread_pool(coro::thread_pool::options{ .thread_count = 1 });
+		auto repeated = coro::sync_wait(v.reduce_async(single, 90, peak, {}, stosim::SimulationAlgorithm::direct, { .chunk_size = 8, .seed = 3 }));
+		CHECK(repeated.reducer.time().mean() == result.reducer.time().mean());
+	}
+
+	SUBCASE("A stopped ensemble says how much of it ran") {
+		auto peak = stosim::PeakStatistics(I.get_agent_token());
+		std::stop_source stop;
+		stop.request_stop();
+		auto result = coro::sync_wait(v.reduce_async(pool, 40, peak, {}, stosim::SimulationAlgorithm::direct, { .chunk_size = 8, .stop_token = stop.get_token(), .seed = 3 }));
+		CHECK(result.stopped);
+		CHECK(result.simulation_count == 0);
+		CHECK(result.reducer.value().count() == 0);
+	}
+
+	SUBCASE("Long simulations yield to short ones") {
+		/* A network that never runs out of events, on a single thread that only gets to the
+		   short simulation if the long one yields */
+		auto flip = stosim::Vessel("flip");
+		auto A = flip.add("A", 10);
+		auto B = flip.add("B", 10);
+		flip.add(A >> 1 >>= B);
+		flip.add(B >> 1 >>= A);
+		flip.compile();
+		auto single = coro::thread_pool(coro::thread_pool::options{ .thread_count = 1 });
+		std::stop_source stop;
+		std::vector<coro::task<std::size_t>> runs;
+		runs.push_back(events_when_done(flip.simulate_async(single, 1, { .event_budget = 100'000'000 }, stosim::SimulationAlgorithm::direct, 0, { .yield_interval = 64, .stop_token = stop.get_token() })));
+		runs.push_back(events_when_done(flip.simulate_async(single, 1, { .event_budget = 1000 }, stosim::SimulationAlgorithm::direct, 1, { .yield_interval = 64 }), stop));
+		auto events = coro::sync_wait(all_events(std::move(runs)));
+		CHECK(events[1] == 1000);
+		CHECK(events[0] < 100'000'000);
+	}
+
+	SUBCASE("A search returns the accepted simulation with the lowest stream") {
+		/* The epidemic dies out before it reaches 20 infected */
+		auto stop = stosim::StopCondition{ .threshold = stosim::SpeciesThreshold{ .token = I.get_agent_token(), .high = 19 } };
+		auto accept = [](const stosim::VesselState&, stosim::StopReason reason) {
+			return reason == stosim::StopReason::exhausted;
+		};
+		std::optional<std::size_t> expected;
+		for (std::size_t i = 0; i < 100 && !expected.has_value(); i++) {
+			auto simulation = v.start(7, stosim::SimulationAlgorithm::direct, i);
+			if (accept(simulation.state(), simulation.run(stop))) {
+				expected = i;
+			}
+		}
+		REQUIRE(expected.has_value());
+		for (std::size_t concurrency : { 1, 3, 16 }) {
+			CAPTURE(concurrency);
+			auto found = coro::sync_wait(v.search_async(pool, 100, accept, stop, stosim::SimulationAlgorithm::direct, { .yield_interval = 8, .concurrency = concurrency, .seed = 7 }));
+			REQUIRE(found.has_value());
+			CHECK(found->index == expected.value());
+			CHECK(found->value.reason == stosim::StopReason::exhausted);
+		}
+
+		auto never = [](const stosim::VesselState&, stosim::StopReason) { return false; };
+		CHECK_FALSE(coro::sync_wait(v.search_async(pool, 20, never, stop, stosim::SimulationAlgorithm::direct, { .seed = 7 })).has_value());
+
+		std::stop_source stopped;
+		stopped.request_stop();
+		CHECK_FALSE(coro::sync_wait(v.search_async(pool, 20, accept, stop, stosim::SimulationAlgorithm::direct, { .stop_token = stopped.get_token(), .seed = 7 })).has_value());
+	}
+}
+
+TEST_CASE("Pipelines") {
+	SUBCASE("A ring keeps the order of every producer") {
+		auto ring = stosim::MpscRing<std::pair<int, int>>(5);
+		CHECK(ring.capacity() == 8);
+		std::vector<std::thread> producers;
+		for (int p = 0; p < 3; p++) {
+			producers.emplace_back([&ring, p]() {
+				for (int i = 0; i < 10000; i++) {
+					auto value = std::pair(p, i);
+					while (!ring.try_push(value)) {
+						std::this_thread::yield();
+					}
+				}
+			});
+		}
+		std::vector<int> next(3, 0);
+		for (int popped = 0; popped < 30000;) {
+			if (auto value = ring.try_pop()) {
+				CHECK(value->second == next[value->first]);
+				next[value->first]++;
+				popped++;
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+		for (auto& producer : producers) {
+			producer.join();
+		}
+		CHECK(!ring.try_pop().has_value());
+		CHECK(next == std::vector<int>{ 10000, 10000, 10000 });
+	}
+
+	auto v = stosim::Vessel("SEIR");
+	auto S = v.add("S", 200);
+	auto E = v.add("E", 0);
+	auto I = v.add("I", 5);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.005 >>= E + I);
+	v.add(E >> 0.5 >>= I);
+	v.add(I >> 0.2 >>= R);
+	v.compile();
+
+	SUBCASE("Every sink sees every state of every simulation") {
+		std::vector<std::size_t> counted(20, 0);
+		std::vector<std::size_t> last_batches(20, 0);
+		std::vector<stosim::VesselState> final_states(20);
+		auto pipeline = stosim::StatePipeline({
+			{ "count", [&](const stosim::StateBatch& batch) {
+				counted[batch.simulation] += batch.states.size();
+				last_batches[batch.simulation] += batch.last;
+			} },
+			{ "final", [&](const stosim::StateBatch& batch) {
+				if (!batch.states.empty()) {
+					final_states[batch.simulation] = batch.states.back();
+				}
+			} }
+		}, { .batch_size = 32, .queue_capacity = 4 });
+		v.simulate_into(pipeline, 20, {}, stosim::SimulationAlgorithm::direct, { .seed = 5 });
+		pipeline.close();
+
+		for (std::size_t i = 0; i < 20; i++) {
+			std::vector<stosim::VesselState> expected;
+			for (const auto& state : v.simulate(5, stosim::SimulationAlgorithm::direct, i)) {
+				expected.push_back(state);
+			}
+			CHECK(counted[i] == expected.size());
+			CHECK(last_batches[i] == 1);
+			CHECK(final_states[i].agent_count == expected.back().agent_count);
+		}
+
+		auto statistics = pipeline.statistics();
+		REQUIRE(statistics.size() == 2);
+		CHECK(statistics[0].name == "count");
+		CHECK(statistics[0].states == std::accumulate(counted.begin(), counted.end(), std::size_t{ 0 }));
+		CHECK(statistics[0].batches == statistics[1].batches);
+		CHECK(statistics[0].queue_depth == 0);
+		CHECK(statistics[0].max_queue_depth <= statistics[0].queue_capacity);
+	}
+
+	SUBCASE("A slow sink holds the producers back") {
+		auto pipeline = stosim::StatePipeline({
+			{ "slow", [](const stosim::StateBatch&) { std::this_thread::sleep_for(std::chrono::microseconds(200)); } }
+		}, { .batch_size = 4, .queue_capacity = 2 });
+		v.simulate_into(pipeline, 8, {}, stosim::SimulationAlgorithm::direct, { .seed = 5 });
+		pipeline.close();
+		auto statistics = pipeline.statistics();
+		CHECK(statistics[0].producer_waits > 0);
+		CHECK(statistics[0].max_queue_depth <= 2);
+		CHECK(statistics[0].throughput() > 0);
+	}
+
+	SUBCASE("An exception in a sink reaches close") {
+		auto pipeline = stosim::StatePipeline({
+			{ "failing", [](const stosim::StateBatch& batch) {
+				if (batch.simulation == 3) {
+					throw std::runtime_error("sink failed");
+				}
+			} }
+		}, { .batch_size = 8, .queue_capacity = 2 });
+		v.simulate_into(pipeline, 8, {}, stosim::SimulationAlgorithm::direct, { .seed = 5 });
+		CHECK_THROWS_AS(pipeline.close(), std::runtime_error);
+	}
+}
+
+TEST_CASE("Instrumentation") {
+	auto v = stosim::Vessel("SEIR");
+	auto S = v.add("S", 200);
+	auto E = v.add("E", 0);
+	auto I = v.add("I", 5);
+	auto R = v.add("R", 0);
+	v.add((S + I) >> 0.005 >>= E + I);
+	v.add(E >> 0.5 >>= I);
+	v.add(I >> 0.2 >>= R);
+	v.compile();
+
+	auto simulation = v.start(21, stosim::SimulationAlgorithm::next_reaction);
+	simulation.run({});
+	const auto& statistics = simulation.statistics();
+
+	auto ensemble = v.measure(10, {}, stosim::SimulationAlgorithm::direct, { .seed = 21 });
+	std::size_t states = 0;
+	for (std::size_t i = 0; i < 10; i++) {
+		for ([[maybe_unused]] const auto& state : v.simulate(21, stosim::SimulationAlgorithm::direct, i)) {
+			states++;
+		}
+	}
+
+	std::ostringstream json;
+	ensemble.write_json(json);
+	CHECK(json.str().starts_with("{\"instrumented\": "));
+	CHECK(json.str().ends_with("}"));
+
+	if constexpr (stosim::instrumentation_enabled) {
+		CHECK(statistics.simulations == 1);
+		CHECK(statistics.events == simulation.events());
+		REQUIRE(statistics.rule_events.size() == 3);
+		CHECK(statistics.rule_events[0] + statistics.rule_events[1] + statistics.rule_events[2] == statistics.events);
+		/* The next reaction method draws a delay for every rule once and then one per event at most */
+		CHECK(statistics.random_draws >= 3);
+		CHECK(statistics.queue_updates >= statistics.events);
+		CHECK(statistics.propensity_evaluations >= 3 + statistics.events);
+		CHECK(statistics.step_seconds > 0);
+
+		CHECK(ensemble.simulations == 10);
+		CHECK(ensemble.yields == states);
+		CHECK(ensemble.events == states - 10);
+		CHECK(ensemble.queue_updates == 0);
+		CHECK(json.str().find("\"simulations\": 10") != std::string::npos);
+	}
+	else {
+		CHECK(statistics.events == 0);
+		CHECK(statistics.rule_events.empty());
+		CHECK(ensemble.simulations == 0);
+		CHECK(ensemble.yields == 0);
+	}
+}